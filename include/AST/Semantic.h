@@ -27,8 +27,23 @@ public:
         return static_cast<Derived&>(*this);
     }
 
+    /// Do not visit the decls and macros in the given files, e.g. headers whose index is
+    /// already known. The files must outlive the visitor.
+    void skip(const llvm::DenseSet<clang::FileID>& files) {
+        skipped = &files;
+    }
+
+    bool isSkipped(clang::FileID fid) {
+        return skipped && skipped->contains(fid);
+    }
+
     bool needFilter(clang::SourceLocation location) {
-        return location.isInvalid() || (mainFileOnly && !srcMgr.isInMainFile(location));
+        if(location.isInvalid() || (mainFileOnly && !srcMgr.isInMainFile(location))) {
+            return true;
+        }
+
+        return skipped && !skipped->empty() &&
+               skipped->contains(srcMgr.getFileID(srcMgr.getExpansionLoc(location)));
     }
 
     /// Invoked when a declaration occur is seen in source code.
@@ -114,8 +129,12 @@ public:
     void run() {
         Base::TraverseAST(info.context());
 
-        for(auto directive: info.directives()) {
-            for(auto macro: directive.second.macros) {
+        for(auto& [fid, directive]: info.directives()) {
+            if(isSkipped(fid)) {
+                continue;
+            }
+
+            for(auto macro: directive.macros) {
                 switch(macro.kind) {
                     case MacroRef::Kind::Def: {
                         handleMacroOccurrence(macro.macro, RelationKind::Definition, macro.loc);
@@ -781,6 +800,7 @@ protected:
     clang::syntax::TokenBuffer& tokBuf;
     ASTInfo& info;
     llvm::SmallVector<clang::Decl*> decls;
+    const llvm::DenseSet<clang::FileID>* skipped = nullptr;
 };
 
 }  // namespace clice
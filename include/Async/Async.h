@@ -1,5 +1,6 @@
 #pragma once
 
 #include "Scheduler.h"
+#include "Cancellation.h"
 #include "FileSystem.h"
 #include "Network.h"
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "Scheduler.h"
+
+namespace clice::async {
+
+/// A token to cancel a running operation, e.g. a request superseded by a newer one.
+/// Copies of a token share the same state. `cancelled` is thread safe, so it could be
+/// polled in the thread pool (e.g. by the compiler). Other methods must be called in
+/// the loop thread. A default constructed token is never cancelled.
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    /// Create a token which could be cancelled.
+    static CancellationToken create() {
+        CancellationToken token;
+        token.state = std::make_shared<State>();
+        return token;
+    }
+
+    /// Whether the operation is cancelled.
+    bool cancelled() const noexcept {
+        return state && state->flag.load(std::memory_order_relaxed);
+    }
+
+    /// Cancel the operation and resume all coroutines waiting for the cancellation.
+    /// Do nothing if the token is already cancelled.
+    void cancel() {
+        if(state && !state->flag.exchange(true, std::memory_order_relaxed)) {
+            state->event.set();
+        }
+    }
+
+    /// Wait until the token is cancelled. Note that it never returns if the token
+    /// is not cancellable.
+    auto wait() {
+        assert(state && "wait: token is not cancellable");
+        return state->event.wait();
+    }
+
+    /// Get the flag shared by all copies, used by code which doesn't depend on async.
+    std::shared_ptr<const std::atomic<bool>> flag() const {
+        if(!state) {
+            return nullptr;
+        }
+        return {state, &state->flag};
+    }
+
+private:
+    struct State {
+        std::atomic<bool> flag = false;
+        Event event;
+    };
+
+    std::shared_ptr<State> state;
+};
+
+}  // namespace clice::async
@@ -13,7 +13,8 @@ class Task;
 
 using core_handle = std::coroutine_handle<>;
 
-/// Schedule the coroutine to resume in the event loop.
+/// Schedule the coroutine to resume in the event loop. Tasks are resumed in FIFO
+/// order, note that it is not thread safe and must be called in the loop thread.
 void schedule(core_handle core);
 
 namespace impl {
@@ -69,8 +69,15 @@ struct Mode : refl::Enum<Mode, true> {
                                       std::size_t size,
                                       Mode mode = Mode(Mode::Write, Mode::Create, Mode::Truncate));
 
+/// Rename the file asynchronously, the destination is replaced atomically if it exists.
+[[nodiscard]] AsyncResult<void> rename(std::string from, std::string to);
+
 struct Stats {
-    std::chrono::milliseconds mtime;
+    /// The last modification time, in full precision of the file system.
+    std::chrono::nanoseconds mtime;
+
+    /// The size of the file in bytes.
+    std::uint64_t size;
 };
 
 AsyncResult<Stats> stat(std::string path);
@@ -5,13 +5,57 @@
 #include "Coroutine.h"
 #include "Support/JSON.h"
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/FunctionExtras.h"
+#include "llvm/ADT/STLFunctionExtras.h"
 
 namespace clice::async::net {
 
 using Callback = llvm::unique_function<Task<void>(json::Value)>;
 
+/// A buffer to split the input stream into LSP messages. Data is read into the free
+/// space at the end of the buffer directly and messages are views of the buffer, so
+/// there is no copy. Consumed space is reclaimed when all data is consumed (the common
+/// case), otherwise the remaining partial message is moved to the front only if there
+/// is not enough free space.
+class MessageBuffer {
+public:
+    /// Get the free space at the end of buffer, which is at least `hint` bytes.
+    /// Note that all messages returned by `next` are invalidated.
+    llvm::MutableArrayRef<char> prepare(std::size_t hint);
+
+    /// Mark the first `size` bytes of the free space as filled.
+    void commit(std::size_t size) {
+        end += size;
+    }
+
+    /// Get the content of next complete message and consume it, return empty if there
+    /// is no complete message. Headers other than `Content-Length` are ignored. A frame
+    /// without `Content-Length` is dropped as a whole, bytes are skipped until the next
+    /// `Content-Length` header.
+    std::optional<llvm::StringRef> next();
+
+    /// The count of bytes which are not consumed.
+    std::size_t size() const {
+        return end - begin;
+    }
+
+private:
+    llvm::SmallVector<char, 0> buffer;
+
+    /// The range of unconsumed bytes.
+    std::size_t begin = 0;
+    std::size_t end = 0;
+
+    /// The total size of the incomplete message at the front, zero if unknown.
+    std::size_t expected = 0;
+
+    /// Whether the body of a frame without `Content-Length` is being skipped.
+    bool skipping = false;
+};
+
 /// Listen on stdin/stdout, callback is called when there is a LSP message available.
 void listen(Callback callback);
 
@@ -21,8 +65,38 @@ void listen(const char* ip, unsigned int port, Callback callback);
 /// Spawn a new process and listen on its stdin/stdout.
 void spawn(llvm::StringRef path, llvm::ArrayRef<std::string> args, Callback callback);
 
-/// Write a JSON value to the client.
+/// Write a JSON value to the client. Messages written in the same loop iteration are
+/// sent in one write, the coroutine is resumed after its message is written.
 Task<> write(json::Value value);
 
+/// Write a message whose content is produced by `serialize` to the client. The content is
+/// written into a reused buffer directly, e.g. by a `json::OStream`.
+Task<> write(llvm::function_ref<void(llvm::raw_ostream&)> serialize);
+
+/// The total bytes of messages which are written but not sent yet. Producers of many
+/// messages (e.g. progress report) could throttle themselves by it.
+std::size_t pending();
+
+/// Producers of many messages should stop writing once `pending` reaches it, until the
+/// client reads the sent ones.
+constexpr std::size_t highWaterMark = 1024 * 1024;
+
+struct Statistics {
+    /// The count of written messages, and the count of writes sending them. Messages
+    /// written in the same loop iteration are sent in one write.
+    std::size_t messages = 0;
+    std::size_t writes = 0;
+
+    /// The count of allocated serialization buffers, others are reused from the pool.
+    std::size_t allocations = 0;
+};
+
+/// Get the statistics of written messages.
+const Statistics& statistics();
+
+/// Write messages to the given stream instead, e.g. a pipe in tests. Note that `listen`
+/// and `spawn` set the stream to the connection.
+void redirect(uv_stream_t* stream);
+
 }  // namespace clice::async::net
 
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <tuple>
+#include <chrono>
+#include <vector>
 
 #include "libuv.h"
 #include "Coroutine.h"
+#include "ThreadPool.h"
 
 namespace clice::async {
 
@@ -81,26 +84,18 @@ struct thread_pool_base<void> {
 };
 
 template <typename Function, typename Ret>
-struct thread_pool : thread_pool_base<Ret> {
-    /// The libuv work request.
-    uv_work_t request;
-
+struct thread_pool : thread_pool_base<Ret>, impl::job {
     /// The function to run in the thread pool.
     Function function;
 
-    /// The coroutine handle waiting for the result.
-    core_handle waiting;
-
     bool await_ready() noexcept {
         return false;
     }
 
     void await_suspend(core_handle waiting) noexcept {
-        request.data = this;
         this->waiting = waiting;
-
-        auto work_cb = [](uv_work_t* work) {
-            auto& awaiter = *static_cast<thread_pool*>(work->data);
+        this->run = [](impl::job* job) {
+            auto& awaiter = static_cast<thread_pool&>(*job);
             if constexpr(!std::is_void_v<Ret>) {
                 awaiter.value.emplace(awaiter.function());
             } else {
@@ -108,44 +103,272 @@ struct thread_pool : thread_pool_base<Ret> {
             }
         };
 
-        auto after_work_cb = [](uv_work_t* work, int status) {
-            auto& awaiter = *static_cast<thread_pool*>(work->data);
-            async::schedule(awaiter.waiting);
-        };
-
-        uv_queue_work(uv_default_loop(), &request, work_cb, after_work_cb);
+        /// The waiting coroutine is scheduled in the event loop after the job is done.
+        this->enqueue();
     }
 };
 
 }  // namespace impl::awaiter
 
+/// Run the callback in the thread pool with the given priority and resume the
+/// current coroutine in the event loop when it is done.
 template <std::invocable<> Callback, typename R = std::invoke_result_t<Callback>>
-auto submit(Callback&& callback) {
+auto submit(Priority priority, Callback&& callback) {
     using C = std::remove_cvref_t<Callback>;
-    return impl::awaiter::thread_pool<C, R>{{}, {}, std::forward<Callback>(callback)};
+    return impl::awaiter::thread_pool<C, R>{
+        {},
+        {nullptr, nullptr, priority},
+        std::forward<Callback>(callback),
+    };
 }
 
-class Lock {
+/// Same as above, but run with background priority.
+template <std::invocable<> Callback, typename R = std::invoke_result_t<Callback>>
+auto submit(Callback&& callback) {
+    return submit(Priority::Background, std::forward<Callback>(callback));
+}
+
+namespace impl {
+
+/// A parked coroutine, the node lives in the awaiter (i.e. the frame of the
+/// waiting coroutine), so parking never allocates.
+struct waiter {
+    core_handle handle;
+    waiter* next = nullptr;
+};
+
+/// An intrusive FIFO of parked coroutines.
+class wait_queue {
+public:
+    bool empty() const noexcept {
+        return head == nullptr;
+    }
+
+    void push(waiter* node) noexcept {
+        node->next = nullptr;
+        if(tail) {
+            tail->next = node;
+        } else {
+            head = node;
+        }
+        tail = node;
+    }
+
+    waiter* pop() noexcept {
+        auto node = head;
+        head = node->next;
+        if(!head) {
+            tail = nullptr;
+        }
+        return node;
+    }
+
+private:
+    waiter* head = nullptr;
+    waiter* tail = nullptr;
+};
+
+}  // namespace impl
+
+/// A mutex for coroutines in the event loop. Waiters are parked in FIFO order and
+/// the ownership is handed to the first waiter directly on unlock, so each waiter
+/// is resumed exactly once. Note that a parked coroutine must not be destroyed.
+class Mutex {
+public:
+    /// Unlock the mutex when destroyed, so an early `co_return` is safe.
+    class Guard {
+    public:
+        explicit Guard(Mutex& mutex) : mutex(&mutex) {}
+
+        Guard(const Guard&) = delete;
+
+        Guard(Guard&& other) noexcept : mutex(other.mutex) {
+            other.mutex = nullptr;
+        }
+
+        ~Guard() {
+            if(mutex) {
+                mutex->unlock();
+            }
+        }
+
+    private:
+        Mutex* mutex;
+    };
+
+    Mutex() = default;
+
+    Mutex(const Mutex&) = delete;
+
+    /// Acquire the mutex, use as `auto guard = co_await mutex.lock();`.
+    auto lock() noexcept {
+        struct lock_awaiter : impl::waiter {
+            Mutex& mutex;
+
+            bool await_ready() noexcept {
+                if(!mutex.locked) {
+                    mutex.locked = true;
+                    return true;
+                }
+                return false;
+            }
+
+            void await_suspend(core_handle handle) noexcept {
+                this->handle = handle;
+                mutex.waiters.push(this);
+            }
+
+            Guard await_resume() noexcept {
+                return Guard(mutex);
+            }
+        };
+
+        return lock_awaiter{{}, *this};
+    }
+
+    void unlock() noexcept {
+        assert(locked && "unlock: mutex is not locked");
+        if(waiters.empty()) {
+            locked = false;
+        } else {
+            /// Keep locked and pass the ownership to the next waiter.
+            async::schedule(waiters.pop()->handle);
+        }
+    }
+
+    bool isLocked() const noexcept {
+        return locked;
+    }
+
+private:
+    bool locked = false;
+    impl::wait_queue waiters;
+};
+
+/// A counting semaphore for coroutines in the event loop, e.g. bounding the count
+/// of concurrent compilations. Like `Mutex`, a released permit is handed to the
+/// first waiter directly.
+class Semaphore {
+public:
+    explicit Semaphore(std::size_t count) : count(count) {}
+
+    Semaphore(const Semaphore&) = delete;
+
+    /// Acquire a permit, wait if there is no available permit.
+    auto acquire() noexcept {
+        struct acquire_awaiter : impl::waiter {
+            Semaphore& semaphore;
+
+            bool await_ready() noexcept {
+                if(semaphore.count > 0) {
+                    semaphore.count -= 1;
+                    return true;
+                }
+                return false;
+            }
+
+            void await_suspend(core_handle handle) noexcept {
+                this->handle = handle;
+                semaphore.waiters.push(this);
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        return acquire_awaiter{{}, *this};
+    }
+
+    void release() noexcept {
+        if(waiters.empty()) {
+            count += 1;
+        } else {
+            async::schedule(waiters.pop()->handle);
+        }
+    }
+
+    /// The count of available permits.
+    std::size_t available() const noexcept {
+        return count;
+    }
+
+private:
+    std::size_t count;
+    impl::wait_queue waiters;
+};
+
+/// A manual reset event for coroutines in the event loop. All waiters are resumed
+/// when the event is set, and later waiters don't wait until it is reset.
+class Event {
 public:
-    Lock(bool& locked) : locked(locked) {}
+    Event() = default;
+
+    Event(const Event&) = delete;
+
+    auto wait() noexcept {
+        struct wait_awaiter : impl::waiter {
+            Event& event;
+
+            bool await_ready() noexcept {
+                return event.flag;
+            }
+
+            void await_suspend(core_handle handle) noexcept {
+                this->handle = handle;
+                event.waiters.push(this);
+            }
+
+            void await_resume() noexcept {}
+        };
 
-    Task<void> operator co_await() {
-        while(locked) {
-            co_await async::suspend([](core_handle handle) { async::schedule(handle); });
+        return wait_awaiter{{}, *this};
+    }
+
+    void set() noexcept {
+        flag = true;
+        while(!waiters.empty()) {
+            async::schedule(waiters.pop()->handle);
         }
-        locked = true;
     }
 
-    void unlock() {
-        locked = false;
+    void reset() noexcept {
+        flag = false;
     }
 
-    ~Lock() {
-        locked = false;
+    bool isSet() const noexcept {
+        return flag;
     }
 
 private:
-    bool& locked;
+    bool flag = false;
+    impl::wait_queue waiters;
 };
 
+/// Run a dynamic count of tasks concurrently and wait for all of them.
+inline Task<> when_all(std::vector<Task<>> tasks) {
+    std::size_t running = tasks.size();
+    Event finished;
+
+    auto wait = [&](Task<>& task) -> Task<> {
+        co_await task;
+        running -= 1;
+        if(running == 0) {
+            finished.set();
+        }
+    };
+
+    std::vector<Task<>> waiters;
+    waiters.reserve(tasks.size());
+    for(auto& task: tasks) {
+        waiters.emplace_back(wait(task));
+        async::schedule(waiters.back().handle());
+    }
+
+    if(running != 0) {
+        co_await finished.wait();
+    }
+}
+
+/// Suspend the current coroutine for the given duration, other coroutines keep running.
+Task<> sleep(std::chrono::milliseconds duration);
+
 }  // namespace clice::async
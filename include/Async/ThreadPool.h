@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Coroutine.h"
+
+namespace clice::async {
+
+/// The priority lane of a job submitted to the thread pool. Workers always take
+/// interactive jobs before background jobs, e.g. compiling for code completion
+/// jumps ahead of all queued indexing jobs.
+enum class Priority : std::uint8_t {
+    Interactive = 0,
+    Background,
+};
+
+namespace impl {
+
+/// A job running in the thread pool. The job is embedded in the awaiter, so
+/// submitting never allocates.
+struct job {
+    /// Run the job in the worker thread.
+    void (*run)(job* self);
+
+    /// The coroutine waiting for the job, resumed in the event loop.
+    core_handle waiting;
+
+    Priority priority;
+
+    /// Push the job into the thread pool, must be called in the loop thread.
+    void enqueue();
+};
+
+}  // namespace impl
+
+/// Set the count of worker threads. Zero means the count of hardware threads. It
+/// only takes effect before the first job is submitted.
+void init_thread_pool(std::size_t threads);
+
+}  // namespace clice::async
@@ -53,8 +53,9 @@ struct VersionedTextDocumentIdentifier {
 /// An event describing a change to a text document. If only a text is provided
 /// it is considered to be the full content of the document.
 struct TextDocumentContentChangeEvent {
-    /// The range of the document that changed.
-    Range range;
+    /// The range of the document that changed, the whole document is replaced if it
+    /// is absent.
+    std::optional<Range> range;
 
     /// The new text for the provided range.
     string text;
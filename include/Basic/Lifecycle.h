@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Workspace.h"
+#include "Progress.h"
 #include "Feature/Lookup.h"
 #include "Feature/DocumentHighlight.h"
 #include "Feature/DocumentLink.h"
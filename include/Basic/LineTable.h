@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+/// A precomputed table of line start offsets of a file content. Build it once per
+/// content version, then the line of any offset can be found by binary search instead
+/// of scanning from the file beginning. Each line also records whether it only contains
+/// ASCII characters, in which case the column doesn't need to be remeasured for UTF-16
+/// and UTF-32 encoding. The table doesn't own the content, it must outlive the table.
+class LineTable {
+public:
+    explicit LineTable(llvm::StringRef content);
+
+    /// The content this table is built from.
+    llvm::StringRef content() const {
+        return text;
+    }
+
+    /// The count of lines, an empty content has one line.
+    std::uint32_t lineCount() const {
+        return starts.size();
+    }
+
+    /// Get the 0-based line which the offset belongs to. The offset of a newline
+    /// character belongs to the line it ends.
+    std::uint32_t lineOf(std::uint32_t offset) const;
+
+    /// Get the offset of the first character of the line.
+    std::uint32_t lineStart(std::uint32_t line) const {
+        return starts[line];
+    }
+
+    /// Whether all characters in the line are ASCII.
+    bool isASCII(std::uint32_t line) const {
+        return !nonASCII[line];
+    }
+
+    /// The bytes used by the table itself, not including the content.
+    std::size_t memoryUsage() const {
+        return starts.capacity() * sizeof(std::uint32_t) + nonASCII.getMemorySize();
+    }
+
+private:
+    llvm::StringRef text;
+
+    /// The start offset of each line, sorted.
+    std::vector<std::uint32_t> starts;
+
+    /// Whether each line contains any non-ASCII character.
+    llvm::BitVector nonASCII;
+};
+
+}  // namespace clice
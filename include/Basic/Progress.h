@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Basic.h"
+
+namespace clice::proto {
+
+using ProgressToken = string;
+
+struct WorkDoneProgressCreateParams {
+    /// The token to be used to report progress.
+    ProgressToken token;
+};
+
+struct WorkDoneProgressBegin {
+    string kind = "begin";
+
+    /// Mandatory title of the progress operation. Used to briefly inform about the kind
+    /// of operation being performed.
+    string title;
+
+    /// Controls if a cancel button should show to allow the user to cancel the long
+    /// running operation.
+    bool cancellable = false;
+
+    /// Optional, more detailed associated progress message.
+    string message;
+
+    /// Optional progress percentage to display (value 100 is considered 100%).
+    uinteger percentage = 0;
+};
+
+struct WorkDoneProgressReport {
+    string kind = "report";
+
+    /// Optional, more detailed associated progress message.
+    string message;
+
+    /// Optional progress percentage to display (value 100 is considered 100%).
+    uinteger percentage = 0;
+};
+
+struct WorkDoneProgressEnd {
+    string kind = "end";
+
+    /// Optional, a final message indicating to for example indicate the outcome of the
+    /// operation.
+    string message;
+};
+
+template <typename T>
+struct ProgressParams {
+    /// The progress token provided by the client or server.
+    ProgressToken token;
+
+    /// The progress data.
+    T value;
+};
+
+}  // namespace clice::proto
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Basic/LineTable.h"
 #include "Basic/Location.h"
 #include "Basic/SourceCode.h"
 #include "clang/Basic/SourceLocation.h"
@@ -30,6 +31,16 @@ public:
     /// Same as the below, but input is raw offset to the content beginning.
     proto::Position toPosition(llvm::StringRef content, std::uint32_t offset) const;
 
+    /// Same as the above, but the line is found by binary search in the precomputed
+    /// table. Prefer this when converting many offsets of the same content.
+    proto::Position toPosition(const LineTable& lines, std::uint32_t offset) const;
+
+    /// Convert a batch of offsets in ascending order to positions, the table is walked
+    /// only once and the columns in the same line are measured incrementally.
+    void toPositions(const LineTable& lines,
+                     llvm::ArrayRef<std::uint32_t> offsets,
+                     std::vector<proto::Position>& positions) const;
+
     /// Convert a clang::SourceLocation to a proto::Position according to the
     /// specified encoding kind. Note that `SourceLocation` in clang is 1-based and
     /// is always encoded in UTF-8.
@@ -42,6 +53,9 @@ public:
     /// Same as the above, but input is a `LocalSourceRange` and the content is provided.
     proto::Range toRange(LocalSourceRange range, llvm::StringRef conent) const;
 
+    /// Same as the above, but use the precomputed line table.
+    proto::Range toRange(LocalSourceRange range, const LineTable& lines) const;
+
     /// Convert a clang::SourceRange to LocalSourceRange.
     LocalSourceRange toLocalRange(clang::SourceRange range, const clang::SourceManager& SM) const;
 
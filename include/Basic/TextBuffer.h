@@ -0,0 +1,130 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Basic/Document.h"
+#include "Basic/LineTable.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace clice {
+
+class SourceConverter;
+
+/// An immutable version of the text of a document, shared by its consumers, e.g. the
+/// compiler and the AST built from it. The content is always null terminated, so it
+/// could be used as a compiler buffer without copying.
+class TextSnapshot {
+public:
+    explicit TextSnapshot(std::string text) : text(std::move(text)), table(this->text) {}
+
+    TextSnapshot(const TextSnapshot&) = delete;
+
+    llvm::StringRef content() const {
+        return text;
+    }
+
+    /// The line table of this version.
+    const LineTable& lines() const {
+        return table;
+    }
+
+    /// A memory buffer referring to the content, the snapshot must outlive it.
+    std::unique_ptr<llvm::MemoryBuffer> buffer(llvm::StringRef name) const {
+        return llvm::MemoryBuffer::getMemBuffer(text, name);
+    }
+
+private:
+    std::string text;
+    LineTable table;
+};
+
+/// The text of an opened document, edited by LSP incremental changes.
+///
+/// It is a piece table, pieces refer to either the last snapshot or the blocks of the
+/// inserted text, which are append only and never move. An edit only splits the pieces
+/// around it, the whole text is never copied. Typing at the end of the last insertion
+/// extends its piece rather than adding a new one. Line starts are maintained with the
+/// edits, so positions are converted without scanning the text.
+///
+/// The text is flattened only in `snapshot`, i.e. when a consumer really needs the
+/// content of a version, or when there are too many pieces.
+class TextBuffer {
+public:
+    explicit TextBuffer(std::string content = "");
+
+    TextBuffer(TextBuffer&&) = default;
+
+    TextBuffer& operator= (TextBuffer&&) = default;
+
+    /// The size of the text in bytes.
+    std::uint32_t size() const {
+        return length;
+    }
+
+    /// The count of lines, an empty text has one line.
+    std::uint32_t lineCount() const {
+        return starts.size();
+    }
+
+    /// The count of pieces, for statistics.
+    std::size_t pieceCount() const {
+        return pieces.size();
+    }
+
+    /// Replace the text in [begin, end) with `text`.
+    void replace(std::uint32_t begin, std::uint32_t end, llvm::StringRef text);
+
+    /// Apply an incremental change, positions are measured by the converter. A change
+    /// without range is a full replacement.
+    void apply(const proto::TextDocumentContentChangeEvent& change,
+               const SourceConverter& converter);
+
+    /// Convert the position to the offset in the text, the position is clamped to the
+    /// end of its line and the end of the text.
+    std::uint32_t offset(proto::Position position, const SourceConverter& converter) const;
+
+    /// Copy the text in [begin, end) to `out`.
+    void read(std::uint32_t begin, std::uint32_t end, std::string& out) const;
+
+    /// Get the snapshot of the current text. It is flattened at most once per version,
+    /// the snapshot is reused until the next edit.
+    std::shared_ptr<const TextSnapshot> snapshot();
+
+private:
+    struct Piece {
+        const char* data;
+        std::uint32_t length;
+    };
+
+    /// Find the piece containing the offset, return its index and the offset in it. The
+    /// offset at the end of the text belongs to the end of the last piece.
+    std::pair<std::size_t, std::uint32_t> find(std::uint32_t offset) const;
+
+    /// Copy the text to the insertion blocks and return the copy.
+    const char* append(llvm::StringRef text);
+
+    /// Flatten all pieces into a new snapshot.
+    void flatten();
+
+    /// The last snapshot, null if edited after it.
+    std::shared_ptr<const TextSnapshot> current;
+
+    /// The snapshot the pieces refer to.
+    std::shared_ptr<const TextSnapshot> base;
+
+    /// Blocks of inserted text, the last one is being appended.
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::uint32_t used = 0;
+    std::uint32_t capacity = 0;
+
+    std::vector<Piece> pieces;
+
+    std::uint32_t length = 0;
+
+    /// The start offset of each line, sorted.
+    std::vector<std::uint32_t> starts;
+};
+
+}  // namespace clice
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Basic.h"
+#include "Support/Enum.h"
 
 namespace clice::proto {
 
@@ -13,6 +14,47 @@ struct WorkspaceFolder {
     std::string name;
 };
 
-struct DidChangeWatchedFilesParams {};
+struct FileChangeType : refl::Enum<FileChangeType> {
+    enum Kind : uint8_t {
+        Invalid = 0,
+
+        /// The file got created.
+        Created,
+
+        /// The file got changed.
+        Changed,
+
+        /// The file got deleted.
+        Deleted,
+    };
+
+    using Enum::Enum;
+
+    constexpr inline static auto InvalidEnum = Invalid;
+};
+
+/// An event describing a file change.
+struct FileEvent {
+    /// The file's URI.
+    URI uri;
+
+    /// The change type.
+    FileChangeType type;
+};
+
+struct FileSystemWatcher {
+    /// The glob pattern to watch, relative to the workspace folders.
+    std::string globPattern;
+};
+
+struct DidChangeWatchedFilesRegistrationOptions {
+    /// The watchers to register, all kinds of changes are reported.
+    std::vector<FileSystemWatcher> watchers;
+};
+
+struct DidChangeWatchedFilesParams {
+    /// The actual file events.
+    std::vector<FileEvent> changes;
+};
 
 }  // namespace clice::proto
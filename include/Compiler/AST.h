@@ -77,6 +77,11 @@ public:
 
     std::vector<std::string> deps();
 
+    /// The approximate memory (in bytes) used by this AST, including the allocators of
+    /// ASTContext, SourceManager, Preprocessor and the token buffer. Memory mapped
+    /// files are not counted.
+    std::size_t memory();
+
 private:
     /// The interested file ID.
     clang::FileID interested;
@@ -1,11 +1,23 @@
 #pragma once
 
+#include <string>
 #include <expected>
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/StringSaver.h"
 
 namespace clice {
 
+/// Split a shell-escaped command with the rules of the host, like the compilers do. On
+/// Windows backslashes are path separators, only those before a double quote escape.
+void tokenizeCommand(llvm::StringRef command,
+                     llvm::StringSaver& saver,
+                     llvm::SmallVectorImpl<const char*>& out);
+
+/// Append the argument to the command, quoted if necessary so that `tokenizeCommand`
+/// splits it back.
+void appendArgument(std::string& command, llvm::StringRef arg);
+
 /// Processes and adjusts a raw compile command from compile_commands.json.
 ///
 /// This function tokenizes the input command, removes unnecessary arguments,
@@ -18,4 +30,11 @@ std::expected<void, std::string> mangleCommand(llvm::StringRef command,
                                                llvm::SmallVectorImpl<const char*>& out,
                                                llvm::SmallVectorImpl<char>& buffer);
 
+/// Check whether the argument of a command refers to the source file. Both paths are made
+/// absolute against the current working directory and normalized before comparing, then
+/// files with the same name are compared by identity so that symbolic links to the
+/// directory are handled. Note that relative arguments of commands in the database are
+/// already rebased onto their directories.
+bool isInputFile(llvm::StringRef arg, llvm::StringRef srcPath);
+
 }  // namespace clice
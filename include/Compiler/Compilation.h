@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 #include "AST.h"
 #include "Module.h"
 #include "Preamble.h"
@@ -11,6 +13,11 @@ struct CompilationParams {
     /// Source file content.
     llvm::StringRef content;
 
+    /// Whether the content outlives the compilation and is null terminated, e.g. it is
+    /// a `TextSnapshot` kept alive by the AST. Then the compiler refers to it directly
+    /// rather than copying it.
+    bool borrowContent = false;
+
     /// Source file path.
     llvm::SmallString<128> srcPath;
 
@@ -26,6 +33,10 @@ struct CompilationParams {
     /// `#include` directive that includes the header to speed up the parsing.
     std::optional<std::uint32_t> bound;
 
+    /// The file interested by the caller, i.e. the header built in the context of `srcPath`.
+    /// Features of the AST are collected from it, empty means the main file.
+    llvm::SmallString<128> interested;
+
     llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs = new ThreadSafeFS();
 
     /// Remapped files. Currently, this is only used for testing.
@@ -34,6 +45,9 @@ struct CompilationParams {
     /// Information about reuse PCH.
     std::pair<std::string, uint32_t> pch;
 
+    /// The preamble patch included right after the PCH, see `computePreamblePatch`.
+    std::string patch;
+
     /// Information about reuse PCM(name, path).
     llvm::StringMap<std::string> pcms;
 
@@ -41,11 +55,33 @@ struct CompilationParams {
     llvm::StringRef file = "";
     uint32_t line = 0;
     uint32_t column = 0;
+
+    /// Set by another thread to cancel the compilation, it is checked between top level
+    /// declarations. See `async::CancellationToken::flag`.
+    std::shared_ptr<const std::atomic<bool>> cancelled;
 };
 
 namespace impl {
 
-/// Create a compiler invocation from the given compilation parameters.
+struct InvocationCacheStatistics {
+    /// The count of invocations copied from the cache.
+    std::size_t hits = 0;
+
+    /// The count of invocations created by running the driver.
+    std::size_t misses = 0;
+
+    /// The count of cached invocations.
+    std::size_t size = 0;
+};
+
+/// Get the statistics of the invocation cache used by `createInvocation`.
+InvocationCacheStatistics invocationCacheStatistics();
+
+/// Clear the invocation cache and its statistics, e.g. the resource directory changed.
+void clearInvocationCache();
+
+/// Create a compiler invocation from the given compilation parameters. The invocation
+/// parsed from the same arguments (except the input file) is cached and copied.
 std::unique_ptr<clang::CompilerInvocation> createInvocation(CompilationParams& params);
 
 /// Create a compiler instance from the given compilation parameters.
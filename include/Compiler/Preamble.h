@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <optional>
 #include <expected>
 
 #include "llvm/ADT/StringRef.h"
@@ -28,11 +29,29 @@ struct PCHInfo {
 
 std::uint32_t computePreambleBound(llvm::StringRef content);
 
-/// Computes the preamble bounds for the given content.
-/// If the bounds are not provided explicitly, they will be calculated based on the content.
-///
-/// - If the header is empty, the bounds can be determined by lexing the source file.
-/// - If the header is not empty, the preprocessor must be executed to compute the bounds.
-std::uint32_t computeBounds(CompilationParams& params);
+struct PreamblePatch {
+    /// The content of the patch, it should be included right after the PCH.
+    std::string content;
+
+    /// The count of added and removed `#include` directives.
+    std::uint32_t added = 0;
+    std::uint32_t removed = 0;
+};
+
+/// Compute the patch to reuse the PCH built from preamble `old` for the new `preamble`
+/// of `file`. It is possible only if they differ in `#include` directives (and whitespace
+/// or comments), directives are found by the raw lexer so those in comments are ignored. Added headers are included by the patch with line markers pointing to the
+/// main file. Removed headers are not patched, their declarations are still visible
+/// from the PCH until it is rebuilt. The patch is included unconditionally, so it is not
+/// possible if any added or removed directive is in a conditional block.
+std::optional<PreamblePatch> computePreamblePatch(llvm::StringRef old,
+                                                  llvm::StringRef preamble,
+                                                  llvm::StringRef file);
+
+/// Computes the bound to cut off the source file `content` right after the directive at
+/// `line`(1-based), i.e. the `#include` that introduces the header being edited, see
+/// `CompilationParams::bound`. The line could be got from the include locations of the
+/// header context. Return the size of content if the line is 0 or out of range.
+std::uint32_t computeBounds(llvm::StringRef content, std::uint32_t line);
 
 }  // namespace clice
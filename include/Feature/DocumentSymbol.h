@@ -105,7 +105,7 @@ namespace feature {
 
 json::Value documentSymbolCapability(json::Value clientCapabilities);
 
-/// Run document symbol in given file.
+/// Run document symbol in the interested file, see `ASTInfo::getInterestedFile`.
 proto::DocumentSymbolResult documentSymbol(ASTInfo& info, const SourceConverter& converter);
 
 }  // namespace feature
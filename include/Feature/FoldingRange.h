@@ -85,7 +85,7 @@ using Result = std::vector<FoldingRange>;
 /// Generate folding range for all files.
 index::Shared<Result> foldingRange(ASTInfo& info, const SourceConverter& converter);
 
-/// Return folding range in main file.
+/// Return folding range in the interested file, see `ASTInfo::getInterestedFile`.
 Result foldingRange(FoldingRangeParams& params, ASTInfo& info, const SourceConverter& converter);
 
 /// Convert folding range to LSP format.
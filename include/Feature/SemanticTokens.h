@@ -57,8 +57,9 @@ struct SemanticToken {
     SymbolModifiers modifiers;
 };
 
-/// Generate semantic tokens for all files.
-index::Shared<std::vector<SemanticToken>> semanticTokens(ASTInfo& info);
+/// Generate semantic tokens for all files except the skipped ones.
+index::Shared<std::vector<SemanticToken>>
+    semanticTokens(ASTInfo& info, const llvm::DenseSet<clang::FileID>& skipped = {});
 
 /// Translate semantic tokens to LSP format.
 proto::SemanticTokens toSemanticTokens(llvm::ArrayRef<SemanticToken> tokens,
@@ -66,6 +67,12 @@ proto::SemanticTokens toSemanticTokens(llvm::ArrayRef<SemanticToken> tokens,
                                        llvm::StringRef content,
                                        const config::SemanticTokensOption& option);
 
+/// Same as above, but use the precomputed line table of the content.
+proto::SemanticTokens toSemanticTokens(llvm::ArrayRef<SemanticToken> tokens,
+                                       SourceConverter& SC,
+                                       const LineTable& lines,
+                                       const config::SemanticTokensOption& option);
+
 /// Generate semantic tokens for main file and translate to LSP format.
 proto::SemanticTokens semanticTokens(ASTInfo& info,
                                      SourceConverter& SC,
@@ -38,6 +38,8 @@ public:
     bool own;
 };
 
-Shared<FeatureIndex> indexFeature(ASTInfo& info);
+/// Index the features of all files of the AST except the skipped ones, see `index`.
+Shared<FeatureIndex> indexFeature(ASTInfo& info,
+                                  const llvm::DenseSet<clang::FileID>& skipped = {});
 
 }  // namespace clice::index
@@ -90,6 +90,8 @@ public:
     bool own;
 };
 
-Shared<SymbolIndex> index(ASTInfo& info);
+/// Index all files of the AST except the skipped ones, e.g. headers whose index is
+/// already known.
+Shared<SymbolIndex> index(ASTInfo& info, const llvm::DenseSet<clang::FileID>& skipped = {});
 
 }  // namespace clice::index
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "Async/Async.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/FunctionExtras.h"
+#include "llvm/Support/xxhash.h"
+
+namespace clice {
+
+/// A content-addressed store of index files. An index is identified by the hashes of its
+/// symbol and feature index, and its files are named by them, so identical indices of all
+/// headers and translation units are stored once on disk.
+///
+/// Each index is reference counted by its users. An unreferenced index is not removed at
+/// once, it could be acquired again by the next index of the same file without writing.
+/// The files are removed from disk by `collect`.
+///
+/// The files of an index are written or removed by one coroutine at a time, others using
+/// the same index wait for it, see `ensure` and `collect`.
+class BlobStore {
+public:
+    explicit BlobStore(llvm::StringRef dir) : dir(dir) {}
+
+    /// The key of the index with the given hashes.
+    static std::uint64_t key(llvm::XXH128_hash_t symbolHash, llvm::XXH128_hash_t featureHash);
+
+    /// The index file path of the key(not include suffix, e.g. `.sidx` and `.fidx`).
+    std::string path(std::uint64_t key) const;
+
+    /// Add a reference to the index. Set `written` if its files are known to be on disk,
+    /// e.g. the index is restored from the saved index information.
+    void acquire(std::uint64_t key, bool written = false);
+
+    /// Remove a reference to the index.
+    void release(std::uint64_t key);
+
+    /// Make sure the files of the referenced index are on disk, call `write` with the path
+    /// to write them if not. If they are being written or removed by others, wait for it
+    /// first. Return false if failed to write, then the next call writes them again.
+    async::Task<bool> ensure(std::uint64_t key,
+                             llvm::unique_function<async::Task<bool>(std::string)> write);
+
+    /// The reference count of the index, zero if unknown.
+    std::uint32_t references(std::uint64_t key) const {
+        auto iter = blobs.find(key);
+        return iter == blobs.end() ? 0 : iter->second.refs;
+    }
+
+    /// The count of indices on disk, including unreferenced ones not collected yet.
+    std::size_t size() const {
+        return blobs.size();
+    }
+
+    /// Remove the files of all unreferenced indices with `remove`, which is called with
+    /// the paths of them. They could not be acquired by others until removed. Return the
+    /// count of removed indices.
+    async::Task<std::size_t>
+        collect(llvm::unique_function<async::Task<>(std::vector<std::string>)> remove);
+
+    /// Forget all indices, e.g. before the references are rebuilt from the loaded index.
+    void clear() {
+        blobs.clear();
+    }
+
+private:
+    /// The directory of index files.
+    std::string dir;
+
+    struct Blob {
+        /// The reference count of the index.
+        std::uint32_t refs = 0;
+
+        /// Whether the files are on disk.
+        bool written = false;
+
+        /// Set while the files are being written or removed.
+        std::shared_ptr<async::Event> busy;
+    };
+
+    llvm::DenseMap<std::uint64_t, Blob> blobs;
+};
+
+}  // namespace clice
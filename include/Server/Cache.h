@@ -1,9 +1,10 @@
 #pragma once
 
-#include <deque>
+#include <unordered_map>
 
-#include "Async/Async.h"
+#include "Config.h"
 #include "Database.h"
+#include "Async/Async.h"
 #include "Compiler/Module.h"
 #include "Compiler/Preamble.h"
 
@@ -11,50 +12,163 @@
 
 namespace clice {
 
-struct CacheOption {
-    /// The directory to store the cache files.
-    std::string dir;
-};
-
 /// This class is responsible for PCH and PCM building.
+///
+/// PCHs are content addressed, the key of a PCH is the hash of its preamble and the
+/// (mangled) command. Translation units with the same preamble and command share one
+/// PCH. A PCH is reused only if the modification time of all its dependencies are not
+/// changed since it is built.
+///
+/// PCMs are built on demand following the import graph, see `preparePCM`. Only modules
+/// whose source, command or imported modules changed are rebuilt. Modules in a cycle
+/// are never built, the cycle is detected on the graph of modules waiting for others.
 class CacheController {
 public:
-    CacheController(CacheOption& option, CompilationDatabase& database);
+    CacheController(const config::CacheOptions& options, CompilationDatabase& database) :
+        options(options), database(database) {}
 
-    /// Generate `cache.json` to store the cache information.
+    /// Load the cache information from `cache.json`.
     void loadFromDisk();
 
-    /// Load the cache information from `cache.json`.
+    /// Generate `cache.json` to store the cache information.
     void saveToDisk();
 
     /// Complete the PCH or PCM information required for the compilation arguments.
-    /// If no suitable PCH or PCM is available, a build will be triggered.
-    async::Task<> prepare(CompilationParams& params);
+    /// If no suitable PCH or PCM is available, a build will be triggered. The PCH is
+    /// referenced by `file`, default to `params.srcPath`. If `params.bound` is set, the
+    /// PCH covers the preamble before the directive at the bound, see `computeBounds`.
+    async::Task<> prepare(CompilationParams& params, llvm::StringRef file = "");
+
+    /// Release the PCH referenced by the file, e.g. the file is closed.
+    void release(llvm::StringRef file);
+
+    struct Statistics {
+        /// The PCH is reused directly.
+        std::uint32_t hits = 0;
+
+        /// The PCH is reused with a preamble patch, see `computePreamblePatch`.
+        std::uint32_t patches = 0;
+
+        /// A new PCH is built.
+        std::uint32_t misses = 0;
+    };
+
+    const Statistics& statistics() const {
+        return stats;
+    }
+
+    /// Remove unreferenced PCHs (least recently used first) until the count of PCHs
+    /// is within `CacheOptions::limit`.
+    void collect();
 
     async::Task<> updatePCH();
 
 private:
-    const CacheOption& option;
+    /// Find a reusable PCH with given key, the file references it if found.
+    async::Task<std::optional<std::string>> reusePCH(llvm::StringRef file,
+                                                     std::uint64_t key,
+                                                     llvm::StringRef preamble);
+
+    /// Try to reuse the PCH currently referenced by the file with a preamble patch, it
+    /// is possible if only `#include` directives are changed.
+    async::Task<bool> patchPCH(CompilationParams& params,
+                               llvm::StringRef file,
+                               std::uint32_t bound);
+
+    /// Build a new PCH with given key, the file references it if succeeded.
+    async::Task<std::optional<std::string>> buildPCH(CompilationParams& params,
+                                                     llvm::StringRef file,
+                                                     std::uint64_t key,
+                                                     llvm::StringRef preamble);
+
+    /// Let the file reference the PCH with given key, and release its old PCH.
+    void acquire(llvm::StringRef file, std::uint64_t key);
+
+    /// Build PCMs of the modules imported by the file and fill `params.pcms`.
+    async::Task<> prepareModules(CompilationParams& params);
+
+    /// Make sure the PCM of given module is up to date, its imported modules are prepared
+    /// first. `chain` is the modules depending on it, used to detect cycles. Sources are
+    /// read through `vfs`, so unsaved interface units are respected.
+    async::Task<> preparePCM(std::string name,
+                             std::vector<std::string> chain,
+                             llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs);
+
+    /// Check the PCM of the module and rebuild it if outdated, return false if failed.
+    async::Task<bool> updatePCM(llvm::StringRef name,
+                                std::vector<std::string> chain,
+                                llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs);
+
+    /// Whether the module being built waits for any module in the chain, directly or
+    /// through other waiting modules. Then waiting for it never ends. Modules of all
+    /// concurrent builds are searched, not only the current chain.
+    bool waitsFor(llvm::StringRef name, llvm::ArrayRef<std::string> chain);
+
+    /// Add the PCM of given module and all modules it depends on to `pcms`.
+    void collectPCMs(llvm::StringRef name, llvm::StringMap<std::string>& pcms);
+
+    /// Hash the modification time of all dependencies, changed or removed files result
+    /// in a different hash.
+    async::Task<std::uint64_t> hashDeps(std::vector<std::string> deps);
+
+    /// Remove the PCH file and its record.
+    void remove(std::uint64_t key);
+
+private:
+    const config::CacheOptions& options;
 
     CompilationDatabase& database;
 
     struct CachedPCHInfo : PCHInfo {
-        /// The hash of the preamble, for fast comparison.
-        std::uint64_t hash;
+        /// The hash of the modification time of all dependencies when it is built.
+        std::uint64_t hash = 0;
+
+        /// The count of files using this PCH. Only PCHs with zero reference count could
+        /// be removed when the count of PCHs exceeds the limit.
+        std::uint32_t reference = 0;
 
-        /// The reference count of this PCH. When server exit, all PCH with zero
-        /// reference count will be removed.
-        std::uint32_t reference;
+        /// Used to determine the least recently used PCH.
+        std::uint64_t lastUsed = 0;
+
+        /// Set if the PCH is being built, others with the same key wait for it.
+        std::shared_ptr<async::Event> building;
     };
 
-    /// All PCHs.
-    std::deque<CachedPCHInfo> pchs;
+    /// All PCHs, the key is the hash of preamble and command. Note that references to
+    /// the elements are stable, but they may be removed after any suspension.
+    std::unordered_map<std::uint64_t, CachedPCHInfo> pchs;
+
+    /// A map between source file and the key of its PCH.
+    llvm::StringMap<std::uint64_t> pchMap;
+
+    /// A logical clock for `lastUsed`.
+    std::uint64_t clock = 0;
 
-    /// A map between source file and its PCH.
-    llvm::StringMap<CachedPCHInfo*> pchMap;
+    Statistics stats;
+
+    struct CachedPCMInfo : PCMInfo {
+        /// The hash of the source content and command.
+        std::uint64_t srcHash = 0;
+
+        /// The hash of `srcHash` and the hashes of all imported modules, so that a change
+        /// of a module interface invalidates all modules depending on it.
+        std::uint64_t hash = 0;
+
+        /// The hash of the modification time of `deps`.
+        std::uint64_t depsHash = 0;
+
+        /// Modules imported by the module directly.
+        std::vector<std::string> imports;
+
+        /// Set if the PCM is being checked or built, others wait for it.
+        std::shared_ptr<async::Event> building;
+
+        /// Set while the module waits for its imports to be prepared.
+        bool waiting = false;
+    };
 
-    /// [module name] -> [PCMInfo]
-    llvm::StringMap<PCMInfo> pcms;
+    /// [module name] -> [PCMInfo], the PCM path is empty if the build is failed.
+    llvm::StringMap<CachedPCMInfo> pcms;
 };
 
 }  // namespace clice
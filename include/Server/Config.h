@@ -16,6 +16,17 @@ void init(std::string_view workplace);
 
 struct ServerOptions {
     std::vector<std::string> compile_commands_dirs;
+    uint32_t threads = 0;
+
+    /// The memory budget(in MB) of ASTs of opened files, 0 means no limit.
+    uint32_t astCacheLimit = 1024;
+
+    /// The delay(in ms) before rebuilding the AST after the last change.
+    uint32_t debounce = 300;
+
+    /// The time(in ms) to wait for the response of a request sent to the client, 0 means
+    /// waiting forever.
+    uint32_t requestTimeout = 10000;
 };
 
 struct CacheOptions {
@@ -26,6 +37,16 @@ struct CacheOptions {
 struct IndexOptions {
     std::string dir;
     bool implicitInstantiation = true;
+
+    /// The memory budget(in MB) of cached index files, 0 means no limit.
+    uint32_t cacheLimit = 256;
+
+    /// The count of files indexed concurrently, 0 means the count of hardware threads.
+    uint32_t concurrency = 0;
+
+    /// Indexing is paused while the user is typing, and resumed after no change for
+    /// this duration(in ms). 0 means never pause.
+    uint32_t pauseOnTyping = 2000;
 };
 
 struct Rule {
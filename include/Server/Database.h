@@ -1,5 +1,8 @@
 #pragma once
 
+#include "Async/Async.h"
+
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/StringMap.h"
 
 namespace clice {
@@ -10,21 +13,63 @@ namespace clice {
 /// This is not always correct, but it is enough for now.
 class CompilationDatabase {
 public:
-    /// Update the compile commands with the given file.
-    void updateCommands(llvm::StringRef file);
+    /// Load `compile_commands.json` in the given directories, commands in the later
+    /// directories override the earlier ones.
+    async::Task<> loadCommands(llvm::ArrayRef<std::string> dirs);
+
+    /// Update the compile commands with the given compile_commands.json. The file is
+    /// parsed in a streaming way, paths are resolved in batches on the thread pool.
+    /// Both `command` and `arguments` are supported. Relative paths in the input file
+    /// and path options (e.g. `-I`, `-include`) are rebased onto the `directory` of the
+    /// entry, so the commands do not depend on the working directory of clice.
+    async::Task<> updateCommands(std::string file);
 
-    /// Update the compile commands with the given file and compile command.
-    void updateCommand(llvm::StringRef file, llvm::StringRef command);
+    /// Update the compile commands with the given file and compile command. Relative
+    /// paths in the command are resolved against `directory` if it is not empty.
+    void updateCommand(llvm::StringRef file,
+                       llvm::StringRef command,
+                       llvm::StringRef directory = "");
 
     /// Update the module map with the given file and module name.
     void updateModule(llvm::StringRef file, llvm::StringRef name);
 
-    /// Lookup the compile commands of the given file.
-    llvm::StringRef getCommand(llvm::StringRef file);
+    /// Lookup the compile commands of the given file, return empty if not found. Note
+    /// that output and dependency file arguments are removed.
+    std::string getCommand(llvm::StringRef file);
+
+    /// Lookup the command class of the given file, return 0 if not found. Files whose
+    /// commands differ only in input, output and dependency file share the same class,
+    /// so it could be used as the key of caches of parsed arguments. Note that the id is
+    /// only meaningful within this database and this process.
+    std::uint32_t getCommandClass(llvm::StringRef file);
+
+    /// Get the arguments of given command class, the input file is replaced with
+    /// `inputPlaceholder` followed by its extension, which determines the language.
+    std::vector<llvm::StringRef> getClassArguments(std::uint32_t id);
+
+    /// The count of command classes and interned arguments, for statistics.
+    std::size_t classCount() const {
+        return classes.size();
+    }
+
+    std::size_t argumentCount() const {
+        return arguments.size();
+    }
+
+    constexpr inline static llvm::StringLiteral inputPlaceholder = "${input}";
 
     /// Lookup the module interface unit file path of the given module name.
     llvm::StringRef getModuleFile(llvm::StringRef name);
 
+    /// Scan all files in the database to build the module map. Files are raw lexed in
+    /// batches on the thread pool, only a few need to be preprocessed.
+    async::Task<> scanModules();
+
+    /// A map between module name and its interface unit file path.
+    const llvm::StringMap<std::string>& modules() const {
+        return moduleMap;
+    }
+
     auto size() const {
         return commands.size();
     }
@@ -38,8 +83,48 @@ public:
     }
 
 private:
+    struct Command {
+        /// The id of the command class.
+        std::uint32_t id = 0;
+
+        /// The argument id of the input file, -1 if the input file is not found.
+        std::uint32_t input = -1;
+    };
+
+    struct CommandClass {
+        /// The argument ids, the input file is the id of `inputPlaceholder`.
+        std::vector<std::uint32_t> arguments;
+
+        /// The position of the input file in arguments, -1 if not found.
+        std::uint32_t input = -1;
+    };
+
+    /// Intern the argument and return its id.
+    std::uint32_t intern(llvm::StringRef argument);
+
+    /// Split, canonicalize and intern the command of the file.
+    Command canonicalize(llvm::StringRef file,
+                         llvm::StringRef command,
+                         llvm::StringRef directory);
+
+    /// Canonicalize and intern the arguments of the file, relative paths are rebased
+    /// onto the directory.
+    Command canonicalize(llvm::StringRef file,
+                         llvm::ArrayRef<llvm::StringRef> args,
+                         llvm::StringRef directory);
+
     /// A map between file path and compile commands.
-    llvm::StringMap<std::string> commands;
+    llvm::StringMap<Command> commands;
+
+    /// All distinct arguments, the id of an argument is its index. The strings are
+    /// owned by `argumentIds`.
+    std::vector<llvm::StringRef> arguments;
+    llvm::StringMap<std::uint32_t> argumentIds;
+
+    /// All distinct command classes, the id of a class is its index plus one. The key
+    /// of `classIds` refers to the arguments of the class.
+    std::vector<CommandClass> classes;
+    llvm::DenseMap<llvm::ArrayRef<std::uint32_t>, std::uint32_t> classIds;
 
     /// For C++20 module, we only can got dependent module name
     /// in source context. But we need dependent module file path
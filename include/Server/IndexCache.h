@@ -0,0 +1,81 @@
+#pragma once
+
+#include <list>
+#include <memory>
+
+#include "Basic/LineTable.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace clice {
+
+/// A LRU cache of read-only file buffers used by `Indexer`, keyed by file path.
+/// Index files are mapped into memory when possible, so a cached entry is just
+/// a view of the page cache. The buffers are shared, an evicted buffer is kept
+/// alive until its last user releases it. The line table of a buffer is cached
+/// along with it, so it is built once per version of the file.
+class IndexCache {
+public:
+    /// Construct a cache with the given byte budget. Zero means no limit.
+    explicit IndexCache(std::size_t limit) : limit(limit) {}
+
+    /// Get the cached buffer of the given path and mark it as most recently
+    /// used. Return nullptr if the path is not cached.
+    std::shared_ptr<llvm::MemoryBuffer> get(llvm::StringRef path);
+
+    /// Insert the buffer into cache, replace the old one if exists. Least recently
+    /// used entries are evicted until the total size fits into the budget.
+    std::shared_ptr<llvm::MemoryBuffer> put(llvm::StringRef path,
+                                            std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+    /// Get the cached line table of the given path, return nullptr if the path is not
+    /// cached or the table is not built yet.
+    std::shared_ptr<const LineTable> getLines(llvm::StringRef path);
+
+    /// Attach the line table to the cached buffer. The table is dropped if the buffer
+    /// was replaced or evicted while building it.
+    void putLines(llvm::StringRef path,
+                  const llvm::MemoryBuffer* buffer,
+                  std::shared_ptr<const LineTable> lines);
+
+    /// Drop the cached buffer of the given path, call when the file is rewritten.
+    void invalidate(llvm::StringRef path);
+
+    /// The total size of all cached buffers and line tables.
+    std::size_t bytes() const {
+        return size;
+    }
+
+    /// The count of cached buffers.
+    std::size_t count() const {
+        return entries.size();
+    }
+
+private:
+    void evict();
+
+private:
+    struct Entry {
+        std::string path;
+        std::shared_ptr<llvm::MemoryBuffer> buffer;
+        std::shared_ptr<const LineTable> lines;
+
+        std::size_t bytes() const {
+            return buffer->getBufferSize() + (lines ? lines->memoryUsage() : 0);
+        }
+    };
+
+    /// The byte budget of the cache.
+    std::size_t limit;
+
+    /// The total size of all cached buffers and line tables.
+    std::size_t size = 0;
+
+    /// All entries, the most recently used one is at the front.
+    std::list<Entry> entries;
+
+    /// A map between file path and its entry.
+    llvm::StringMap<std::list<Entry>::iterator> map;
+};
+
+}  // namespace clice
@@ -3,10 +3,15 @@
 #include "Config.h"
 #include "Database.h"
 #include "Protocol.h"
+#include "BlobStore.h"
+#include "IndexCache.h"
+#include "SymbolTable.h"
 #include "Async/Async.h"
+#include "Support/FileSystem.h"
 #include "AST/RelationKind.h"
 
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 namespace clice {
 
@@ -14,15 +19,21 @@ class ASTInfo;
 
 class Indexer {
 public:
-    Indexer(const config::IndexOptions& options, CompilationDatabase& database) :
-        options(options), database(database) {}
+    Indexer(const config::IndexOptions& options,
+            CompilationDatabase& database,
+            llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs = new ThreadSafeFS()) :
+        options(options), database(database), vfs(std::move(vfs)), blobs(options.dir),
+        cache(std::size_t(options.cacheLimit) * 1024 * 1024) {
+        resumed.set();
+    }
 
     ~Indexer();
 
     struct TranslationUnit;
 
     struct HeaderIndex {
-        /// The index file path(not include suffix, e.g. `.sidx` and `.fidx`).
+        /// The index file path(not include suffix, e.g. `.sidx` and `.fidx`) in the blob
+        /// store. Empty if the index is dropped, the slot is reused by a later index.
         std::string path;
 
         /// The hash of the symbol index.
@@ -30,6 +41,9 @@ public:
 
         /// The hash of the feature index.
         llvm::XXH128_hash_t featureHash;
+
+        /// The count of header contexts using this index, it is dropped once unused.
+        std::uint32_t references = 0;
     };
 
     struct Context {
@@ -54,6 +68,21 @@ public:
         uint32_t filename = -1;
     };
 
+    /// The state of a file when it is indexed, used to check whether it is changed.
+    struct Fingerprint {
+        /// The last modification time in nanoseconds.
+        std::int64_t mtime = 0;
+
+        /// The size of the file in bytes.
+        std::uint64_t size = 0;
+
+        /// The hash of the content. It is only compared if the mtime or size differs, so
+        /// touching a file does not make it changed.
+        std::uint64_t hash = 0;
+
+        friend bool operator== (const Fingerprint&, const Fingerprint&) = default;
+    };
+
     struct Header {
         /// The path of the header file.
         std::string srcPath;
@@ -61,28 +90,55 @@ public:
         /// All indices of this header.
         std::vector<HeaderIndex> indices;
 
-        /// All header contexts of this header.
+        /// A map between the key of each index in the blob store and its slot in `indices`,
+        /// so that an existing index is found without scanning.
+        llvm::DenseMap<std::uint64_t, std::uint32_t> slots;
+
+        /// The dropped slots in `indices`.
+        std::vector<std::uint32_t> freeSlots;
+
+        /// A map between the fingerprint of an inclusion of this header, i.e. its content
+        /// and the macro state, and the key of its index. Inclusions with a known index
+        /// are not indexed again.
+        llvm::DenseMap<std::uint64_t, std::uint64_t> inclusions;
+
+        /// All header contexts of this header. The keys are exactly the translation units
+        /// including this header in their last index, i.e. the reverse include graph.
         llvm::DenseMap<TranslationUnit*, std::vector<Context>> contexts;
+
+        /// The fingerprint of the header when it is last indexed or checked.
+        Fingerprint fingerprint;
     };
 
     struct TranslationUnit {
         /// The source file path.
         std::string srcPath;
 
-        /// The index file path(not include suffix, e.g. `.sidx` and `.fidx`).
+        /// The index file path(not include suffix, e.g. `.sidx` and `.fidx`) in the blob
+        /// store, empty if not indexed yet.
         std::string indexPath;
 
+        /// The key of the index in the blob store.
+        std::uint64_t indexKey = 0;
+
         /// All headers included by this translation unit.
         llvm::DenseSet<Header*> headers;
 
-        /// The time when this translation unit is indexed. Used to determine
-        /// whether the index file is outdated.
-        std::chrono::milliseconds mtime;
+        /// The fingerprint of the source file when it is indexed.
+        Fingerprint fingerprint;
+
+        /// Set if the source file or any header included by it is changed since it is
+        /// indexed. A changed header marks all translation units including it at once.
+        bool dirty = false;
 
         /// All include locations introduced by this translation unit.
         /// Note that if a file has guard macro or pragma once, we will
         /// record it at most once.
         std::vector<IncludeLocation> locations;
+
+        /// The include locations in the mapped index file if not used since loaded, they
+        /// are copied to `locations` on first use, see `Indexer::locations`.
+        llvm::ArrayRef<IncludeLocation> storedLocations;
     };
 
     using Self = Indexer;
@@ -91,32 +147,104 @@ public:
     /// If not need to update, return nullptr.
     async::Task<TranslationUnit*> check(this Self& self, llvm::StringRef file);
 
+    /// Refresh the fingerprints of the files in one job of the thread pool, and mark the
+    /// translation units affected by the changed ones dirty.
+    async::Task<> refresh(this Self& self, std::vector<std::string> files);
+
     uint32_t addIncludeChain(std::vector<Indexer::IncludeLocation>& locations,
                              llvm::DenseMap<clang::FileID, uint32_t>& files,
                              clang::SourceManager& SM,
                              clang::FileID fid);
 
-    /// Add all possible header contexts for the AST info.
-    void addContexts(this Self& self,
-                     ASTInfo& info,
-                     TranslationUnit* tu,
-                     llvm::DenseMap<clang::FileID, uint32_t>& files);
-
-    /// Index the given AST, write the index information to disk.
+    /// A header index which may be unused, see `addContexts`.
+    using IndexSlot = std::pair<Header*, std::uint32_t>;
+
+    /// Add all possible header contexts for the AST info, the include graph of the unit
+    /// is replaced and the fingerprints of its files are updated. Return the header
+    /// indices no longer used by any context, they are kept until `updateIndices`, so an
+    /// unchanged index is reused rather than written again.
+    std::vector<IndexSlot>
+        addContexts(this Self& self,
+                    ASTInfo& info,
+                    TranslationUnit* tu,
+                    llvm::DenseMap<clang::FileID, uint32_t>& files,
+                    const llvm::DenseMap<clang::FileID, Fingerprint>& fingerprints);
+
+    /// Index the given AST, write the new indices to the blob store. Headers whose
+    /// inclusion fingerprint has a known index are skipped. The given unused header
+    /// indices are dropped if they are not reused.
     async::Task<> updateIndices(this Self& self,
                                 ASTInfo& info,
                                 TranslationUnit* tu,
-                                llvm::DenseMap<clang::FileID, uint32_t>& files);
+                                llvm::DenseMap<clang::FileID, uint32_t>& files,
+                                const llvm::DenseMap<clang::FileID, std::uint64_t>& inclusions,
+                                llvm::ArrayRef<IndexSlot> unused);
 
     async::Task<> index(this Self& self, llvm::StringRef file);
 
     /// Index the given file(for opened file).
     async::Task<> index(llvm::StringRef file, ASTInfo& info);
 
-    async::Task<> indexAll();
+    struct Report {
+        /// The count of files taken.
+        std::size_t files = 0;
 
-    /// Generate the index file path based on time and file name.
-    std::string getIndexPath(llvm::StringRef file);
+        /// The count of files actually indexed, up to date files are skipped.
+        std::size_t indexed = 0;
+
+        /// The bytes of index files written.
+        std::uint64_t written = 0;
+
+        std::chrono::milliseconds elapsed{0};
+    };
+
+    /// Called after each file is indexed with the count of done and total files.
+    using Progress = llvm::function_ref<void(std::size_t done, std::size_t total)>;
+
+    /// Index all files in the compilation database. Files likely sharing a preamble, i.e.
+    /// with the same command class and the same first include, are indexed together so
+    /// that they hit warm caches.
+    async::Task<Report> indexAll(Progress progress = {});
+
+    /// Files are changed on disk, e.g. reported by the client. Compute the translation
+    /// units whose indices are outdated, i.e. the changed ones and all units including
+    /// the changed headers. Units of opened files come first, then units including opened
+    /// headers.
+    async::Task<std::vector<std::string>>
+        outdated(this Self& self,
+                 std::vector<std::string> files,
+                 llvm::function_ref<bool(llvm::StringRef)> opened);
+
+    /// Reindex the outdated translation units, see `outdated`.
+    async::Task<> update(this Self& self,
+                         std::vector<std::string> files,
+                         llvm::function_ref<bool(llvm::StringRef)> opened);
+
+    /// Index the files in the given order, at most `IndexOptions::concurrency` files at
+    /// the same time. New files are not started while paused.
+    async::Task<Report> indexFiles(llvm::ArrayRef<std::string> files, Progress progress = {});
+
+    /// Pause indexing until `resume` is called, files being indexed are finished.
+    void pause() {
+        resumed.reset();
+    }
+
+    void resume() {
+        resumed.set();
+    }
+
+    /// The count of workers waiting for `resume` before starting the next file.
+    std::size_t pausedWorkers() const {
+        return paused;
+    }
+
+    /// Pause indexing for a while, e.g. when the user is typing. Later calls extend it.
+    void pauseFor(std::chrono::milliseconds duration) {
+        pausedUntil = std::max(pausedUntil, std::chrono::steady_clock::now() + duration);
+    }
+
+    /// Remove the files of indices no longer used by any header or translation unit.
+    async::Task<> collect(this Self& self);
 
     /// Dump the index information to JSON.
     json::Value dumpToJSON();
@@ -128,10 +256,26 @@ public:
 
     void lookupHeaderContexts(llvm::StringRef file);
 
-    /// Save the index information to disk.
+    struct HeaderContext {
+        /// The source file which includes the header.
+        std::string srcPath;
+
+        /// The line of the `#include` directive in the source file, which includes the
+        /// header directly or indirectly.
+        std::uint32_t line = 0;
+    };
+
+    /// Find a context of the header from the include locations of indexed translation
+    /// units, return `std::nullopt` if the header is not included by any of them.
+    std::optional<HeaderContext> context(llvm::StringRef header);
+
+    /// Save the index information to disk. Only the units and headers changed since the
+    /// last save are appended to the index file, it is compacted if the superseded records
+    /// take more than half of it.
     void saveToDisk();
 
-    /// Load the index information from disk.
+    /// Load the index information from disk. The index file is mapped into memory, and
+    /// the include locations of units are only copied when used.
     void loadFromDisk();
 
 private:
@@ -140,12 +284,45 @@ private:
         std::string name;
     };
 
-    async::Task<std::unique_ptr<llvm::MemoryBuffer>> read(llvm::StringRef path);
+    /// Drop the header index, it is no longer used by any context.
+    void dropIndex(Header* header, std::uint32_t slot);
+
+    /// Mark the unit dirty, it is indexed again by the next update.
+    void markDirty(TranslationUnit* tu) {
+        tu->dirty = true;
+        changedUnits.insert(tu);
+    }
+
+    /// The include locations of the unit, copied from the index file if not yet.
+    std::vector<IncludeLocation>& locations(TranslationUnit* tu);
+
+    /// Write the records of the changed units and headers, or of all of them if `all` is
+    /// set, to the index file. Return the written bytes.
+    std::uint64_t writeRecords(llvm::raw_ostream& os, bool all);
+
+    /// Wait until indexing is not paused.
+    async::Task<> waitResumed();
+
+    /// The path of the first header included by the translation unit in its last index,
+    /// empty if unknown. Units with the same first include likely share a preamble.
+    llvm::StringRef firstInclude(TranslationUnit* tu);
+
+    /// Read the file through the cache, the file is read from disk at most once
+    /// until it is invalidated or evicted. Index files are never rewritten in place, so
+    /// they are mapped into memory. Set `isVolatile` for files which may be rewritten,
+    /// e.g. source files being edited, then the content is copied into memory, otherwise
+    /// a truncated file would tear the mapped content or even raise SIGBUS.
+    async::Task<std::shared_ptr<llvm::MemoryBuffer>> read(llvm::StringRef path,
+                                                          bool isVolatile = false);
+
+    /// Get the line table of the file, it is built at most once per cached version
+    /// of the file. The returned table keeps its content alive.
+    async::Task<std::shared_ptr<const LineTable>> lines(llvm::StringRef path);
 
     async::Task<> lookup(llvm::ArrayRef<SymbolID> ids,
                          RelationKind kind,
                          llvm::StringRef srcPath,
-                         llvm::StringRef content,
+                         const LineTable& lines,
                          std::string indexPath,
                          std::vector<proto::Location>& result);
 
@@ -168,13 +345,57 @@ public:
 private:
     const config::IndexOptions& options;
     CompilationDatabase& database;
+
+    /// The file system used to compile translation units for indexing.
+    llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs;
+
     llvm::StringMap<Header*> headers;
     llvm::StringMap<TranslationUnit*> tus;
 
-    bool locked = false;
+    /// The index files shared by all headers and translation units.
+    BlobStore blobs;
+
+    /// A map between symbol id and the index files which mention it.
+    SymbolTable symbols;
+
+    /// Recently used index files and their sources.
+    IndexCache cache;
+
+    /// Serialize the checking and updating of indices.
+    async::Mutex mutex;
+
+    /// Set unless paused by `pause`.
+    async::Event resumed;
+
+    /// The count of workers waiting for `resumed`.
+    std::size_t paused = 0;
+
+    /// Paused until the time point by `pauseFor`.
+    std::chrono::steady_clock::time_point pausedUntil;
+
+    /// The count of indexed files and bytes of written index files, for `Report`.
+    std::size_t indexed = 0;
+    std::uint64_t written = 0;
 
     std::vector<std::string> pathPool;
     llvm::StringMap<std::uint32_t> pathIndices;
+
+    /// The mapped index file, the stored include locations of units refer to it.
+    std::unique_ptr<llvm::MemoryBuffer> storage;
+
+    /// The units and headers changed since the index file is last written.
+    llvm::DenseSet<TranslationUnit*> changedUnits;
+    llvm::DenseSet<Header*> changedHeaders;
+
+    /// The count of paths in the pool written to the index file.
+    std::size_t savedPaths = 0;
+
+    /// The size of the index file, and the bytes of records superseded by later ones.
+    std::uint64_t fileSize = 0;
+    std::uint64_t staleSize = 0;
+
+    /// The size of the last record of each unit and header in the index file.
+    llvm::DenseMap<const void*, std::uint32_t> recordSizes;
 };
 
 }  // namespace clice
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+
+#include "Basic/TextBuffer.h"
+#include "Support/FileSystem.h"
+#include "llvm/ADT/StringMap.h"
+
+namespace clice {
+
+/// The file system shared by all compilations of the server.
+///
+/// Opened documents are served from their snapshots, so unsaved changes are visible to
+/// every compilation including them, not only to the document's own. For files on disk,
+/// the content is cached across compilations. It is only served if the modification time
+/// and size of the file are not changed since it is read, the status is refreshed by the
+/// same stat, so a file changed outside of the editor is never read stale and its status
+/// always matches its content. The failures of probing include directories are cached
+/// until `invalidate` is called, i.e. when the client reports the file is created.
+///
+/// At most `capacity` files are cached, and their content takes at most `limit` bytes,
+/// the least recently used ones are dropped first. Zero means no limit.
+///
+/// Precompiled files are written by the server itself, they are never cached.
+class OverlayFS : public vfs::ProxyFileSystem {
+public:
+    explicit OverlayFS(llvm::IntrusiveRefCntPtr<vfs::FileSystem> fs = new ThreadSafeFS(),
+                       std::size_t capacity = 65536,
+                       std::size_t limit = 512 * 1024 * 1024) :
+        ProxyFileSystem(std::move(fs)), capacity(capacity), limit(limit) {}
+
+    /// Serve the file from the snapshot until it is closed.
+    void open(llvm::StringRef path, std::shared_ptr<const TextSnapshot> snapshot);
+
+    /// Stop serving the file from memory.
+    void close(llvm::StringRef path);
+
+    /// Drop the cached failure and content of the file on disk.
+    void invalidate(llvm::StringRef path);
+
+    /// Drop the cached failures and content of all files on disk.
+    void invalidateAll();
+
+    llvm::ErrorOr<vfs::Status> status(const llvm::Twine& path) override;
+
+    llvm::ErrorOr<std::unique_ptr<vfs::File>> openFileForRead(const llvm::Twine& path) override;
+
+    bool exists(const llvm::Twine& path) override;
+
+    struct Statistics {
+        /// The count of status lookups, including those for reads, and those served
+        /// without a syscall.
+        std::atomic<std::uint64_t> stats = 0;
+        std::atomic<std::uint64_t> cachedStats = 0;
+
+        /// The count of files opened for read and those served without reading.
+        std::atomic<std::uint64_t> reads = 0;
+        std::atomic<std::uint64_t> cachedReads = 0;
+
+        /// The count of cached content checked against the status of the file, the status
+        /// syscalls are counted in `stats` as well.
+        std::atomic<std::uint64_t> validations = 0;
+
+        /// The count of files dropped from the cache because of the budget.
+        std::atomic<std::uint64_t> evictions = 0;
+    };
+
+    const Statistics& statistics() const {
+        return stats;
+    }
+
+    /// The count of files whose failure or content is cached.
+    std::size_t size() {
+        std::lock_guard lock(mutex);
+        return lru.size();
+    }
+
+    /// The total size of the cached content.
+    std::size_t memoryUsage() {
+        std::lock_guard lock(mutex);
+        return memory;
+    }
+
+private:
+    struct Entry {
+        /// The error of the status of the file on disk, e.g. it does not exist. Empty if
+        /// not cached, the status of an existing file is never cached.
+        std::optional<std::error_code> error;
+
+        /// The content of the file on disk, null if not cached.
+        std::shared_ptr<const llvm::MemoryBuffer> content;
+
+        /// The status of the file when the content is read.
+        vfs::Status contentStatus;
+
+        /// The snapshot of the opened document, null if not opened.
+        std::shared_ptr<const TextSnapshot> snapshot;
+
+        /// The unique id of the opened document if it does not exist on disk.
+        llvm::sys::fs::UniqueID id;
+
+        /// The position in `lru` if the failure or content is cached.
+        std::optional<std::list<std::string>::iterator> position;
+    };
+
+    /// Make the path absolute and normalized as the key of entries.
+    std::string normalize(const llvm::Twine& path) const;
+
+    /// Get the status of the file on disk, only the failure is served from the cache. The
+    /// lock must not be held.
+    llvm::ErrorOr<vfs::Status> diskStatus(llvm::StringRef key);
+
+    /// Make the status of the opened document.
+    static vfs::Status overlayStatus(const Entry& entry,
+                                     const llvm::ErrorOr<vfs::Status>& disk,
+                                     llvm::StringRef name);
+
+    /// Mark the cached entry as most recently used and drop the least recently used ones
+    /// beyond the budget. The entry may be dropped as well, it must not be used after.
+    /// The lock must be held.
+    void touch(llvm::StringRef key, Entry& entry);
+
+    /// Drop the cached failure and content of the entry, the lock must be held.
+    void forget(Entry& entry);
+
+private:
+    std::mutex mutex;
+
+    llvm::StringMap<Entry> entries;
+
+    /// The max count of cached files and the max size of cached content.
+    std::size_t capacity;
+    std::size_t limit;
+
+    /// The paths of all cached files, the most recently used one is at the front.
+    std::list<std::string> lru;
+
+    /// The total size of the cached content.
+    std::size_t memory = 0;
+
+    Statistics stats;
+};
+
+}  // namespace clice
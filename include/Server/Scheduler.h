@@ -1,6 +1,10 @@
 #pragma once
 
 #include "Cache.h"
+#include "Indexer.h"
+#include "OverlayFS.h"
+#include "Compiler/AST.h"
+#include "Basic/TextBuffer.h"
 
 namespace clice {
 
@@ -22,25 +26,190 @@ struct Rule {
 };
 
 /// This class is responsible for managing all opened files.
+///
+/// The ASTs of opened files are kept in memory and shared by feature requests. Changes
+/// are debounced, the AST is rebuilt in the background if the file is not changed again
+/// within `ServerOptions::debounce`. When the memory used by all ASTs exceeds
+/// `ServerOptions::astCacheLimit`, ASTs of the least recently used files are dropped and
+/// rebuilt on demand.
 class Scheduler {
 public:
-    Scheduler(CompilationDatabase& database, llvm::ArrayRef<Rule> rules) :
-        database(database), rules(rules) {}
+    Scheduler(const config::ServerOptions& options,
+              CompilationDatabase& database,
+              Indexer& indexer,
+              llvm::IntrusiveRefCntPtr<OverlayFS> vfs,
+              llvm::ArrayRef<Rule> rules) :
+        options(options), database(database), indexer(indexer), vfs(std::move(vfs)),
+        rules(rules), cache(config::cache, database) {}
+
+    /// Load the PCH and PCM information, call after the config is initialized.
+    void loadCache() {
+        cache.loadFromDisk();
+    }
+
+    /// Save the PCH and PCM information, so that they could be reused next time.
+    void saveCache() {
+        cache.saveToDisk();
+    }
+
+    /// Open the file with given content, the AST is built in the background.
+    async::Task<> open(llvm::StringRef path, std::string content);
+
+    /// Update the content of the opened file, the AST is rebuilt after debouncing.
+    async::Task<> update(llvm::StringRef path, std::string content);
+
+    /// Apply incremental changes to the opened file, the AST is rebuilt after debouncing.
+    /// Changes only edit the buffer, the whole content is not copied until it is built.
+    async::Task<> update(llvm::StringRef path,
+                         llvm::ArrayRef<proto::TextDocumentContentChangeEvent> changes,
+                         const SourceConverter& converter);
 
-    async::Task<> open(llvm::StringRef path);
+    async::Task<> close(llvm::StringRef path);
 
-    async::Task<> update(llvm::StringRef path);
+    /// Whether the file is opened.
+    bool isOpened(llvm::StringRef path) const {
+        return files.contains(path);
+    }
+
+    /// Run the action with the AST of the latest content of the file in the thread pool,
+    /// the AST is built first if it is outdated. Return `std::nullopt` if the file is not
+    /// opened, fails to build or the request is cancelled by `token`. A build started by
+    /// the request is aborted once it is cancelled. Actions on the same AST are
+    /// serialized, because ASTs are not thread safe.
+    template <typename Action, typename R = std::invoke_result_t<Action&, ASTInfo&>>
+    async::Task<std::optional<R>> withAST(llvm::StringRef path,
+                                          Action action,
+                                          async::CancellationToken token = {}) {
+        auto ast = co_await this->ast(path.str(), token);
+        if(!ast) {
+            co_return std::nullopt;
+        }
+
+        auto guard = co_await ast->mutex.lock();
+        if(token.cancelled()) {
+            co_return std::nullopt;
+        }
+
+        co_return co_await async::submit(async::Priority::Interactive,
+                                         [&] { return action(ast->info); });
+    }
+
+    struct Statistics {
+        /// The count of ASTs built.
+        std::uint32_t builds = 0;
+
+        /// The count of requests served by an up to date AST without building.
+        std::uint32_t hits = 0;
+
+        /// The count of ASTs dropped because of the memory budget.
+        std::uint32_t evictions = 0;
+
+        /// The count of builds aborted because the request is cancelled.
+        std::uint32_t cancellations = 0;
+    };
+
+    const Statistics& statistics() const {
+        return stats;
+    }
+
+    /// The memory used by all ASTs in bytes.
+    std::size_t memoryUsage() const {
+        return memory;
+    }
+
+    /// Called after the debounced build of the latest content is done, so tests could
+    /// wait for it instead of sleeping. Builds skipped by newer changes are not reported.
+    llvm::unique_function<void(llvm::StringRef path)> onDebounced;
 
-    async::Task<> close(llvm::StringRef path);
+private:
+    struct AST {
+        AST(ASTInfo info, std::size_t memory, std::shared_ptr<const TextSnapshot> snapshot) :
+            snapshot(std::move(snapshot)), info(std::move(info)), memory(memory) {}
+
+        /// The content the AST is built from, the source manager refers to it. Declared
+        /// before `info`, so it is destroyed after the AST.
+        std::shared_ptr<const TextSnapshot> snapshot;
+
+        ASTInfo info;
+
+        /// The memory used by the AST, see `ASTInfo::memory`.
+        std::size_t memory;
+
+        /// Serialize the actions on the AST.
+        async::Mutex mutex;
+    };
+
+    struct File {
+        /// The latest content of the file.
+        TextBuffer buffer;
+
+        /// The version of the latest content. Versions are unique among all files and
+        /// increase on each change, so an outdated build never overrides a newer one.
+        std::uint32_t version = 0;
+
+        /// The version of content the last build is for, 0 if it should be (re)built.
+        std::uint32_t built = 0;
+
+        /// The AST of the latest successful build, null if not built or dropped.
+        std::shared_ptr<AST> ast;
+
+        /// The version of content the AST is built from.
+        std::uint32_t astVersion = 0;
+
+        /// Used to determine the least recently used AST.
+        std::uint64_t lastUsed = 0;
+
+        /// Set if the AST is being built, others wait for it.
+        std::shared_ptr<async::Event> building;
+    };
+
+    /// Get the AST of the latest content of the file, build it if outdated.
+    async::Task<std::shared_ptr<AST>> ast(std::string path, async::CancellationToken token);
+
+    /// Build the AST until it is up to date with the latest content. The build is
+    /// aborted if `token` is cancelled, then it is left to the next caller.
+    async::Task<> build(std::string path, async::CancellationToken token = {});
+
+    /// Build the AST after debouncing, do nothing if the file is changed meanwhile.
+    async::Task<> debounce(std::string path, std::uint32_t target);
+
+    /// Compile the content of the file. A header without compile command is compiled in
+    /// the context of a source file, see `Indexer::context`.
+    async::Task<std::shared_ptr<AST>> compile(std::string path,
+                                              std::shared_ptr<const TextSnapshot> snapshot,
+                                              async::CancellationToken token);
+
+    /// Drop ASTs of the least recently used files except `keep` until the memory is
+    /// within the budget.
+    void evict(const File& keep);
 
 private:
+    const config::ServerOptions& options;
+
     CompilationDatabase& database;
 
+    Indexer& indexer;
+
+    /// Built snapshots of opened files are published to it, so they are visible to the
+    /// compilations of other files.
+    llvm::IntrusiveRefCntPtr<OverlayFS> vfs;
+
     llvm::ArrayRef<Rule> rules;
 
-    struct File {};
+    CacheController cache;
 
     llvm::StringMap<File> files;
+
+    /// The latest version of all files, see `File::version`.
+    std::uint32_t version = 0;
+
+    /// A logical clock for `lastUsed`.
+    std::uint64_t clock = 0;
+
+    /// The memory used by all ASTs.
+    std::size_t memory = 0;
+
+    Statistics stats;
 };
 
 }  // namespace clice
@@ -17,8 +17,10 @@ public:
 
     async::Task<> onReceive(json::Value value);
 
-    /// Send a request to the client.
-    async::Task<> request(llvm::StringRef method, json::Value params);
+    /// Send a request to the client and wait for the response. Return the result, or
+    /// nullopt if the client responds with an error or does not respond within
+    /// `ServerOptions::requestTimeout`.
+    async::Task<std::optional<json::Value>> request(llvm::StringRef method, json::Value params);
 
     /// Send a notification to the client.
     async::Task<> notify(llvm::StringRef method, json::Value params);
@@ -26,12 +28,24 @@ public:
     /// Send a response to the client.
     async::Task<> response(json::Value id, json::Value result);
 
+    /// Send a response to the client, the result is written into the message directly
+    /// without building a `json::Value` first. Prefer it for large results.
+    template <typename Result>
+    async::Task<> response(json::Value id, const Result& result) {
+        co_await writeResponse(std::move(id),
+                               [&](json::OStream& os) { json::stream(os, result); });
+    }
+
     /// Send an register capability to the client.
     async::Task<> registerCapacity(llvm::StringRef id,
                                    llvm::StringRef method,
                                    json::Value registerOptions);
     std::uint32_t id = 0;
 
+    /// Get the cancellation token of the request being handled. Handlers should poll
+    /// it between steps, or pass it to `Scheduler::withAST` to abort the compilation.
+    async::CancellationToken token(const json::Value& id);
+
 private:
     using onRequest = llvm::unique_function<async::Task<>(json::Value, json::Value)>;
     using onNotification = llvm::unique_function<async::Task<>(json::Value)>;
@@ -56,6 +70,42 @@ private:
     llvm::StringMap<onRequest> requests;
     llvm::StringMap<onNotification> notifications;
 
+    struct PendingRequest {
+        async::CancellationToken token;
+
+        /// The key in `latestRequests` if the request could be superseded.
+        std::string supersedeKey;
+    };
+
+    /// Requests being handled, the key is the serialized request id.
+    llvm::StringMap<PendingRequest> pendingRequests;
+
+    /// A map between method + document uri and the latest request id of it. A new
+    /// request of the same method and document cancels the old one.
+    llvm::StringMap<std::string> latestRequests;
+
+    struct PendingResponse {
+        async::Event received;
+        std::optional<json::Value> result;
+    };
+
+    /// Requests sent to the client and waiting for the responses, the key is the request
+    /// id. The value lives in the frame of `request`.
+    llvm::DenseMap<std::uint32_t, PendingResponse*> pendingResponses;
+
+    /// Resume the request waiting for the response, called on a message without method.
+    void receive(const json::Object& response);
+
+    /// Stop waiting for the response of the request once the timeout elapses, the entry
+    /// is erased and a late response is ignored.
+    async::Task<> expire(std::uint32_t id, std::chrono::milliseconds timeout);
+
+    /// Cancel the request with given id, called on `$/cancelRequest`.
+    void cancel(const json::Value& id);
+
+    /// Write the response of given request, `result` writes the result value to the stream.
+    async::Task<> writeResponse(json::Value id, llvm::function_ref<void(json::OStream&)> result);
+
 private:
     /// ============================================================================
     ///                            Lifecycle Message
@@ -152,6 +202,10 @@ private:
 
     async::Task<> onIndexAll(const proto::None&);
 
+    async::Task<> onIndexPause(const proto::None&);
+
+    async::Task<> onIndexResume(const proto::None&);
+
     async::Task<> onContextCurrent(const proto::TextDocumentIdentifier& params);
 
     async::Task<> onContextAll(const proto::TextDocumentIdentifier& params);
@@ -159,6 +213,7 @@ private:
     async::Task<> onContextSwitch(const proto::TextDocumentIdentifier& params);
 
     SourceConverter converter;
+    llvm::IntrusiveRefCntPtr<OverlayFS> vfs = new OverlayFS();
     CompilationDatabase database;
     Indexer indexer;
     Scheduler scheduler;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+
+namespace clice {
+
+/// A workspace-wide map between symbol id and the index files which mention it.
+/// Symbol id is the xxh3 hash of the symbol USR, see `SymbolIndexBuilder::getSymbolID`.
+/// With this table, a cross-file lookup only needs to open the index files that
+/// actually contain the symbol instead of scanning all index files.
+class SymbolTable {
+public:
+    struct Entry {
+        /// The index file path(not include suffix, e.g. `.sidx` and `.fidx`).
+        std::string indexPath;
+
+        /// The source file path of the index file.
+        std::string srcPath;
+    };
+
+    /// Replace all symbols recorded for the given index file of the source. Identical index
+    /// files are shared by sources, so a file is identified by both paths.
+    void update(llvm::StringRef indexPath,
+                llvm::StringRef srcPath,
+                llvm::ArrayRef<std::uint64_t> symbols);
+
+    /// Remove the given index file of the source from the table.
+    void remove(llvm::StringRef indexPath, llvm::StringRef srcPath);
+
+    /// Collect all index files which mention any of the given symbols. Each index
+    /// file occurs at most once in the result.
+    std::vector<Entry> lookup(llvm::ArrayRef<std::uint64_t> symbols) const;
+
+    /// The count of index files recorded in the table.
+    std::size_t size() const {
+        return fileIndices.size();
+    }
+
+    /// Save the table to disk in binary format.
+    void saveToDisk(llvm::StringRef path) const;
+
+    /// Load the table from disk, the old content is discarded.
+    void loadFromDisk(llvm::StringRef path);
+
+private:
+    struct File {
+        std::string indexPath;
+        std::string srcPath;
+
+        /// All symbols mentioned in this file, sorted and unique.
+        std::vector<std::uint64_t> symbols;
+    };
+
+    /// All index files, removed slots are reused by later update.
+    std::vector<File> files;
+
+    /// The removed slots in `files`.
+    std::vector<std::uint32_t> freeList;
+
+    /// A map between index file and source path and its slot in `files`.
+    llvm::StringMap<std::uint32_t> fileIndices;
+
+    /// A map between symbol id and the slots of files which mention it. Each
+    /// list is kept sorted so that insertion and removal are binary searches.
+    llvm::DenseMap<std::uint64_t, llvm::SmallVector<std::uint32_t, 2>> symbolFiles;
+};
+
+}  // namespace clice
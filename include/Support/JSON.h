@@ -2,6 +2,7 @@
 
 #include <array>
 #include <vector>
+#include <optional>
 #include <ranges>
 #include <string_view>
 
@@ -116,6 +117,28 @@ struct Serde<std::nullopt_t> {
     }
 };
 
+/// An empty optional is serialized as null, a missing or null member is deserialized as empty.
+template <typename T>
+struct Serde<std::optional<T>> {
+    constexpr inline static bool stateful = stateful_serde<T>;
+
+    template <typename... Serdes>
+    static json::Value serialize(const std::optional<T>& v, Serdes&&... serdes) {
+        if(!v) {
+            return json::Value(nullptr);
+        }
+        return json::serialize(*v, std::forward<Serdes>(serdes)...);
+    }
+
+    template <typename... Serdes>
+    static std::optional<T> deserialize(const json::Value& value, Serdes&&... serdes) {
+        if(value.kind() == json::Value::Null) {
+            return std::nullopt;
+        }
+        return json::deserialize<T>(value, std::forward<Serdes>(serdes)...);
+    }
+};
+
 template <>
 struct Serde<bool> {
     static json::Value serialize(bool v) {
@@ -375,4 +398,50 @@ struct Serde<T> {
     }
 };
 
+/// Write an object to the JSON stream directly, without building a `json::Value` tree
+/// first. It handles the same kinds of types as the generic serdes above and falls back
+/// to `json::serialize` for other types, e.g. types with a custom `Serde`. Note that
+/// stateful serdes are not supported.
+template <typename V>
+void stream(json::OStream& os, const V& v) {
+    if constexpr(std::is_same_v<V, json::Value>) {
+        os.value(v);
+    } else if constexpr(std::is_same_v<V, bool> || clice::integral<V> ||
+                        clice::floating_point<V> || std::is_enum_v<V>) {
+        /// Number values are stored inline, no allocation.
+        os.value(Serde<V>::serialize(v));
+    } else if constexpr(std::is_convertible_v<const V&, llvm::StringRef>) {
+        os.value(llvm::StringRef(v));
+    } else if constexpr(refl::reflectable_enum<V>) {
+        json::stream(os, v.value());
+    } else if constexpr(requires {
+                            requires map_range<V>;
+                            requires std::is_convertible_v<typename V::key_type, llvm::StringRef>;
+                        }) {
+        os.object([&] {
+            for(const auto& [key, value]: v) {
+                os.attributeBegin(llvm::StringRef(key));
+                json::stream(os, value);
+                os.attributeEnd();
+            }
+        });
+    } else if constexpr(set_range<V> || sequence_range<V>) {
+        os.array([&] {
+            for(const auto& element: v) {
+                json::stream(os, element);
+            }
+        });
+    } else if constexpr(refl::reflectable_struct<V>) {
+        os.object([&] {
+            refl::foreach(v, [&](std::string_view name, auto& member) {
+                os.attributeBegin(llvm::StringRef(name));
+                json::stream(os, member);
+                os.attributeEnd();
+            });
+        });
+    } else {
+        os.value(json::serialize(v));
+    }
+}
+
 }  // namespace clice::json
@@ -13,6 +13,10 @@ namespace clice::testing {
 
 llvm::StringRef test_dir();
 
+/// Whether to run the heavy benchmarks, e.g. writing or parsing large data. They are
+/// skipped by default.
+bool benchmark();
+
 #undef EXPECT_EQ
 #undef EXPECT_NE
 
@@ -137,4 +141,36 @@ private:
     llvm::StringMap<proto::Position> locations;
 };
 
+/// A fixture owning a unique temporary directory, which is removed after the test. Tests
+/// writing files should put them under it rather than the working directory.
+struct TempDirTest : ::testing::Test {
+    /// The real path of the temporary directory.
+    std::string dir;
+
+    void SetUp() override {
+        llvm::SmallString<128> path;
+        auto error = fs::createUniqueDirectory("clice-test", path);
+        ASSERT_FALSE(error) << error.message();
+        dir = path::real_path(path);
+    }
+
+    void TearDown() override {
+        if(!dir.empty()) {
+            auto error = fs::remove_directories(dir);
+        }
+    }
+
+    /// Write the content to the file under the directory, return its path. Parent
+    /// directories are created.
+    std::string write(llvm::StringRef name, llvm::StringRef content) {
+        auto file = path::join(dir, name);
+        auto error = fs::create_directories(path::parent_path(file));
+
+        std::error_code ec;
+        llvm::raw_fd_ostream os(file, ec);
+        os << content;
+        return file;
+    }
+};
+
 }  // namespace clice::testing
@@ -13,6 +13,12 @@ namespace {
 /// The task queue waiting for resuming.
 std::deque<std::coroutine_handle<>> tasks;
 
+/// The only handle used to wake up the event loop for ready tasks. It is active
+/// only if there are tasks in the queue, so an idle loop still blocks in poll.
+uv_idle_t idle;
+
+bool idleInitialized = false;
+
 net::Callback callback = {};
 
 uv_stream_t* writer = {};
@@ -20,25 +26,62 @@ uv_stream_t* writer = {};
 /// Whether the server is listening.
 bool listened = false;
 
+void drain(uv_idle_t* handle) {
+    /// Only resume the tasks already in the queue. Tasks scheduled during this drain
+    /// are resumed in the next loop iteration, so that pending IO could be polled
+    /// between them and a task rescheduling itself cannot starve the loop.
+    auto count = tasks.size();
+    while(count--) {
+        auto core = tasks.front();
+        tasks.pop_front();
+        core.resume();
+    }
+
+    if(tasks.empty()) {
+        uv_idle_stop(handle);
+    }
+}
+
 }  // namespace
 
 void schedule(std::coroutine_handle<> core) {
-    uv_async_t* async = new uv_async_t;
-    async->data = core.address();
-    uv_async_init(loop, async, [](uv_async_t* handle) {
-        auto core = std::coroutine_handle<>::from_address(handle->data);
-        core.resume();
-        uv_close((uv_handle_t*)handle, [](uv_handle_t* handle) { delete (uv_async_t*)handle; });
+    if(!idleInitialized) {
+        uv_idle_init(loop, &idle);
+        idleInitialized = true;
+    }
+
+    if(tasks.empty()) {
+        uv_idle_start(&idle, drain);
+    }
+
+    tasks.push_back(core);
+}
+
+Task<> sleep(std::chrono::milliseconds duration) {
+    /// The timer is closed asynchronously, so it is allocated on the heap and freed in
+    /// the close callback.
+    auto timer = new uv_timer_t;
+    uv_timer_init(loop, timer);
+
+    co_await async::suspend([&](core_handle handle) {
+        timer->data = handle.address();
+        uv_timer_start(
+            timer,
+            [](uv_timer_t* timer) {
+                auto handle = core_handle::from_address(timer->data);
+                uv_close(reinterpret_cast<uv_handle_t*>(timer), [](uv_handle_t* handle) {
+                    delete reinterpret_cast<uv_timer_t*>(handle);
+                });
+                async::schedule(handle);
+            },
+            duration.count(),
+            0);
     });
-    uv_async_send(async);
 }
 
 void run() {
-#ifdef _WIN32
-    _putenv_s("UV_THREADPOOL_SIZE", "20");
-#else
-    setenv("UV_THREADPOOL_SIZE", "20", 1);
-#endif
+    /// Note that CPU heavy jobs run in our own thread pool, see `async::submit`. The
+    /// libuv thread pool is only used for file system requests.
     uv_run(loop, UV_RUN_DEFAULT);
 }
 
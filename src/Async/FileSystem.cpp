@@ -103,6 +103,15 @@ struct write : fs<write> {
     }
 };
 
+struct rename : fs<rename> {
+    const char* from;
+    const char* to;
+
+    int schedule(uv_fs_cb cb) {
+        return uv_fs_rename(async::loop, &request, from, to, cb);
+    }
+};
+
 struct stat : fs<stat, Stats> {
     const char* path;
 
@@ -112,7 +121,9 @@ struct stat : fs<stat, Stats> {
 
     auto result() {
         Stats stats;
-        stats.mtime = std::chrono::milliseconds(request.statbuf.st_mtim.tv_sec * 1000);
+        stats.mtime = std::chrono::seconds(request.statbuf.st_mtim.tv_sec) +
+                      std::chrono::nanoseconds(request.statbuf.st_mtim.tv_nsec);
+        stats.size = request.statbuf.st_size;
         return stats;
     }
 };
@@ -229,6 +240,13 @@ AsyncResult<void> write(std::string path, char* buffer, std::size_t size, Mode m
     co_return Result<void>();
 }
 
+AsyncResult<void> rename(std::string from, std::string to) {
+    co_return co_await awaiter::rename{
+        .from = from.c_str(),
+        .to = to.c_str(),
+    };
+}
+
 AsyncResult<Stats> stat(std::string path) {
     co_return co_await awaiter::stat{.path = path.c_str()};
 }
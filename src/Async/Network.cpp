@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "Async/Network.h"
 #include "Support/Logger.h"
 
@@ -5,6 +7,7 @@ namespace clice::async::net {
 
 namespace {
 
+/// Used by the streams whose content is only logged, e.g. stderr of the child process.
 void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
     /// This function is called synchronously before `on_read`. See the implementation of
     /// `uv__read` in libuv/src/unix/stream.c. So it is safe to use a static buffer here.
@@ -14,56 +17,36 @@ void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
     buf->len = suggested_size;
 }
 
-class MessageBuffer {
-public:
-    MessageBuffer() = default;
-
-    void append(llvm::StringRef message) {
-        buffer += message;
-    }
-
-    llvm::StringRef peek() {
-        llvm::StringRef str = buffer;
-        std::size_t length = 0;
-        if(str.consume_front("Content-Length: ") && !str.consumeInteger(10, length) &&
-           str.consume_front("\r\n\r\n") && str.size() >= length) {
-            auto result = str.substr(0, length);
-            pos = result.end() - buffer.begin();
-            return result;
-        }
-        return {};
-    }
+net::Callback callback = {};
 
-    void consume() {
-        buffer.erase(buffer.begin(), buffer.begin() + pos);
-        pos = 0;
-    }
+uv_stream_t* writer = {};
 
-private:
-    std::size_t pos;
-    llvm::SmallString<4096> buffer;
-};
+Statistics stats;
 
-net::Callback callback = {};
+/// We have at most one connection and use default event loop. So there is no data race
+/// risk. It is safe to use a global buffer here.
+MessageBuffer reader;
 
-uv_stream_t* writer = {};
+/// Let libuv read into the message buffer directly.
+void on_alloc_message(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+    auto space = reader.prepare(suggested_size);
+    buf->base = space.data();
+    buf->len = space.size();
+}
 
 void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
-    /// We have at most one connection and use default event loop. So there is no data race
-    /// risk. It is safe to use a static buffer here.
-
-    /// FIXME: use a more efficient data structure.
-    static MessageBuffer buffer;
     if(nread > 0) {
-        buffer.append({buf->base, static_cast<std::size_t>(nread)});
-        if(auto message = buffer.peek(); !message.empty()) {
-            if(auto json = json::parse(message)) {
+        reader.commit(nread);
+
+        /// Handle all complete messages in this read, a client may send many messages
+        /// at once, e.g. didChange followed by semanticTokens and inlayHint.
+        while(auto message = reader.next()) {
+            if(auto json = json::parse(*message)) {
                 /// This is a top-level coroutine.
                 auto core = callback(std::move(*json));
                 /// It will be destroyed in final suspend point.
                 /// So we release it here.
                 async::schedule(core.release());
-                buffer.consume();
             } else {
                 log::fatal("An error occurred while parsing JSON: {0}", json.takeError());
             }
@@ -78,6 +61,89 @@ void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
 
 }  // namespace
 
+llvm::MutableArrayRef<char> MessageBuffer::prepare(std::size_t hint) {
+    /// Make sure the whole incomplete message fits, so it is moved at most once.
+    if(expected > size()) {
+        hint = std::max(hint, expected - size());
+    }
+
+    if(begin == end) {
+        begin = end = 0;
+    }
+
+    if(buffer.size() - end < hint) {
+        if(begin != 0) {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+
+        if(buffer.size() - end < hint) {
+            buffer.resize_for_overwrite(std::max(buffer.size() * 2, end + hint));
+        }
+    }
+
+    return {buffer.data() + end, buffer.size() - end};
+}
+
+std::optional<llvm::StringRef> MessageBuffer::next() {
+    constexpr llvm::StringLiteral header = "Content-Length";
+    while(true) {
+        llvm::StringRef data(buffer.data() + begin, end - begin);
+
+        /// The length of the body is unknown, resync at the next frame.
+        if(skipping) {
+            auto next = data.find_insensitive(header);
+            if(next == llvm::StringRef::npos) {
+                /// Keep the tail which may be the beginning of the header.
+                begin += data.size() - std::min(data.size(), header.size() - 1);
+                return std::nullopt;
+            }
+
+            skipping = false;
+            begin += next;
+            continue;
+        }
+
+        auto headerSize = data.find("\r\n\r\n");
+        if(headerSize == llvm::StringRef::npos) {
+            return std::nullopt;
+        }
+
+        /// Parse headers, e.g. `Content-Length: 10\r\nContent-Type: ...\r\n\r\n`.
+        std::optional<std::size_t> length;
+        llvm::StringRef headers = data.take_front(headerSize);
+        while(!headers.empty()) {
+            llvm::StringRef line;
+            std::tie(line, headers) = headers.split("\r\n");
+            auto [name, value] = line.split(':');
+            std::size_t result;
+            if(name.trim().equals_insensitive("Content-Length") &&
+               !value.trim().getAsInteger(10, result)) {
+                length = result;
+            }
+        }
+
+        auto bodyBegin = headerSize + 4;
+        if(!length) {
+            log::warn("Skip message without Content-Length header: {}", data.take_front(headerSize));
+            begin += bodyBegin;
+            skipping = true;
+            continue;
+        }
+
+        if(data.size() - bodyBegin < *length) {
+            expected = bodyBegin + *length;
+            return std::nullopt;
+        }
+
+        expected = 0;
+        begin += bodyBegin + *length;
+        return data.substr(bodyBegin, *length);
+    }
+}
+
+
 #define uv_check_call(func, ...)                                                                   \
     if(int error = func(__VA_ARGS__); error < 0) {                                                 \
         log::fatal("An error occurred while calling {0}: {1}", #func, uv_strerror(error));         \
@@ -101,7 +167,7 @@ void listen(Callback callback) {
     uv_log(uv_pipe_init(async::loop, &out, 0));
     uv_log(uv_pipe_open(&out, 1));
 
-    uv_log(uv_read_start((uv_stream_t*)&in, net::on_alloc, net::on_read));
+    uv_log(uv_read_start((uv_stream_t*)&in, net::on_alloc_message, net::on_read));
 }
 
 void listen(const char* ip, unsigned int port, Callback callback) {
@@ -121,7 +187,7 @@ void listen(const char* ip, unsigned int port, Callback callback) {
     auto on_connection = [](uv_stream_t* server, int status) {
         uv_log(status);
         uv_log(uv_accept(server, (uv_stream_t*)&client));
-        uv_log(uv_read_start((uv_stream_t*)&client, net::on_alloc, net::on_read));
+        uv_log(uv_read_start((uv_stream_t*)&client, net::on_alloc_message, net::on_read));
     };
 
     uv_log(uv_listen((uv_stream_t*)&server, 1, on_connection));
@@ -181,7 +247,7 @@ void spawn(llvm::StringRef path, llvm::ArrayRef<std::string> args, Callback call
     options.args = argv.data();
 
     uv_log(uv_spawn(async::loop, &process, &options));
-    uv_log(uv_read_start((uv_stream_t*)&out, net::on_alloc, net::on_read));
+    uv_log(uv_read_start((uv_stream_t*)&out, net::on_alloc_message, net::on_read));
 
     auto on_read = [](uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
         if(nread > 0) {
@@ -197,44 +263,188 @@ void spawn(llvm::StringRef path, llvm::ArrayRef<std::string> args, Callback call
     uv_log(uv_read_start((uv_stream_t*)&err, net::on_alloc, on_read));
 }
 
-/// Write a JSON value to the client.
-Task<> write(json::Value value) {
+namespace {
+
+using WriteBuffer = llvm::SmallString<4096>;
+
+/// Reuse serialization buffers, so a message doesn't allocate in the common case.
+class BufferPool {
+public:
+    std::unique_ptr<WriteBuffer> acquire() {
+        if(buffers.empty()) {
+            stats.allocations += 1;
+            return std::make_unique<WriteBuffer>();
+        }
+
+        auto buffer = std::move(buffers.back());
+        buffers.pop_back();
+        buffer->clear();
+        return buffer;
+    }
+
+    void release(std::unique_ptr<WriteBuffer> buffer) {
+        /// Do not keep too many buffers or very large buffers.
+        if(buffers.size() < 16 && buffer->capacity() <= 1024 * 1024) {
+            buffers.emplace_back(std::move(buffer));
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<WriteBuffer>> buffers;
+};
+
+/// A message waiting for writing, it lives in the frame of the writing coroutine.
+struct PendingMessage {
+    llvm::SmallString<32> header;
+    std::unique_ptr<WriteBuffer> content;
+    core_handle waiting;
+
+    std::size_t size() const {
+        return header.size() + content->size();
+    }
+};
+
+/// Coalesce all messages written in the same loop iteration into one vectored write.
+/// Coroutines resumed in the idle phase write messages, and they are flushed in the
+/// prepare phase right after it, before the loop blocks in poll. At most one write
+/// is in flight, messages written meanwhile are flushed after it completes.
+class OutputQueue {
+public:
+    void push(PendingMessage* message) {
+        queue.emplace_back(message);
+        bytes += message->size();
+
+        if(!inflight) {
+            schedule();
+        }
+    }
+
+    std::size_t pending() const {
+        return bytes;
+    }
+
+    BufferPool pool;
+
+private:
+    void schedule() {
+        if(!initialized) {
+            uv_prepare_init(async::loop, &prepare);
+            prepare.data = this;
+            initialized = true;
+        }
+
+        uv_prepare_start(&prepare, [](uv_prepare_t* handle) {
+            uv_prepare_stop(handle);
+            static_cast<OutputQueue*>(handle->data)->flush();
+        });
+    }
+
+    void flush() {
+        if(queue.empty() || inflight) {
+            return;
+        }
+
+        batch.swap(queue);
+        buffers.clear();
+        for(auto message: batch) {
+            buffers.emplace_back(uv_buf_init(message->header.data(), message->header.size()));
+            buffers.emplace_back(uv_buf_init(message->content->data(), message->content->size()));
+        }
+
+        stats.writes += 1;
+        stats.messages += batch.size();
+        inflight = true;
+        request.data = this;
+        uv_check_call(uv_write,
+                      &request,
+                      writer,
+                      buffers.data(),
+                      buffers.size(),
+                      [](uv_write_t* request, int status) {
+                          if(status < 0) {
+                              log::fatal("An error occurred while writing: {0}",
+                                         uv_strerror(status));
+                          }
+                          static_cast<OutputQueue*>(request->data)->complete();
+                      });
+    }
+
+    void complete() {
+        inflight = false;
+
+        for(auto message: batch) {
+            bytes -= message->size();
+            pool.release(std::move(message->content));
+            async::schedule(message->waiting);
+        }
+        batch.clear();
+
+        if(!queue.empty()) {
+            schedule();
+        }
+    }
+
+private:
+    /// Messages waiting for the next flush.
+    std::vector<PendingMessage*> queue;
+
+    /// Messages being written.
+    std::vector<PendingMessage*> batch;
+    std::vector<uv_buf_t> buffers;
+    uv_write_t request;
+    bool inflight = false;
+
+    /// The total size of queued and being written messages.
+    std::size_t bytes = 0;
+
+    uv_prepare_t prepare;
+    bool initialized = false;
+};
+
+OutputQueue output;
+
+}  // namespace
+
+Task<> write(llvm::function_ref<void(llvm::raw_ostream&)> serialize) {
     struct awaiter {
-        uv_write_t write;
-        uv_buf_t buf[2];
-        llvm::SmallString<128> header;
-        llvm::SmallString<4096> message;
-        core_handle waiting;
+        PendingMessage message;
 
         bool await_ready() const noexcept {
             return false;
         }
 
         void await_suspend(core_handle waiting) noexcept {
-            write.data = this;
-
-            this->waiting = waiting;
-            buf[0] = uv_buf_init(header.data(), header.size());
-            buf[1] = uv_buf_init(message.data(), message.size());
-
-            uv_check_call(uv_write, &write, writer, buf, 2, [](uv_write_t* req, int status) {
-                if(status < 0) {
-                    log::fatal("An error occurred while writing: {0}", uv_strerror(status));
-                }
-
-                auto& awaiter = uv_cast<struct awaiter>(req);
-                async::schedule(awaiter.waiting);
-            });
+            message.waiting = waiting;
+            output.push(&message);
         }
 
         void await_resume() noexcept {}
     } awaiter;
 
-    llvm::raw_svector_ostream(awaiter.message) << value;
-    llvm::raw_svector_ostream(awaiter.header)
-        << "Content-Length: " << awaiter.message.size() << "\r\n\r\n";
+    awaiter.message.content = output.pool.acquire();
+    llvm::raw_svector_ostream stream(*awaiter.message.content);
+    serialize(stream);
+    llvm::raw_svector_ostream(awaiter.message.header)
+        << "Content-Length: " << awaiter.message.content->size() << "\r\n\r\n";
 
     co_await awaiter;
 }
 
+/// Write a JSON value to the client.
+Task<> write(json::Value value) {
+    co_await write([&](llvm::raw_ostream& os) { os << value; });
+}
+
+std::size_t pending() {
+    return output.pending();
+}
+
+const Statistics& statistics() {
+    return stats;
+}
+
+void redirect(uv_stream_t* stream) {
+    writer = stream;
+}
+
 }  // namespace clice::async::net
@@ -0,0 +1,202 @@
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "Async/Async.h"
+
+namespace clice::async {
+
+namespace {
+
+/// A work stealing thread pool. Each worker owns a deque for each priority lane.
+/// A worker takes jobs from the front of its own deques and steals from the back
+/// of others' when its own are empty. All interactive lanes are checked before
+/// any background lane.
+class ThreadPool {
+public:
+    ~ThreadPool() {
+        {
+            std::lock_guard guard(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+
+        for(auto& thread: threads) {
+            thread.join();
+        }
+    }
+
+    void configure(std::size_t threads) {
+        count = threads;
+    }
+
+    /// Push a job into the pool, called in the loop thread.
+    void push(impl::job* job) {
+        if(threads.empty()) {
+            start();
+        }
+
+        /// Keep the loop alive while there are running jobs.
+        if(pending++ == 0) {
+            uv_ref(reinterpret_cast<uv_handle_t*>(&notifier));
+        }
+
+        auto& worker = *workers[next++ % workers.size()];
+        {
+            std::lock_guard guard(worker.mutex);
+            worker.lanes[static_cast<std::size_t>(job->priority)].push_back(job);
+        }
+
+        {
+            std::lock_guard guard(mutex);
+            queued += 1;
+        }
+        condition.notify_one();
+    }
+
+private:
+    constexpr inline static std::size_t laneCount = 2;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<impl::job*> lanes[laneCount];
+    };
+
+    void start() {
+        if(count == 0) {
+            count = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        uv_async_init(loop, &notifier, [](uv_async_t* handle) {
+            auto& pool = *static_cast<ThreadPool*>(handle->data);
+            pool.complete();
+        });
+        notifier.data = this;
+        uv_unref(reinterpret_cast<uv_handle_t*>(&notifier));
+
+        for(std::size_t i = 0; i < count; ++i) {
+            workers.emplace_back(std::make_unique<Worker>());
+        }
+
+        for(std::size_t i = 0; i < count; ++i) {
+            threads.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    /// Take a job for the given worker, return nullptr if all lanes are empty.
+    impl::job* take(std::size_t self) {
+        for(std::size_t lane = 0; lane < laneCount; ++lane) {
+            {
+                auto& worker = *workers[self];
+                std::lock_guard guard(worker.mutex);
+                auto& jobs = worker.lanes[lane];
+                if(!jobs.empty()) {
+                    auto job = jobs.front();
+                    jobs.pop_front();
+                    return job;
+                }
+            }
+
+            for(std::size_t i = 1; i < workers.size(); ++i) {
+                auto& victim = *workers[(self + i) % workers.size()];
+                std::lock_guard guard(victim.mutex);
+                auto& jobs = victim.lanes[lane];
+                if(!jobs.empty()) {
+                    auto job = jobs.back();
+                    jobs.pop_back();
+                    return job;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+    void work(std::size_t self) {
+        while(true) {
+            {
+                std::unique_lock lock(mutex);
+                condition.wait(lock, [&] { return stopping || queued > 0; });
+                if(stopping) {
+                    return;
+                }
+                queued -= 1;
+            }
+
+            /// A job is reserved by decreasing `queued`, so it must be found eventually.
+            impl::job* job = nullptr;
+            while(!(job = take(self))) {
+                std::this_thread::yield();
+            }
+
+            job->run(job);
+
+            {
+                std::lock_guard guard(finishedMutex);
+                finished.push_back(job);
+            }
+            uv_async_send(&notifier);
+        }
+    }
+
+    /// Resume the coroutines whose jobs are done, called in the loop thread.
+    void complete() {
+        std::vector<impl::job*> jobs;
+        {
+            std::lock_guard guard(finishedMutex);
+            jobs.swap(finished);
+        }
+
+        for(auto job: jobs) {
+            async::schedule(job->waiting);
+        }
+
+        pending -= jobs.size();
+        if(pending == 0) {
+            uv_unref(reinterpret_cast<uv_handle_t*>(&notifier));
+        }
+    }
+
+private:
+    /// The count of worker threads.
+    std::size_t count = 0;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    /// Protect `queued` and `stopping`, idle workers wait on the condition.
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::size_t queued = 0;
+    bool stopping = false;
+
+    /// The worker which the next job is pushed to, only used in the loop thread.
+    std::size_t next = 0;
+
+    /// The count of submitted but not yet resumed jobs, only used in the loop thread.
+    std::size_t pending = 0;
+
+    /// Done jobs waiting for resuming in the loop thread.
+    std::mutex finishedMutex;
+    std::vector<impl::job*> finished;
+
+    /// Wake up the loop thread when jobs are done.
+    uv_async_t notifier;
+};
+
+ThreadPool pool;
+
+}  // namespace
+
+void impl::job::enqueue() {
+    pool.push(this);
+}
+
+void init_thread_pool(std::size_t threads) {
+    pool.configure(threads);
+}
+
+}  // namespace clice::async
@@ -0,0 +1,79 @@
+#include "Basic/LineTable.h"
+#include "Support/Ranges.h"
+
+#include <bit>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace clice {
+
+LineTable::LineTable(llvm::StringRef content) : text(content) {
+    const char* data = content.data();
+    std::uint32_t size = content.size();
+
+    /// Most source lines are shorter than 64 characters.
+    starts.reserve(size / 32 + 1);
+    starts.push_back(0);
+
+    std::uint32_t i = 0;
+    bool hasNonASCII = false;
+    llvm::SmallVector<std::uint32_t> nonASCIILines;
+
+    auto endLine = [&](std::uint32_t newline) {
+        if(hasNonASCII) {
+            nonASCIILines.push_back(starts.size() - 1);
+            hasNonASCII = false;
+        }
+        starts.push_back(newline + 1);
+    };
+
+#ifdef __SSE2__
+    /// Scan 16 bytes at a time, one mask for newlines and one for non-ASCII bytes
+    /// (their highest bit is set).
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; i + 16 <= size; i += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        std::uint32_t newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        std::uint32_t highs = _mm_movemask_epi8(chunk);
+
+        while(newlines) {
+            auto bit = std::countr_zero(newlines);
+            auto before = (1u << bit) - 1;
+            hasNonASCII |= (highs & before) != 0;
+            highs &= ~before;
+            endLine(i + bit);
+            newlines &= newlines - 1;
+        }
+
+        hasNonASCII |= highs != 0;
+    }
+#endif
+
+    for(; i < size; ++i) {
+        auto c = static_cast<unsigned char>(data[i]);
+        if(c == '\n') {
+            endLine(i);
+        } else if(c & 0x80) {
+            hasNonASCII = true;
+        }
+    }
+
+    if(hasNonASCII) {
+        nonASCIILines.push_back(starts.size() - 1);
+    }
+
+    nonASCII.resize(starts.size());
+    for(auto line: nonASCIILines) {
+        nonASCII.set(line);
+    }
+}
+
+std::uint32_t LineTable::lineOf(std::uint32_t offset) const {
+    assert(offset <= text.size() && "Offset is out of range");
+    /// The first line start which is greater than offset is the next line.
+    return ranges::upper_bound(starts, offset) - starts.begin() - 1;
+}
+
+}  // namespace clice
@@ -95,30 +95,74 @@ proto::Position SourceConverter::toPosition(llvm::StringRef content, std::uint32
     assert(offset <= content.size() && "Offset is out of range");
     proto::Position position = {0, 0};
 
-    std::uint32_t line = 0;
-    std::uint32_t column = 0;
-    for(std::uint32_t i = 0; i < offset; i++) {
-        auto c = content[i];
-        if(c == '\n') {
-            line += 1;
-            column = 0;
-        } else {
-            column += 1;
-        }
-    }
-
-    /// Line doesn't need to be adjusted.
-    position.line = line;
+    /// `count` and `rfind` are much faster than checking characters one by one.
+    auto prefix = content.take_front(offset);
+    position.line = prefix.count('\n');
 
     /// Column needs to be adjusted based on the encoding.
-    if(column > 0) {
-        auto word = content.substr(offset - column, column);
+    auto lineStart = prefix.rfind('\n');
+    auto word = lineStart == llvm::StringRef::npos ? prefix : prefix.drop_front(lineStart + 1);
+    if(!word.empty()) {
         position.character = remeasure(word);
     }
 
     return position;
 }
 
+proto::Position SourceConverter::toPosition(const LineTable& lines, std::uint32_t offset) const {
+    auto line = lines.lineOf(offset);
+    auto start = lines.lineStart(line);
+
+    proto::Position position = {line, offset - start};
+
+    /// Column of an ASCII line is the same in all encodings.
+    if(kind != proto::PositionEncodingKind::UTF8 && !lines.isASCII(line)) {
+        position.character = remeasure(lines.content().slice(start, offset));
+    }
+
+    return position;
+}
+
+void SourceConverter::toPositions(const LineTable& lines,
+                                  llvm::ArrayRef<std::uint32_t> offsets,
+                                  std::vector<proto::Position>& positions) const {
+    positions.reserve(positions.size() + offsets.size());
+
+    auto content = lines.content();
+    bool needRemeasure = kind != proto::PositionEncodingKind::UTF8;
+
+    auto lineEnd = [&](std::uint32_t line) -> std::uint64_t {
+        return line + 1 < lines.lineCount() ? lines.lineStart(line + 1) : content.size() + 1;
+    };
+
+    std::uint32_t line = 0;
+    std::uint64_t nextLineStart = lineEnd(0);
+
+    /// The last measured offset and its column in the current line.
+    std::uint32_t lastOffset = 0;
+    std::uint32_t lastCharacter = 0;
+
+    for(auto offset: offsets) {
+        assert(offset >= lastOffset && "Offsets must be sorted");
+
+        if(offset >= nextLineStart) {
+            line = lines.lineOf(offset);
+            nextLineStart = lineEnd(line);
+            lastOffset = lines.lineStart(line);
+            lastCharacter = 0;
+        }
+
+        if(needRemeasure && !lines.isASCII(line)) {
+            lastCharacter += remeasure(content.slice(lastOffset, offset));
+        } else {
+            lastCharacter += offset - lastOffset;
+        }
+
+        lastOffset = offset;
+        positions.push_back({line, lastCharacter});
+    }
+}
+
 proto::Position SourceConverter::toPosition(clang::SourceLocation location,
                                             const clang::SourceManager& SM) const {
     assert(location.isValid() && location.isFileID() &&
@@ -149,6 +193,13 @@ proto::Range SourceConverter::toRange(LocalSourceRange range, llvm::StringRef co
     };
 }
 
+proto::Range SourceConverter::toRange(LocalSourceRange range, const LineTable& lines) const {
+    return {
+        .start = toPosition(lines, range.begin),
+        .end = toPosition(lines, range.end),
+    };
+}
+
 LocalSourceRange SourceConverter::toLocalRange(clang::SourceRange range,
                                                const clang::SourceManager& SM) const {
     return {
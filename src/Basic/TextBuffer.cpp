@@ -0,0 +1,193 @@
+#include <cstring>
+
+#include "Basic/TextBuffer.h"
+#include "Basic/SourceConverter.h"
+#include "Support/Ranges.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace clice {
+
+namespace {
+
+/// The size of blocks of inserted text.
+constexpr std::uint32_t blockSize = 64 * 1024;
+
+/// Finding a piece is linear, so pieces are flattened if there are too many.
+constexpr std::size_t maxPieces = 1024;
+
+}  // namespace
+
+TextBuffer::TextBuffer(std::string content) {
+    base = std::make_shared<TextSnapshot>(std::move(content));
+    current = base;
+
+    auto text = base->content();
+    length = text.size();
+    if(length != 0) {
+        pieces.push_back({text.data(), length});
+    }
+
+    auto& lines = base->lines();
+    starts.reserve(lines.lineCount());
+    for(std::uint32_t line = 0; line < lines.lineCount(); ++line) {
+        starts.push_back(lines.lineStart(line));
+    }
+}
+
+std::pair<std::size_t, std::uint32_t> TextBuffer::find(std::uint32_t offset) const {
+    std::uint32_t start = 0;
+    for(std::size_t i = 0; i < pieces.size(); ++i) {
+        if(offset < start + pieces[i].length) {
+            return {i, offset - start};
+        }
+        start += pieces[i].length;
+    }
+    return {pieces.size(), 0};
+}
+
+const char* TextBuffer::append(llvm::StringRef text) {
+    if(capacity - used < text.size()) {
+        capacity = std::max<std::uint32_t>(blockSize, text.size());
+        blocks.emplace_back(new char[capacity]);
+        used = 0;
+    }
+
+    auto data = blocks.back().get() + used;
+    std::memcpy(data, text.data(), text.size());
+    used += text.size();
+    return data;
+}
+
+void TextBuffer::replace(std::uint32_t begin, std::uint32_t end, llvm::StringRef text) {
+    assert(begin <= end && end <= length && "Range is out of text");
+    if(begin == end && text.empty()) {
+        return;
+    }
+
+    current.reset();
+
+    /// Remove line starts in the replaced range, shift the following ones and add the
+    /// line starts in the new text.
+    std::int64_t delta = std::int64_t(text.size()) - (end - begin);
+    auto first = ranges::upper_bound(starts, begin) - starts.begin();
+    auto last = ranges::upper_bound(starts, end) - starts.begin();
+    for(auto i = last; i < starts.size(); ++i) {
+        starts[i] += delta;
+    }
+
+    llvm::SmallVector<std::uint32_t> inserted;
+    for(auto i = text.find('\n'); i != llvm::StringRef::npos; i = text.find('\n', i + 1)) {
+        inserted.push_back(begin + i + 1);
+    }
+    starts.erase(starts.begin() + first, starts.begin() + last);
+    starts.insert(starts.begin() + first, inserted.begin(), inserted.end());
+
+    auto [beginIndex, beginOffset] = find(begin);
+    auto [endIndex, endOffset] = find(end);
+
+    /// Typing right after the last insertion extends its piece.
+    bool extended = false;
+    if(!text.empty() && beginOffset == 0 && beginIndex > 0 && !blocks.empty() &&
+       capacity - used >= text.size()) {
+        auto& previous = pieces[beginIndex - 1];
+        if(previous.data + previous.length == blocks.back().get() + used) {
+            append(text);
+            previous.length += text.size();
+            extended = true;
+        }
+    }
+
+    llvm::SmallVector<Piece, 3> replacement;
+    if(beginOffset != 0) {
+        replacement.push_back({pieces[beginIndex].data, beginOffset});
+    }
+
+    if(!text.empty() && !extended) {
+        replacement.push_back({append(text), std::uint32_t(text.size())});
+    }
+
+    if(endIndex < pieces.size()) {
+        auto& piece = pieces[endIndex];
+        replacement.push_back({piece.data + endOffset, piece.length - endOffset});
+    }
+
+    auto eraseEnd = std::min(endIndex + 1, pieces.size());
+    pieces.erase(pieces.begin() + beginIndex, pieces.begin() + eraseEnd);
+    pieces.insert(pieces.begin() + beginIndex, replacement.begin(), replacement.end());
+    length += delta;
+
+    if(pieces.size() > maxPieces) {
+        flatten();
+    }
+}
+
+void TextBuffer::apply(const proto::TextDocumentContentChangeEvent& change,
+                       const SourceConverter& converter) {
+    /// A change without range replaces the whole text.
+    if(!change.range) {
+        replace(0, length, change.text);
+        return;
+    }
+
+    auto begin = offset(change.range->start, converter);
+    auto end = std::max(begin, offset(change.range->end, converter));
+    replace(begin, end, change.text);
+}
+
+std::uint32_t TextBuffer::offset(proto::Position position,
+                                 const SourceConverter& converter) const {
+    if(position.line >= starts.size()) {
+        return length;
+    }
+
+    auto begin = starts[position.line];
+    auto end = position.line + 1 < starts.size() ? starts[position.line + 1] - 1 : length;
+
+    /// Only the line is copied to measure the column.
+    std::string line;
+    read(begin, end, line);
+    if(position.character >= converter.remeasure(line)) {
+        return end;
+    }
+
+    return begin + converter.toOffset(line, {0, position.character});
+}
+
+void TextBuffer::read(std::uint32_t begin, std::uint32_t end, std::string& out) const {
+    auto [index, offset] = find(begin);
+    auto remaining = end - begin;
+    for(; index < pieces.size() && remaining != 0; ++index, offset = 0) {
+        auto count = std::min(remaining, pieces[index].length - offset);
+        out.append(pieces[index].data + offset, count);
+        remaining -= count;
+    }
+}
+
+void TextBuffer::flatten() {
+    std::string text;
+    text.reserve(length);
+    for(auto& piece: pieces) {
+        text.append(piece.data, piece.length);
+    }
+
+    base = std::make_shared<TextSnapshot>(std::move(text));
+    current = base;
+
+    pieces.clear();
+    if(length != 0) {
+        pieces.push_back({base->content().data(), length});
+    }
+
+    blocks.clear();
+    used = 0;
+    capacity = 0;
+}
+
+std::shared_ptr<const TextSnapshot> TextBuffer::snapshot() {
+    if(!current) {
+        flatten();
+    }
+    return current;
+}
+
+}  // namespace clice
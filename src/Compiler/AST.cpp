@@ -45,4 +45,19 @@ std::vector<std::string> ASTInfo::deps() {
     return result;
 }
 
+std::size_t ASTInfo::memory() {
+    auto& SM = srcMgr();
+    std::size_t size = context().getASTAllocatedMemory() +
+                       context().getSideTableAllocatedMemory() + SM.getContentCacheSize() +
+                       SM.getDataStructureSizes() + SM.getMemoryBufferSizes().malloc_bytes +
+                       pp().getTotalMemory();
+
+    if(buffer) {
+        size += buffer->expandedTokens().size() * sizeof(clang::syntax::Token);
+        size += buffer->spelledTokens(SM.getMainFileID()).size() * sizeof(clang::syntax::Token);
+    }
+
+    return size;
+}
+
 }  // namespace clice
@@ -2,37 +2,81 @@
 #include "Support/FileSystem.h"
 #include "Support/Format.h"
 
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/CommandLine.h"
+
 namespace clice {
 
+void tokenizeCommand(llvm::StringRef command,
+                     llvm::StringSaver& saver,
+                     llvm::SmallVectorImpl<const char*>& out) {
+#ifdef _WIN32
+    llvm::cl::TokenizeWindowsCommandLine(command, saver, out);
+#else
+    llvm::cl::TokenizeGNUCommandLine(command, saver, out);
+#endif
+}
+
+void appendArgument(std::string& command, llvm::StringRef arg) {
+    if(!command.empty()) {
+        command += ' ';
+    }
+
+#ifdef _WIN32
+    if(!arg.empty() && arg.find_first_of(" \t\n\"") == llvm::StringRef::npos) {
+        command += arg;
+        return;
+    }
+
+    /// Backslashes are literal unless they precede a double quote, then both the
+    /// backslashes and the quote are escaped. So are the ones before the closing quote.
+    command += '"';
+    std::size_t backslashes = 0;
+    for(char c: arg) {
+        if(c == '\\') {
+            backslashes += 1;
+        } else if(c == '"') {
+            command.append(backslashes + 1, '\\');
+            backslashes = 0;
+        } else {
+            backslashes = 0;
+        }
+        command += c;
+    }
+    command.append(backslashes, '\\');
+    command += '"';
+#else
+    if(!arg.empty() && arg.find_first_of(" \t\n'\"\\") == llvm::StringRef::npos) {
+        command += arg;
+        return;
+    }
+
+    /// Backslashes and double quotes are escaped in double quotes.
+    command += '"';
+    for(char c: arg) {
+        if(c == '\\' || c == '"') {
+            command += '\\';
+        }
+        command += c;
+    }
+    command += '"';
+#endif
+}
+
 std::expected<void, std::string> mangleCommand(llvm::StringRef command,
                                                llvm::SmallVectorImpl<const char*>& out,
                                                llvm::SmallVectorImpl<char>& buffer) {
+    /// It is the inverse of the quoting in `CompilationDatabase::getCommand`.
+    llvm::BumpPtrAllocator allocator;
+    llvm::StringSaver saver(allocator);
+    llvm::SmallVector<const char*, 64> tokens;
+    tokenizeCommand(command, saver, tokens);
+
     llvm::SmallString<128> current;
     llvm::SmallVector<uint32_t> indices;
-    bool inSingleQuote = false;
-    bool inDoubleQuote = false;
-
-    for(size_t i = 0; i < command.size(); ++i) {
-        char c = command[i];
-        if(c == ' ' && !inSingleQuote && !inDoubleQuote) {
-            if(!current.empty()) {
-                indices.push_back(buffer.size());
-                buffer.append(current);
-                buffer.push_back('\0');
-                current.clear();
-            }
-        } else if(c == '\'' && !inDoubleQuote) {
-            inSingleQuote = !inSingleQuote;
-        } else if(c == '"' && !inSingleQuote) {
-            inDoubleQuote = !inDoubleQuote;
-        } else {
-            current.push_back(c);
-        }
-    }
-
-    if(!current.empty()) {
+    for(llvm::StringRef token: tokens) {
         indices.push_back(buffer.size());
-        buffer.append(current);
+        buffer.append(token.begin(), token.end());
         buffer.push_back('\0');
     }
 
@@ -70,4 +114,32 @@ std::expected<void, std::string> mangleCommand(llvm::StringRef command,
     return {};
 }
 
+bool isInputFile(llvm::StringRef arg, llvm::StringRef srcPath) {
+    if(arg.empty() || arg.starts_with("-") || srcPath.empty()) {
+        return false;
+    }
+
+    auto normalize = [](llvm::StringRef file) {
+        llvm::SmallString<128> path = file;
+        fs::make_absolute(path);
+        path::remove_dots(path, true);
+        return path;
+    };
+
+    auto path = normalize(arg);
+    auto src = normalize(srcPath);
+    if(path == src) {
+        return true;
+    }
+
+    /// Only stat files with the same name, e.g. the source file is under a symbolic link
+    /// directory. Other arguments like the compiler itself are not worth the syscalls.
+    if(path::filename(path) != path::filename(src)) {
+        return false;
+    }
+
+    bool result = false;
+    return !fs::equivalent(path, src, result) && result;
+}
+
 }  // namespace clice
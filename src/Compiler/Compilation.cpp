@@ -1,13 +1,74 @@
 #include "Compiler/Command.h"
 #include "Compiler/Compilation.h"
 
+#include <mutex>
+
 #include "clang/Lex/PreprocessorOptions.h"
+#include "clang/Frontend/MultiplexConsumer.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 
 namespace clice {
 
 namespace impl {
 
+namespace {
+
+/// Running the driver to parse arguments is expensive, and many files share the same
+/// arguments. So cache the parsed invocation by the arguments except the input file.
+class InvocationCache {
+public:
+    std::shared_ptr<const clang::CompilerInvocation> get(llvm::StringRef key) {
+        std::lock_guard guard(mutex);
+        if(auto iter = invocations.find(key); iter != invocations.end()) {
+            hits += 1;
+            return iter->second;
+        }
+        misses += 1;
+        return nullptr;
+    }
+
+    void put(llvm::StringRef key, std::shared_ptr<const clang::CompilerInvocation> invocation) {
+        std::lock_guard guard(mutex);
+        /// Commands in a project are usually few, just drop all if there are too many.
+        if(invocations.size() >= capacity) {
+            invocations.clear();
+        }
+        invocations[key] = std::move(invocation);
+    }
+
+    InvocationCacheStatistics statistics() {
+        std::lock_guard guard(mutex);
+        return {hits, misses, invocations.size()};
+    }
+
+    void clear() {
+        std::lock_guard guard(mutex);
+        invocations.clear();
+        hits = 0;
+        misses = 0;
+    }
+
+private:
+    constexpr inline static std::size_t capacity = 256;
+
+    std::mutex mutex;
+    llvm::StringMap<std::shared_ptr<const clang::CompilerInvocation>> invocations;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+};
+
+InvocationCache invocations;
+
+}  // namespace
+
+InvocationCacheStatistics invocationCacheStatistics() {
+    return invocations.statistics();
+}
+
+void clearInvocationCache() {
+    invocations.clear();
+}
+
 std::unique_ptr<clang::CompilerInvocation> createInvocation(CompilationParams& params) {
     llvm::SmallString<1024> buffer;
     llvm::SmallVector<const char*, 16> args;
@@ -16,12 +77,44 @@ std::unique_ptr<clang::CompilerInvocation> createInvocation(CompilationParams& p
         std::terminate();
     }
 
-    clang::CreateInvocationOptions options = {};
-    options.VFS = params.vfs;
+    /// The key is the arguments except the input file, but the extension of the input
+    /// file is kept because it determines the language.
+    llvm::SmallString<1024> key;
+    std::optional<std::size_t> input;
+    for(std::size_t i = 0; i < args.size(); ++i) {
+        llvm::StringRef arg = args[i];
+        if(!input && isInputFile(arg, params.srcPath)) {
+            input = i;
+            key += path::extension(arg);
+        } else {
+            key += arg;
+        }
+        key.push_back('\0');
+    }
 
-    auto invocation = clang::createInvocation(args, options);
-    if(!invocation) {
-        std::terminate();
+    std::unique_ptr<clang::CompilerInvocation> invocation;
+    if(auto cached = invocations.get(key)) {
+        /// Copy the cached invocation (deep copy) and retarget it to the input file.
+        invocation = std::make_unique<clang::CompilerInvocation>(*cached);
+        auto& inputs = invocation->getFrontendOpts().Inputs;
+        if(input && inputs.size() == 1) {
+            inputs[0] = clang::FrontendInputFile(args[*input], inputs[0].getKind());
+            invocation->getCodeGenOpts().MainFileName = path::filename(args[*input]);
+        }
+    } else {
+        clang::CreateInvocationOptions options = {};
+        options.VFS = params.vfs;
+
+        invocation = clang::createInvocation(args, options);
+        if(!invocation) {
+            std::terminate();
+        }
+
+        /// Only cache the invocation whose input file is known, so that it could be
+        /// retargeted.
+        if(input && invocation->getFrontendOpts().Inputs.size() == 1) {
+            invocations.put(key, std::make_shared<clang::CompilerInvocation>(*invocation));
+        }
     }
 
     auto& frontOpts = invocation->getFrontendOpts();
@@ -57,10 +150,12 @@ std::unique_ptr<clang::CompilerInstance> createInstance(CompilationParams& param
     assert(!instance->getPreprocessorOpts().RetainRemappedFileBuffers &&
            "RetainRemappedFileBuffers should be false");
     if(!params.content.empty()) {
-        instance->getPreprocessorOpts().addRemappedFile(
-            params.srcPath,
-            llvm::MemoryBuffer::getMemBufferCopy(params.content.substr(0, size), params.srcPath)
-                .release());
+        /// A cut off content is not null terminated, so it is always copied.
+        auto buffer = params.borrowContent && size == params.content.size()
+                          ? llvm::MemoryBuffer::getMemBuffer(params.content, params.srcPath)
+                          : llvm::MemoryBuffer::getMemBufferCopy(params.content.substr(0, size),
+                                                                 params.srcPath);
+        instance->getPreprocessorOpts().addRemappedFile(params.srcPath, buffer.release());
     }
 
     for(auto& [file, content]: params.remappedFiles) {
@@ -80,6 +175,16 @@ std::unique_ptr<clang::CompilerInstance> createInstance(CompilationParams& param
         PPOpts.ImplicitPCHInclude = std::move(pch);
         PPOpts.PrecompiledPreambleBytes = {bound, false};
         PPOpts.DisablePCHOrModuleValidation = clang::DisableValidationForModuleKind::PCH;
+
+        /// The patch is a virtual file next to the source file, so that quoted includes
+        /// are searched from the same directory.
+        if(!params.patch.empty()) {
+            auto path = (params.srcPath + ".preamble.patch").str();
+            PPOpts.addRemappedFile(
+                path,
+                llvm::MemoryBuffer::getMemBufferCopy(params.patch, path).release());
+            PPOpts.Includes.emplace_back(std::move(path));
+        }
     }
 
     for(auto& [name, path]: params.pcms) {
@@ -94,6 +199,71 @@ std::unique_ptr<clang::CompilerInstance> createInstance(CompilationParams& param
 
 namespace {
 
+/// Forward all callbacks to the original consumer, but stop parsing once the compilation
+/// is cancelled. `clang::ParseAST` returns immediately if `HandleTopLevelDecl` returns false,
+/// and `HandleTranslationUnit` is not called, so no output(e.g. PCH) is written.
+///
+/// A top level declaration is handled after it is parsed entirely, e.g. a namespace with
+/// the whole file in it. So the flag is also checked when a class or an inline function
+/// is defined. Parsing could not be stopped there, a fatal error is reported instead, then
+/// Sema stops instantiating templates and drops all later diagnostics.
+class CancellableConsumer : public clang::MultiplexConsumer {
+public:
+    CancellableConsumer(std::vector<std::unique_ptr<clang::ASTConsumer>> consumers,
+                        std::shared_ptr<const std::atomic<bool>> cancelled) :
+        clang::MultiplexConsumer(std::move(consumers)), cancelled(std::move(cancelled)) {}
+
+    void Initialize(clang::ASTContext& context) override {
+        this->context = &context;
+        clang::MultiplexConsumer::Initialize(context);
+    }
+
+    bool HandleTopLevelDecl(clang::DeclGroupRef group) override {
+        if(isCancelled()) {
+            return false;
+        }
+        return clang::MultiplexConsumer::HandleTopLevelDecl(group);
+    }
+
+    void HandleInlineFunctionDefinition(clang::FunctionDecl* decl) override {
+        if(!isCancelled()) {
+            clang::MultiplexConsumer::HandleInlineFunctionDefinition(decl);
+        }
+    }
+
+    void HandleTagDeclDefinition(clang::TagDecl* decl) override {
+        if(!isCancelled()) {
+            clang::MultiplexConsumer::HandleTagDeclDefinition(decl);
+        }
+    }
+
+    void HandleTranslationUnit(clang::ASTContext& context) override {
+        if(!isCancelled()) {
+            clang::MultiplexConsumer::HandleTranslationUnit(context);
+        }
+    }
+
+private:
+    bool isCancelled() {
+        if(!cancelled->load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        if(!reported && context) {
+            auto& diagnostics = context->getDiagnostics();
+            diagnostics.Report(diagnostics.getCustomDiagID(clang::DiagnosticsEngine::Fatal,
+                                                           "compilation is cancelled"));
+            reported = true;
+        }
+        return true;
+    }
+
+private:
+    std::shared_ptr<const std::atomic<bool>> cancelled;
+    clang::ASTContext* context = nullptr;
+    bool reported = false;
+};
+
 /// Execute given action with the on the given instance. `callback` is called after
 /// `BeginSourceFile`. Beacuse `BeginSourceFile` may create new preprocessor.
 std::expected<void, std::string> ExecuteAction(clang::CompilerInstance& instance,
@@ -113,12 +283,24 @@ std::expected<void, std::string> ExecuteAction(clang::CompilerInstance& instance
 }
 
 std::expected<ASTInfo, std::string> ExecuteAction(std::unique_ptr<clang::CompilerInstance> instance,
-                                                  std::unique_ptr<clang::FrontendAction> action) {
+                                                  std::unique_ptr<clang::FrontendAction> action,
+                                                  const CompilationParams& params) {
+    if(params.cancelled && params.cancelled->load(std::memory_order_relaxed)) {
+        return std::unexpected("Compilation is cancelled");
+    }
 
     if(!action->BeginSourceFile(*instance, instance->getFrontendOpts().Inputs[0])) {
         return std::unexpected("Failed to begin source file");
     }
 
+    /// The consumer is created in `BeginSourceFile` and used by `Sema` in `Execute`.
+    if(params.cancelled && instance->hasASTConsumer()) {
+        std::vector<std::unique_ptr<clang::ASTConsumer>> consumers;
+        consumers.emplace_back(instance->takeASTConsumer());
+        instance->setASTConsumer(
+            std::make_unique<CancellableConsumer>(std::move(consumers), params.cancelled));
+    }
+
     auto& pp = instance->getPreprocessor();
     // FIXME: clang-tidy, include-fixer, etc?
 
@@ -142,6 +324,10 @@ std::expected<ASTInfo, std::string> ExecuteAction(std::unique_ptr<clang::Compile
         return std::unexpected(std::format("Failed to execute action, because {} ", error));
     }
 
+    if(params.cancelled && params.cancelled->load(std::memory_order_relaxed)) {
+        return std::unexpected("Compilation is cancelled");
+    }
+
     std::optional<clang::syntax::TokenBuffer> tokBuf;
     if(tokCollector) {
         tokBuf = std::move(*tokCollector).consume();
@@ -155,7 +341,19 @@ std::expected<ASTInfo, std::string> ExecuteAction(std::unique_ptr<clang::Compile
         resolver.emplace(instance->getSema());
     }
 
-    return ASTInfo(pp.getSourceManager().getMainFileID(),
+    /// A header compiled in the context of a source file is the interested one, fall back to
+    /// the main file if it is not included at all.
+    auto& srcMgr = pp.getSourceManager();
+    clang::FileID interested = srcMgr.getMainFileID();
+    if(!params.interested.empty()) {
+        if(auto file = srcMgr.getFileManager().getOptionalFileRef(params.interested)) {
+            if(auto fid = srcMgr.translateFile(*file); fid.isValid()) {
+                interested = fid;
+            }
+        }
+    }
+
+    return ASTInfo(interested,
                    std::move(action),
                    std::move(instance),
                    std::move(resolver),
@@ -168,7 +366,7 @@ std::expected<ASTInfo, std::string> ExecuteAction(std::unique_ptr<clang::Compile
 std::expected<ASTInfo, std::string> compile(CompilationParams& params) {
     auto instance = impl::createInstance(params);
 
-    return ExecuteAction(std::move(instance), std::make_unique<clang::SyntaxOnlyAction>());
+    return ExecuteAction(std::move(instance), std::make_unique<clang::SyntaxOnlyAction>(), params);
 }
 
 std::expected<ASTInfo, std::string> compile(CompilationParams& params,
@@ -181,7 +379,7 @@ std::expected<ASTInfo, std::string> compile(CompilationParams& params,
     instance->getFrontendOpts().CodeCompletionAt.Column = params.column;
     instance->setCodeCompletionConsumer(consumer);
 
-    return ExecuteAction(std::move(instance), std::make_unique<clang::SyntaxOnlyAction>());
+    return ExecuteAction(std::move(instance), std::make_unique<clang::SyntaxOnlyAction>(), params);
 }
 
 std::expected<ASTInfo, std::string> compile(CompilationParams& params, PCHInfo& out) {
@@ -198,7 +396,9 @@ std::expected<ASTInfo, std::string> compile(CompilationParams& params, PCHInfo&
     instance->getLangOpts().CompilingPCH = true;
 
     if(auto info =
-           ExecuteAction(std::move(instance), std::make_unique<clang::GeneratePCHAction>())) {
+           ExecuteAction(std::move(instance),
+                         std::make_unique<clang::GeneratePCHAction>(),
+                         params)) {
         out.path = outPath;
         out.preamble = params.content.substr(0, *params.bound);
         out.command = params.command.str();
@@ -219,7 +419,8 @@ std::expected<ASTInfo, std::string> compile(CompilationParams& params, PCMInfo&
 
     ;
     if(auto info = ExecuteAction(std::move(instance),
-                                 std::make_unique<clang::GenerateReducedModuleInterfaceAction>())) {
+                                 std::make_unique<clang::GenerateReducedModuleInterfaceAction>(),
+                                 params)) {
         assert(info->pp().isInNamedInterfaceUnit() &&
                "Only module interface unit could be built as PCM");
         out.isInterfaceUnit = true;
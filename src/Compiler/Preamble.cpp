@@ -1,5 +1,9 @@
 #include "Compiler/Preamble.h"
+#include "Support/Format.h"
 #include "clang/Lex/Lexer.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/SmallVector.h"
 
 namespace clice {
 
@@ -59,8 +63,194 @@ std::uint32_t computePreambleBound(llvm::StringRef content) {
     }
 }
 
-std::uint32_t computeBounds(CompilationParams& params) {
-    return 0;
+namespace {
+
+/// A directive or another logical line of the preamble.
+struct PreambleLine {
+    /// The tokens separated by a space, so whitespace and comments are not compared.
+    std::string text;
+
+    /// The source from the first token to the end of the last one.
+    llvm::StringRef source;
+
+    /// The name of the directive, e.g. `include`, empty if it is not a directive.
+    llvm::StringRef directive;
+
+    /// The 1-based line of the first token.
+    std::uint32_t line = 0;
+};
+
+/// Split the preamble into logical lines with the raw lexer like `computePreambleBound`, so
+/// directives in comments are not taken into account.
+std::vector<PreambleLine> lexPreamble(llvm::StringRef content) {
+    clang::LangOptions langOpts;
+    langOpts.CPlusPlus = true;
+    langOpts.CPlusPlus26 = true;
+
+    auto beginLoc = clang::SourceLocation::getFromRawEncoding(1);
+    clang::Lexer lexer(beginLoc, langOpts, content.begin(), content.begin(), content.end());
+
+    std::vector<PreambleLine> lines;
+    std::uint32_t line = 1;
+    std::size_t counted = 0;
+    std::size_t first = 0;
+    std::size_t tokens = 0;
+
+    clang::Token token;
+    while(true) {
+        lexer.LexFromRawLexer(token);
+        if(token.is(clang::tok::eof)) {
+            break;
+        }
+
+        std::size_t offset = token.getLocation().getRawEncoding() - beginLoc.getRawEncoding();
+        auto spelling = content.substr(offset, token.getLength());
+        if(token.isAtStartOfLine() || lines.empty()) {
+            line += content.slice(counted, offset).count('\n');
+            counted = offset;
+            first = offset;
+            tokens = 0;
+            lines.emplace_back().line = line;
+        }
+
+        auto& current = lines.back();
+        if(tokens != 0) {
+            current.text += ' ';
+        }
+        current.text += spelling;
+        current.source = content.slice(first, offset + token.getLength());
+
+        /// The directive name follows the `#` at the start of line.
+        if(tokens == 1 && current.text.starts_with("#") && token.is(clang::tok::raw_identifier)) {
+            current.directive = token.getRawIdentifier();
+        }
+        tokens += 1;
+    }
+
+    return lines;
+}
+
+/// Whether the directive is an `#include`, `#include_next` or `#import`.
+bool isInclude(llvm::StringRef directive) {
+    return directive == "include" || directive == "include_next" || directive == "import";
+}
+
+/// Update the depth of conditional blocks after the directive.
+void updateDepth(llvm::StringRef directive, std::uint32_t& depth) {
+    if(directive == "if" || directive == "ifdef" || directive == "ifndef") {
+        depth += 1;
+    } else if(directive == "endif" && depth > 0) {
+        depth -= 1;
+    }
+}
+
+}  // namespace
+
+std::optional<PreamblePatch> computePreamblePatch(llvm::StringRef old,
+                                                  llvm::StringRef preamble,
+                                                  llvm::StringRef file) {
+    auto oldLines = lexPreamble(old);
+    auto newLines = lexPreamble(preamble);
+
+    /// [include directive] -> [count in old preamble - count in new preamble]
+    llvm::StringMap<int> includes;
+
+    /// Includes in conditional blocks of old preamble. Such an include could not be
+    /// removed by the patch, whether it is included depends on the condition.
+    llvm::StringSet<> conditionalIncludes;
+
+    llvm::SmallVector<llvm::StringRef> oldOthers;
+    std::uint32_t depth = 0;
+    for(auto& line: oldLines) {
+        if(isInclude(line.directive)) {
+            includes[line.text] += 1;
+            if(depth > 0) {
+                conditionalIncludes.insert(line.text);
+            }
+        } else {
+            oldOthers.emplace_back(line.text);
+            updateDepth(line.directive, depth);
+        }
+    }
+
+    /// Escape the file name for the line marker.
+    std::string filename;
+    for(auto c: file) {
+        if(c == '\\' || c == '"') {
+            filename.push_back('\\');
+        }
+        filename.push_back(c);
+    }
+
+    PreamblePatch patch;
+    std::size_t others = 0;
+    depth = 0;
+    for(auto& line: newLines) {
+        if(isInclude(line.directive)) {
+            if(auto& count = includes[line.text]; count > 0) {
+                count -= 1;
+            } else if(depth > 0) {
+                /// The patch is included unconditionally, it would include the header even
+                /// if the condition is false.
+                return std::nullopt;
+            } else {
+                patch.content +=
+                    std::format("#line {} \"{}\"\n{}\n", line.line, filename, line.source);
+                patch.added += 1;
+            }
+        } else {
+            /// Other directives must not be changed, e.g. a macro may affect all headers.
+            if(others >= oldOthers.size() || oldOthers[others] != line.text) {
+                return std::nullopt;
+            }
+            others += 1;
+            updateDepth(line.directive, depth);
+        }
+    }
+
+    if(others != oldOthers.size()) {
+        return std::nullopt;
+    }
+
+    for(auto& [line, count]: includes) {
+        if(count > 0) {
+            if(conditionalIncludes.contains(line)) {
+                return std::nullopt;
+            }
+            patch.removed += count;
+        }
+    }
+
+    return patch;
+}
+
+std::uint32_t computeBounds(llvm::StringRef content, std::uint32_t line) {
+    if(line == 0) {
+        return content.size();
+    }
+
+    std::size_t offset = 0;
+    for(std::uint32_t i = 1; i < line; ++i) {
+        offset = content.find('\n', offset);
+        if(offset == llvm::StringRef::npos) {
+            return content.size();
+        }
+        offset += 1;
+    }
+
+    /// The directive may be continued to next lines with backslash.
+    while(true) {
+        auto end = content.find('\n', offset);
+        if(end == llvm::StringRef::npos) {
+            return content.size();
+        }
+
+        auto text = content.slice(offset, end).rtrim('\r');
+        offset = end + 1;
+        if(!text.ends_with("\\")) {
+            return offset;
+        }
+    }
 }
 
 }  // namespace clice
@@ -31,6 +31,8 @@ int main(int argc, const char** argv) {
         log::info("Successfully loaded configuration file from {0}.", cl::config.getValue());
     }
 
+    async::init_thread_pool(config::server.threads);
+
     /// Get the resource directory.
     if(!cl::resource_dir.empty()) {
         fs::resource_dir = cl::resource_dir.getValue();
@@ -1,4 +1,5 @@
 #include "Test/Test.h"
+#include "Async/Async.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/Support/CommandLine.h"
 
@@ -13,6 +14,10 @@ llvm::cl::opt<std::string> test_dir("test-dir",
 
 llvm::cl::opt<std::string> resource_dir("resource-dir", llvm::cl::desc("Resource dir path"));
 
+llvm::cl::opt<bool> benchmark("benchmark",
+                              llvm::cl::desc("Run the heavy benchmarks"),
+                              llvm::cl::init(false));
+
 }  // namespace cl
 
 namespace testing {
@@ -21,6 +26,10 @@ llvm::StringRef test_dir() {
     return cl::test_dir;
 }
 
+bool benchmark() {
+    return cl::benchmark;
+}
+
 }  // namespace testing
 
 }  // namespace clice
@@ -40,6 +49,9 @@ int main(int argc, char** argv) {
         }
     }
 
+    /// Use a fixed count of workers so that tests don't depend on the machine.
+    async::init_thread_pool(4);
+
     return RUN_ALL_TESTS();
 }
 
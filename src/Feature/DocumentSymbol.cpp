@@ -19,6 +19,10 @@ struct DocumentSymbolCollector : clang::RecursiveASTVisitor<DocumentSymbolCollec
 
     const SourceConverter& cvtr;
 
+    /// Only symbols in this file are collected, i.e. the main file or the header compiled
+    /// in the context of a source file, see `ASTInfo::getInterestedFile`.
+    const clang::FileID interested;
+
     /// DFS state stack.
     std::vector<proto::DocumentSymbol> stack;
 
@@ -51,8 +55,8 @@ struct DocumentSymbolCollector : clang::RecursiveASTVisitor<DocumentSymbolCollec
         symbol.deprecated = true;
     }
 
-    bool isInMainFile(clang::SourceLocation loc) {
-        return loc.isValid() && src.isInMainFile(loc);
+    bool isInInterestedFile(clang::SourceLocation loc) {
+        return loc.isValid() && src.getFileID(src.getExpansionLoc(loc)) == interested;
     }
 
     /// For a given location, it could be one of SpellingLoc or ExpansionLoc (from macro expansion).
@@ -74,7 +78,7 @@ struct DocumentSymbolCollector : clang::RecursiveASTVisitor<DocumentSymbolCollec
         if(!llvm::isa<clang::NamedDecl>(decl))
             return true;
 
-        if(!isInMainFile(decl->getLocation()) || decl->isImplicit())
+        if(!isInInterestedFile(decl->getLocation()) || decl->isImplicit())
             return true;
 
         if(auto* ctsd = llvm::dyn_cast<clang::ClassTemplateSpecializationDecl>(decl)) {
@@ -287,6 +291,7 @@ proto::DocumentSymbolResult documentSymbol(ASTInfo& info, const SourceConverter&
     DocumentSymbolCollector collector{
         .src = info.srcMgr(),
         .cvtr = converter,
+        .interested = info.getInterestedFile(),
     };
 
     collector.TraverseTranslationUnitDecl(info.tu());
@@ -27,19 +27,22 @@ struct FoldingRangeCollector : public clang::RecursiveASTVisitor<FoldingRangeCol
     /// The result of folding ranges.
     Storage result;
 
-    /// True if only main file is involved.
+    /// True if only the interested file is involved.
     const bool onlyMain;
 
-    const clang::FileID mainFileID;
+    /// The main file or the header compiled in the context of a source file, see
+    /// `ASTInfo::getInterestedFile`.
+    const clang::FileID interested;
 
-    /// Do not produce folding ranges if either range ends is not within the main file.
+    /// Do not produce folding ranges if either range ends is not within the interested file.
     bool needFilter(clang::SourceLocation loc) {
-        return loc.isInvalid() || (onlyMain && !src.isInMainFile(loc));
+        return loc.isInvalid() ||
+               (onlyMain && src.getFileID(src.getExpansionLoc(loc)) != interested);
     }
 
     /// Get last column of previous line of a location.
     clang::SourceLocation prevLineLastColOf(clang::SourceLocation loc) {
-        return src.translateLineCol(src.getMainFileID(),
+        return src.translateLineCol(interested,
                                     src.getPresumedLineNumber(loc) - 1,
                                     std::numeric_limits<unsigned>::max());
     }
@@ -54,7 +57,7 @@ struct FoldingRangeCollector : public clang::RecursiveASTVisitor<FoldingRangeCol
         if(startLine >= endLine)
             return;
 
-        auto& state = onlyMain ? result[mainFileID] : result[src.getFileID(sr.getBegin())];
+        auto& state = onlyMain ? result[interested] : result[src.getFileID(sr.getBegin())];
         state.push_back({
             .range = cvtr.toLocalRange(sr, src),
             .kind = kind,
@@ -303,7 +306,7 @@ struct FoldingRangeCollector : public clang::RecursiveASTVisitor<FoldingRangeCol
 
     void collectDrectives(const ASTDirectives& direcs) {
         for(auto& [fileid, dirc]: direcs) {
-            if(fileid != src.getMainFileID())
+            if(fileid != interested)
                 continue;
 
             collectConditionMacro(dirc.conditions);
@@ -358,7 +361,7 @@ struct FoldingRangeCollector : public clang::RecursiveASTVisitor<FoldingRangeCol
     /// Collect all condition macro's block as folding range.
     void collectPragmaRegion(const std::vector<Pragma>& pragmas) {
         auto lastLocOfLine = [this](clang::SourceLocation loc) {
-            return src.translateLineCol(src.getMainFileID(),
+            return src.translateLineCol(interested,
                                         src.getPresumedLineNumber(loc),
                                         std::numeric_limits<unsigned>::max());
         };
@@ -379,7 +382,7 @@ struct FoldingRangeCollector : public clang::RecursiveASTVisitor<FoldingRangeCol
 
         // If there is some region without end pragma, use the end of file as the end region.
         if(!stack.empty()) {
-            auto eof = src.getLocForEndOfFile(src.getMainFileID());
+            auto eof = src.getLocForEndOfFile(interested);
             while(!stack.empty()) {
                 auto last = stack.pop_back_val();
                 collect({lastLocOfLine(last->loc), eof});
@@ -405,6 +408,7 @@ index::Shared<Result> foldingRange(ASTInfo& info, const SourceConverter& convert
         .tkbuf = info.tokBuf(),
         .result = FoldingRangeCollector::Storage{},
         .onlyMain = false,
+        .interested = info.srcMgr().getMainFileID(),
     };
 
     collector.collectDrectives(info.directives());
@@ -420,14 +424,14 @@ Result foldingRange(FoldingRangeParams& _, ASTInfo& info, const SourceConverter&
         .tkbuf = info.tokBuf(),
         .result = FoldingRangeCollector::Storage{},
         .onlyMain = true,
-        .mainFileID = info.srcMgr().getMainFileID(),
+        .interested = info.getInterestedFile(),
     };
     collector.result.reserve(1);
 
     collector.collectDrectives(info.directives());
     collector.TraverseTranslationUnitDecl(info.tu());
 
-    return std::move(collector.result[collector.mainFileID]);
+    return std::move(collector.result[collector.interested]);
 }
 
 proto::FoldingRangeResult toLspResult(llvm::ArrayRef<FoldingRange> ranges, llvm::StringRef content,
@@ -435,8 +439,9 @@ proto::FoldingRangeResult toLspResult(llvm::ArrayRef<FoldingRange> ranges, llvm:
     proto::FoldingRangeResult results;
     results.reserve(ranges.size());
 
+    LineTable lines(content);
     for(auto& range: ranges) {
-        auto lspRange = SC.toRange(range.range, content);
+        auto lspRange = SC.toRange(range.range, lines);
         results.push_back({
             .startLine = lspRange.start.line,
             .endLine = lspRange.end.line,
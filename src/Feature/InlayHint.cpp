@@ -52,10 +52,18 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
     /// The printing policy of AST.
     const clang::PrintingPolicy policy;
 
-    /// Whole source code text in main file.
+    /// Whole source code text in the interested file.
     const llvm::StringRef code;
 
-    /// Do not produce inlay hints if either range ends is not within the main file.
+    /// The file whose hints are collected in mode A, i.e. the main file or the header
+    /// compiled in the context of a source file, see `ASTInfo::getInterestedFile`.
+    const clang::FileID interested;
+
+    bool isInInterestedFile(clang::SourceLocation loc) {
+        return loc.isValid() && src.getFileID(src.getExpansionLoc(loc)) == interested;
+    }
+
+    /// Do not produce inlay hints if either range ends is not within the interested file.
     bool needFilter(clang::SourceRange range) {
         // skip invalid range or not in main file
         if(range.isInvalid())
@@ -64,7 +72,7 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
         if(!onlyMain)
             return false;
 
-        if(!src.isInMainFile(range.getBegin()) || !src.isInMainFile(range.getEnd()))
+        if(!isInInterestedFile(range.getBegin()) || !isInInterestedFile(range.getEnd()))
             return true;
 
         // not involved in restrict range
@@ -115,7 +123,7 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
             .lable = lable,
         };
 
-        clang::FileID fid = onlyMain ? src.getMainFileID() : src.getFileID(identRange.getBegin());
+        clang::FileID fid = onlyMain ? interested : src.getFileID(identRange.getBegin());
         result[fid].push_back(std::move(hint));
     }
 
@@ -135,7 +143,7 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
     /// Check if there is any comment like /*paramName*/ before a argument.
     bool hasHandWriteComment(clang::SourceRange argument) {
         auto [fid, offset] = src.getDecomposedLoc(argument.getBegin());
-        if(fid != src.getMainFileID())
+        if(fid != interested)
             return false;
 
         // Get source text until the argument and drop end whitespace.
@@ -195,7 +203,7 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
                 .lable = std::move(lable),
             };
 
-            clang::FileID fid = onlyMain ? src.getMainFileID() : src.getFileID(argBeginLoc);
+            clang::FileID fid = onlyMain ? interested : src.getFileID(argBeginLoc);
             result[fid].push_back(std::move(hint));
         }
     }
@@ -436,7 +444,7 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
             .lable = std::move(lable),
         };
 
-        clang::FileID fid = onlyMain ? src.getMainFileID() : src.getFileID(hintLoc);
+        clang::FileID fid = onlyMain ? interested : src.getFileID(hintLoc);
         result[fid].push_back(std::move(hint));
     }
 
@@ -527,7 +535,7 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
             .lable = std::move(lable),
         };
 
-        clang::FileID fid = onlyMain ? src.getMainFileID() : src.getFileID(location);
+        clang::FileID fid = onlyMain ? interested : src.getFileID(location);
         result[fid].push_back(std::move(hint));
     }
 
@@ -582,7 +590,7 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
            remain.starts_with("/*") || remain.starts_with("//"))
             return;
 
-        auto& state = result[onlyMain ? src.getMainFileID() : src.getFileID(location)];
+        auto& state = result[onlyMain ? interested : src.getFileID(location)];
         if(decision != DecideDuplicated::AcceptBoth && !state.empty()) {
             // Already has a duplicated hint in that line, use the newer hint instead.
             auto lastHintLine = cvtr.toPosition(code, state.back().offset).line;
@@ -648,7 +656,7 @@ struct InlayHintCollector : clang::RecursiveASTVisitor<InlayHintCollector> {
             .lable = std::move(lable),
         };
 
-        auto fid = onlyMain ? src.getMainFileID() : src.getFileID(tail);
+        auto fid = onlyMain ? interested : src.getFileID(tail);
         result[fid].push_back(std::move(hint));
     }
 
@@ -747,26 +755,26 @@ json::Value inlayHintCapability(json::Value InlayHintClientCapabilities) {
 /// Convert `Lable` to `proto:":InlayHintLablePart`. the hint text will be shrinked to the
 /// `maxHintLength` if it's not zero.
 proto::InlayHintLablePart toLspType(const Lable& lable, size_t maxHintLength,
-                                    llvm::StringRef docuri, llvm::StringRef content,
+                                    llvm::StringRef docuri, const LineTable& lines,
                                     const SourceConverter& SC) {
     proto::InlayHintLablePart lspLable;
     lspLable.value = InlayHintCollector::shrinkHintText(lable.value, maxHintLength);
     lspLable.tooltip = blank();
     lspLable.Location = {
         .uri = docuri.str(),
-        .range = SC.toRange(lable.location, content),
+        .range = SC.toRange(lable.location, lines),
     };
     return lspLable;
 }
 
 /// Convert `InlayHint` to `proto::proto::InlayHint`.
 proto::InlayHint toLspType(const InlayHint& hint, size_t maxHintLength, llvm::StringRef docuri,
-                           llvm::StringRef content, const SourceConverter& SC) {
+                           const LineTable& lines, const SourceConverter& SC) {
     proto::InlayHint lspHint;
     /// Use hint.lable as the only element of `proto::InlayHint::lable`.
-    lspHint.lable = {toLspType(hint.lable, maxHintLength, docuri, content, SC)};
+    lspHint.lable = {toLspType(hint.lable, maxHintLength, docuri, lines, SC)};
     lspHint.kind = toLspType(hint.kind);
-    lspHint.position = SC.toPosition(content, hint.offset);
+    lspHint.position = SC.toPosition(lines, hint.offset);
     return lspHint;
 }
 
@@ -774,7 +782,8 @@ Result inlayHints(proto::InlayHintParams param, ASTInfo& info, const SourceConve
                   const config::InlayHintOption& config) {
     const clang::SourceManager& src = info.srcMgr();
 
-    llvm::StringRef codeText = src.getBufferData(src.getMainFileID());
+    clang::FileID interested = info.getInterestedFile();
+    llvm::StringRef codeText = src.getBufferData(interested);
 
     // Take 0-0 based Lsp Location from `param.range` and convert it to offset pair.
     LocalSourceRange requestRange{
@@ -782,11 +791,11 @@ Result inlayHints(proto::InlayHintParams param, ASTInfo& info, const SourceConve
         .end = static_cast<uint32_t>(converter.toOffset(codeText, param.range.end)),
     };
 
-    // If request range is invalid, use the whole main file as the restrict range.
+    // If request range is invalid, use the whole interested file as the restrict range.
     if(requestRange.begin >= requestRange.end) {
-        clang::FileID main = src.getMainFileID();
-        requestRange.begin = src.getDecomposedSpellingLoc(src.getLocForStartOfFile(main)).second;
-        requestRange.end = src.getDecomposedSpellingLoc(src.getLocForEndOfFile(main)).second;
+        requestRange.begin =
+            src.getDecomposedSpellingLoc(src.getLocForStartOfFile(interested)).second;
+        requestRange.end = src.getDecomposedSpellingLoc(src.getLocForEndOfFile(interested)).second;
     }
 
     /// TODO:
@@ -800,11 +809,12 @@ Result inlayHints(proto::InlayHintParams param, ASTInfo& info, const SourceConve
         .result = InlayHintCollector::Storage{},
         .policy = info.context().getPrintingPolicy(),
         .code = codeText,
+        .interested = interested,
     };
 
     collector.TraverseTranslationUnitDecl(info.tu());
 
-    return std::move(collector.result[src.getMainFileID()]);
+    return std::move(collector.result[interested]);
 }
 
 index::Shared<Result> inlayHints(proto::DocumentUri uri, ASTInfo& info,
@@ -828,6 +838,7 @@ index::Shared<Result> inlayHints(proto::DocumentUri uri, ASTInfo& info,
         .result = InlayHintCollector::Storage{},
         .policy = info.context().getPrintingPolicy(),
         .code = src.getBufferData(src.getMainFileID()),
+        .interested = src.getMainFileID(),
     };
 
     collector.TraverseTranslationUnitDecl(info.tu());
@@ -845,11 +856,12 @@ proto::InlayHintsResult toLspType(llvm::ArrayRef<InlayHint> result, llvm::String
     /// `config::maxArrayElements` will be ignored because we can't recover the parent-child
     /// relationship of AST node from `InlayHint`.
 
+    LineTable lines(content);
     for(auto& hint: result) {
         if(config.has_value() && !isAvailableWithOption(hint.kind, *config))
             continue;
 
-        lspRes.push_back(toLspType(hint, config->maxLength, docuri, content, SC));
+        lspRes.push_back(toLspType(hint, config->maxLength, docuri, lines, SC));
     }
 
     lspRes.shrink_to_fit();
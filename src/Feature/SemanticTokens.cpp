@@ -234,7 +234,9 @@ public:
 
     auto buildForIndex() {
         for(auto fid: info.files()) {
-            highlightFromLexer(fid);
+            if(!isSkipped(fid)) {
+                highlightFromLexer(fid);
+            }
         }
 
         run();
@@ -254,26 +256,46 @@ private:
 
 }  // namespace
 
-index::Shared<std::vector<SemanticToken>> semanticTokens(ASTInfo& info) {
-    return HighlightBuilder(info, true).buildForIndex();
+index::Shared<std::vector<SemanticToken>>
+    semanticTokens(ASTInfo& info, const llvm::DenseSet<clang::FileID>& skipped) {
+    HighlightBuilder builder(info, true);
+    builder.skip(skipped);
+    return builder.buildForIndex();
 }
 
 proto::SemanticTokens toSemanticTokens(llvm::ArrayRef<SemanticToken> tokens,
                                        SourceConverter& SC,
                                        llvm::StringRef content,
                                        const config::SemanticTokensOption& option) {
+    return toSemanticTokens(tokens, SC, LineTable(content), option);
+}
+
+proto::SemanticTokens toSemanticTokens(llvm::ArrayRef<SemanticToken> tokens,
+                                       SourceConverter& SC,
+                                       const LineTable& lines,
+                                       const config::SemanticTokensOption& option) {
 
     proto::SemanticTokens result;
+    result.data.reserve(tokens.size() * 5);
+
+    /// Tokens are sorted by their begin offset, convert them in one pass.
+    llvm::SmallVector<std::uint32_t> offsets;
+    offsets.reserve(tokens.size());
+    for(auto& token: tokens) {
+        offsets.push_back(token.range.begin);
+    }
+
+    std::vector<proto::Position> positions;
+    SC.toPositions(lines, offsets, positions);
 
     std::size_t lastLine = 0;
     std::size_t lastColumn = 0;
 
-    for(auto& token: tokens) {
+    for(auto [token, position]: views::zip(tokens, positions)) {
         auto [begin, end] = token.range;
-        auto [line, column] = SC.toPosition(content, begin);
+        auto [line, column] = position;
 
         if(line != lastLine) {
-            /// FIXME: Cut off content to improve performance.
             lastColumn = 0;
         }
 
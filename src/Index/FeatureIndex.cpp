@@ -12,10 +12,11 @@ struct FeatureIndex {
 
 }  // namespace memory
 
-Shared<FeatureIndex> indexFeature(ASTInfo& info) {
+Shared<FeatureIndex> indexFeature(ASTInfo& info,
+                                  const llvm::DenseSet<clang::FileID>& skipped) {
     Shared<memory::FeatureIndex> indices;
 
-    for(auto&& [fid, result]: feature::semanticTokens(info)) {
+    for(auto&& [fid, result]: feature::semanticTokens(info, skipped)) {
         indices[fid].tokens = std::move(result);
     }
 
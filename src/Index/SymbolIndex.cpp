@@ -335,8 +335,9 @@ private:
 
 }  // namespace
 
-Shared<SymbolIndex> index(ASTInfo& info) {
+Shared<SymbolIndex> index(ASTInfo& info, const llvm::DenseSet<clang::FileID>& skipped) {
     SymbolIndexBuilder collector(info);
+    collector.skip(skipped);
     return collector.build();
 }
 
@@ -0,0 +1,100 @@
+#include "Server/BlobStore.h"
+#include "Support/FileSystem.h"
+
+namespace clice {
+
+std::uint64_t BlobStore::key(llvm::XXH128_hash_t symbolHash, llvm::XXH128_hash_t featureHash) {
+    std::uint64_t data[] = {
+        symbolHash.low64,
+        symbolHash.high64,
+        featureHash.low64,
+        featureHash.high64,
+    };
+    return llvm::xxh3_64bits(llvm::ArrayRef(reinterpret_cast<const std::uint8_t*>(data),
+                                            sizeof(data)));
+}
+
+std::string BlobStore::path(std::uint64_t key) const {
+    return path::join(dir, std::format("{:016x}", key));
+}
+
+void BlobStore::acquire(std::uint64_t key, bool written) {
+    auto& blob = blobs[key];
+    blob.refs += 1;
+    blob.written |= written;
+}
+
+void BlobStore::release(std::uint64_t key) {
+    auto iter = blobs.find(key);
+    assert(iter != blobs.end() && iter->second.refs != 0 && "Index is not referenced");
+    iter->second.refs -= 1;
+}
+
+async::Task<bool> BlobStore::ensure(std::uint64_t key,
+                                    llvm::unique_function<async::Task<bool>(std::string)> write) {
+    while(true) {
+        /// The referenced index is never removed from the map, but the iterators are
+        /// invalidated after any suspension.
+        auto iter = blobs.find(key);
+        assert(iter != blobs.end() && iter->second.refs != 0 && "Index is not referenced");
+
+        if(auto busy = iter->second.busy) {
+            co_await busy->wait();
+            continue;
+        }
+
+        if(iter->second.written) {
+            co_return true;
+        }
+
+        auto busy = std::make_shared<async::Event>();
+        iter->second.busy = busy;
+
+        bool success = co_await write(path(key));
+
+        auto& blob = blobs[key];
+        blob.written = success;
+        blob.busy.reset();
+        busy->set();
+        co_return success;
+    }
+}
+
+async::Task<std::size_t>
+    BlobStore::collect(llvm::unique_function<async::Task<>(std::vector<std::string>)> remove) {
+    std::vector<std::uint64_t> keys;
+    std::vector<std::string> paths;
+    for(auto& [key, blob]: blobs) {
+        if(blob.refs == 0 && !blob.busy) {
+            keys.emplace_back(key);
+            paths.emplace_back(path(key));
+        }
+    }
+
+    if(keys.empty()) {
+        co_return 0;
+    }
+
+    /// Acquirers of the index being removed wait for it, then write it again.
+    auto busy = std::make_shared<async::Event>();
+    for(auto key: keys) {
+        blobs[key].busy = busy;
+    }
+
+    co_await remove(std::move(paths));
+
+    for(auto key: keys) {
+        auto iter = blobs.find(key);
+        if(iter->second.refs == 0) {
+            blobs.erase(iter);
+        } else {
+            iter->second.written = false;
+            iter->second.busy.reset();
+        }
+    }
+    busy->set();
+
+    co_return keys.size();
+}
+
+}  // namespace clice
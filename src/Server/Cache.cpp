@@ -1,26 +1,677 @@
+#include "Compiler/Command.h"
+#include "Compiler/Compilation.h"
 #include "Server/Cache.h"
+#include "Support/Logger.h"
+#include "Support/FileSystem.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/xxhash.h"
 
 namespace clice {
 
+namespace {
+
+/// The version of `cache.json`, caches of other versions are ignored.
+constexpr std::uint32_t version = 2;
+
+/// The max count of changed `#include` directives could be patched, a new PCH is built
+/// if exceeded.
+constexpr std::uint32_t maxPatchedIncludes = 8;
+
+struct PCHRecord {
+    std::uint64_t key;
+    std::uint64_t hash;
+    std::string path;
+    std::string preamble;
+    std::string command;
+    std::vector<std::string> deps;
+};
+
+struct PCMRecord {
+    std::string name;
+    std::string path;
+    std::string srcPath;
+    std::uint64_t srcHash;
+    std::uint64_t hash;
+    std::uint64_t depsHash;
+    std::vector<std::string> imports;
+    std::vector<std::string> mods;
+    std::vector<std::string> deps;
+};
+
+struct CacheRecord {
+    std::uint32_t version;
+    std::vector<PCHRecord> pchs;
+    std::vector<PCMRecord> pcms;
+};
+
+}  // namespace
+
 void CacheController::loadFromDisk() {
+    auto path = path::join(options.dir, "cache.json");
+    auto file = llvm::MemoryBuffer::getFile(path);
+    if(!file) {
+        log::warn("Failed to open cache file: {} Beacuse {}", path, file.getError());
+        return;
+    }
+
+    auto json = json::parse(file.get()->getBuffer());
+    if(!json) {
+        log::warn("Failed to parse cache file: {} Beacuse {}",
+                  path,
+                  llvm::toString(json.takeError()));
+        return;
+    }
 
+    auto object = json->getAsObject();
+    if(!object || object->getInteger("version") != std::int64_t(version)) {
+        log::warn("Ignore outdated cache file: {}", path);
+        return;
+    }
+
+    auto record = json::deserialize<CacheRecord>(*json);
+    for(auto& pch: record.pchs) {
+        /// The PCH file may be removed by user.
+        if(!llvm::sys::fs::exists(pch.path)) {
+            continue;
+        }
+
+        auto& info = pchs[pch.key];
+        info.path = std::move(pch.path);
+        info.preamble = std::move(pch.preamble);
+        info.command = std::move(pch.command);
+        info.deps = std::move(pch.deps);
+        info.hash = pch.hash;
+        info.lastUsed = ++clock;
+    }
+
+    for(auto& pcm: record.pcms) {
+        if(!llvm::sys::fs::exists(pcm.path)) {
+            continue;
+        }
+
+        auto& info = pcms[pcm.name];
+        info.isInterfaceUnit = true;
+        info.name = std::move(pcm.name);
+        info.path = std::move(pcm.path);
+        info.srcPath = std::move(pcm.srcPath);
+        info.srcHash = pcm.srcHash;
+        info.hash = pcm.hash;
+        info.depsHash = pcm.depsHash;
+        info.imports = std::move(pcm.imports);
+        info.mods = std::move(pcm.mods);
+        info.deps = std::move(pcm.deps);
+    }
+
+    collect();
+
+    log::info("Successfully loaded {} PCHs and {} PCMs from disk", pchs.size(), pcms.size());
 }
 
 void CacheController::saveToDisk() {
+    CacheRecord record = {version, {}, {}};
+    for(auto& [key, pch]: pchs) {
+        /// Skip the PCH being built, it is incomplete.
+        if(pch.building) {
+            continue;
+        }
+
+        record.pchs.emplace_back(PCHRecord{
+            .key = key,
+            .hash = pch.hash,
+            .path = pch.path,
+            .preamble = pch.preamble,
+            .command = pch.command,
+            .deps = pch.deps,
+        });
+    }
+
+    for(auto& [name, pcm]: pcms) {
+        if(pcm.building || pcm.path.empty()) {
+            continue;
+        }
+
+        record.pcms.emplace_back(PCMRecord{
+            .name = pcm.name,
+            .path = pcm.path,
+            .srcPath = pcm.srcPath,
+            .srcHash = pcm.srcHash,
+            .hash = pcm.hash,
+            .depsHash = pcm.depsHash,
+            .imports = pcm.imports,
+            .mods = pcm.mods,
+            .deps = pcm.deps,
+        });
+    }
+
+    auto path = path::join(options.dir, "cache.json");
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path, ec);
+    if(ec) {
+        log::warn("Failed to open cache file: {} Beacuse {}", path, ec.message());
+        return;
+    }
 
+    os << json::serialize(record);
+
+    if(os.has_error()) {
+        log::warn("Failed to write cache file: {}", os.error().message());
+    } else {
+        log::info("Successfully saved cache to disk");
+    }
 }
 
-async::Task<> CacheController::prepare(CompilationParams& params) {
-    /// 首先要区分这个文件是不是 module file.
-    bool isModule = false;
+async::Task<> CacheController::prepare(CompilationParams& params, llvm::StringRef file) {
+    co_await prepareModules(params);
+
+    /// The file referencing the PCH.
+    std::string owner = file.empty() ? params.srcPath.str().str() : file.str();
+
+    /// For a header compiled in the context of the source file, the directive including
+    /// the header (the last line before the bound) must not be precompiled, otherwise the
+    /// header itself would be in the PCH.
+    auto content = params.content;
+    if(params.bound) {
+        auto directive = content.substr(0, *params.bound).rtrim("\r\n");
+        content = content.substr(0, directive.rfind('\n') + 1);
+    }
 
-    if(isModule){
-        /// Update dependent mods ....
+    auto bound = computePreambleBound(content);
+    if(bound == 0) {
+        release(owner);
+        co_return;
     }
 
-    /// 准备构建 PCH ...
+    /// Hash the mangled arguments rather than the raw command, so that commands only
+    /// differing in quoting, whitespace, output file or source file share the PCH.
+    llvm::SmallString<1024> buffer;
+    llvm::SmallVector<const char*, 16> args;
+    if(auto result = mangleCommand(params.command, args, buffer); !result) {
+        log::warn("Failed to mangle command of {}, because {}", params.srcPath, result.error());
+        co_return;
+    }
+
+    auto preamble = params.content.substr(0, bound);
+    llvm::SmallString<4096> input = preamble;
+    for(llvm::StringRef arg: args) {
+        if(isInputFile(arg, params.srcPath)) {
+            continue;
+        }
+        input.push_back('\0');
+        input += arg;
+    }
+    auto key = llvm::xxh3_64bits(input);
+
+    if(auto path = co_await reusePCH(owner, key, preamble)) {
+        stats.hits += 1;
+        params.pch = {std::move(*path), bound};
+    } else if(co_await patchPCH(params, owner, bound)) {
+        stats.patches += 1;
+    } else {
+        stats.misses += 1;
+        if(auto path = co_await buildPCH(params, owner, key, preamble)) {
+            params.pch = {std::move(*path), bound};
+        }
+    }
+
+    collect();
+}
+
+async::Task<std::optional<std::string>> CacheController::reusePCH(llvm::StringRef file,
+                                                                  std::uint64_t key,
+                                                                  llvm::StringRef preamble) {
+    while(true) {
+        auto iter = pchs.find(key);
+        if(iter == pchs.end()) {
+            co_return std::nullopt;
+        }
+
+        /// Wait for the PCH being built by others, then check it again.
+        if(auto event = iter->second.building) {
+            co_await event->wait();
+            continue;
+        }
+
+        if(iter->second.preamble != preamble) {
+            log::warn("PCH hash collision of {}", file);
+            co_return std::nullopt;
+        }
+
+        auto hash = co_await hashDeps(iter->second.deps);
+
+        /// The PCH may be removed or start to rebuild while we are checking.
+        iter = pchs.find(key);
+        if(iter == pchs.end() || iter->second.building) {
+            continue;
+        }
+
+        if(iter->second.hash != hash) {
+            co_return std::nullopt;
+        }
+
+        iter->second.lastUsed = ++clock;
+        acquire(file, key);
+        co_return iter->second.path;
+    }
+}
+
+async::Task<bool> CacheController::patchPCH(CompilationParams& params,
+                                            llvm::StringRef file,
+                                            std::uint32_t bound) {
+    auto current = pchMap.find(file);
+    if(current == pchMap.end()) {
+        co_return false;
+    }
+
+    auto key = current->second;
+    auto iter = pchs.find(key);
+    if(iter == pchs.end() || iter->second.building) {
+        co_return false;
+    }
+
+    auto patch = computePreamblePatch(iter->second.preamble,
+                                      params.content.substr(0, bound),
+                                      params.srcPath);
+    if(!patch) {
+        co_return false;
+    }
+
+    /// Do not accumulate too many changes, parsing the patch is not free.
+    if(patch->added + patch->removed > maxPatchedIncludes) {
+        co_return false;
+    }
+
+    auto hash = co_await hashDeps(iter->second.deps);
+
+    /// The file may be closed or the PCH may be changed while we are checking.
+    current = pchMap.find(file);
+    iter = pchs.find(key);
+    if(current == pchMap.end() || current->second != key || iter == pchs.end() ||
+       iter->second.building || iter->second.hash != hash) {
+        co_return false;
+    }
+
+    log::info("Patch PCH of {}, added {} includes, removed {} includes",
+              params.srcPath,
+              patch->added,
+              patch->removed);
+
+    iter->second.lastUsed = ++clock;
+    params.pch = {iter->second.path, bound};
+    params.patch = std::move(patch->content);
+    co_return true;
+}
+
+async::Task<std::optional<std::string>> CacheController::buildPCH(CompilationParams& params,
+                                                                  llvm::StringRef file,
+                                                                  std::uint64_t key,
+                                                                  llvm::StringRef preamble) {
+    /// Others may start to build the same PCH while we are checking.
+    while(true) {
+        auto iter = pchs.find(key);
+        if(iter == pchs.end() || !iter->second.building) {
+            break;
+        }
+
+        auto event = iter->second.building;
+        co_await event->wait();
+        if(auto path = co_await reusePCH(file, key, preamble)) {
+            co_return path;
+        }
+    }
+
+    auto event = std::make_shared<async::Event>();
+    auto outPath = path::join(options.dir, std::format("{:016x}.pch", key));
+    pchs[key].building = event;
+
+    if(auto error = llvm::sys::fs::create_directories(options.dir)) {
+        log::warn("Failed to create cache directory: {}, because {}", options.dir, error.message());
+    }
+
+    CompilationParams pchParams;
+    pchParams.srcPath = params.srcPath;
+    pchParams.outPath = outPath;
+    pchParams.content = params.content;
+    pchParams.command = params.command;
+    pchParams.bound = preamble.size();
+    pchParams.vfs = params.vfs;
+    pchParams.remappedFiles = params.remappedFiles;
+    pchParams.cancelled = params.cancelled;
+
+    /// The PCH is built for an opened file, it jumps ahead of queued indexing jobs.
+    PCHInfo info;
+    auto result = co_await async::submit(async::Priority::Interactive,
+                                         [&]() -> std::expected<void, std::string> {
+        if(auto ast = compile(pchParams, info); !ast) {
+            return std::unexpected(ast.error());
+        }
+        return {};
+    });
+
+    std::uint64_t hash = 0;
+    if(result) {
+        hash = co_await hashDeps(info.deps);
+    }
+
+    /// The PCH being built is never removed, so it is safe to access it here.
+    auto& pch = pchs[key];
+    pch.building.reset();
+    event->set();
+
+    if(!result) {
+        log::warn("Failed to build PCH for {}, because {}", params.srcPath, result.error());
+        if(pch.reference == 0) {
+            pchs.erase(key);
+        }
+        co_return std::nullopt;
+    }
+
+    static_cast<PCHInfo&>(pch) = std::move(info);
+    pch.hash = hash;
+    pch.lastUsed = ++clock;
+    acquire(file, key);
+
+    log::info("Build PCH for {} at {}, hits {}, patches {}, misses {}",
+              params.srcPath,
+              pch.path,
+              stats.hits,
+              stats.patches,
+              stats.misses);
+
+    co_return pch.path;
+}
+
+async::Task<> CacheController::prepareModules(CompilationParams& params) {
+    /// Most files do not use modules, skip the preprocessing.
+    if(!params.content.contains("import") && !params.content.contains("module")) {
+        co_return;
+    }
+
+    auto info = co_await async::submit([&] { return scanModule(params); });
+    if(!info) {
+        log::warn("Failed to scan modules of {}, because {}", params.srcPath, info.error());
+        co_return;
+    }
 
-    co_return;
+    /// A module implementation unit imports its primary module interface implicitly.
+    auto imports = info->mods;
+    if(!info->isInterfaceUnit && !info->name.empty()) {
+        imports.emplace_back(info->name);
+    }
+
+    std::vector<async::Task<>> tasks;
+    for(auto& name: imports) {
+        tasks.emplace_back(preparePCM(name, {}, params.vfs));
+    }
+    co_await async::when_all(std::move(tasks));
+
+    for(auto& name: imports) {
+        collectPCMs(name, params.pcms);
+    }
+}
+
+async::Task<> CacheController::preparePCM(std::string name,
+                                          std::vector<std::string> chain,
+                                          llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs) {
+    /// The module is being checked or built, e.g. imported by multiple modules. Two
+    /// builds may enter a cycle from different modules, so the whole wait-for graph is
+    /// checked rather than the current chain.
+    if(auto iter = pcms.find(name); iter != pcms.end() && iter->second.building) {
+        if(waitsFor(name, chain)) {
+            log::warn("Cyclic module dependency: {} -> {}", llvm::join(chain, " -> "), name);
+            co_return;
+        }
+
+        auto event = iter->second.building;
+        co_await event->wait();
+        co_return;
+    }
+
+    auto event = std::make_shared<async::Event>();
+    pcms[name].building = event;
+
+    bool success = co_await updatePCM(name, std::move(chain), std::move(vfs));
+
+    auto& pcm = pcms[name];
+    if(!success) {
+        pcm.path.clear();
+        pcm.hash = 0;
+    }
+    pcm.building.reset();
+    event->set();
+}
+
+bool CacheController::waitsFor(llvm::StringRef name, llvm::ArrayRef<std::string> chain) {
+    llvm::StringSet<> visited;
+    llvm::SmallVector<llvm::StringRef> stack = {name};
+    while(!stack.empty()) {
+        auto current = stack.pop_back_val();
+        if(ranges::contains(chain, current)) {
+            return true;
+        }
+
+        if(!visited.insert(current).second) {
+            continue;
+        }
+
+        auto iter = pcms.find(current);
+        if(iter == pcms.end() || !iter->second.waiting) {
+            continue;
+        }
+
+        for(auto& import: iter->second.imports) {
+            stack.emplace_back(import);
+        }
+    }
+    return false;
+}
+
+async::Task<bool> CacheController::updatePCM(llvm::StringRef name,
+                                             std::vector<std::string> chain,
+                                             llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs) {
+    auto srcPath = database.getModuleFile(name).str();
+    if(srcPath.empty()) {
+        log::warn("Cannot find the interface unit of module {}", name);
+        co_return false;
+    }
+
+    auto command = database.getCommand(srcPath);
+    auto file = co_await async::submit([&] {
+        return vfs->getBufferForFile(srcPath);
+    });
+    if(!file) {
+        log::warn("Failed to read {}, because {}", srcPath, file.getError().message());
+        co_return false;
+    }
+
+    /// The module being prepared is never removed, so it is safe to refer to it.
+    auto& pcm = pcms[name];
+    std::shared_ptr<llvm::MemoryBuffer> content = std::move(file.get());
+
+    llvm::SmallString<1024> input = llvm::StringRef(command);
+    input.push_back('\0');
+    input += content->getBuffer();
+    auto srcHash = llvm::xxh3_64bits(input);
+
+    /// Scan imported modules only if the source is changed.
+    if(srcHash != pcm.srcHash) {
+        auto info = co_await async::submit([&] {
+            CompilationParams params;
+            params.srcPath = srcPath;
+            params.content = content->getBuffer();
+            params.command = command;
+            params.vfs = vfs;
+            return scanModule(params);
+        });
+
+        if(!info) {
+            log::warn("Failed to scan module {}, because {}", name, info.error());
+            co_return false;
+        }
+
+        pcm.imports = std::move(info->mods);
+    }
+
+    /// Prepare all imported modules in parallel.
+    chain.emplace_back(name);
+    std::vector<async::Task<>> tasks;
+    for(auto& import: pcm.imports) {
+        tasks.emplace_back(preparePCM(import, chain, vfs));
+    }
+    pcm.waiting = true;
+    co_await async::when_all(std::move(tasks));
+    pcm.waiting = false;
+
+    /// An import still being built is in a cycle with this module.
+    llvm::SmallVector<std::uint64_t, 16> hashes = {srcHash};
+    for(auto& import: pcm.imports) {
+        auto iter = pcms.find(import);
+        if(iter == pcms.end() || iter->second.path.empty() || iter->second.building) {
+            log::warn("Failed to build module {}, because its dependency {} is failed",
+                      name,
+                      import);
+            co_return false;
+        }
+        hashes.emplace_back(iter->second.hash);
+    }
+
+    auto bytes = reinterpret_cast<const std::uint8_t*>(hashes.data());
+    auto hash = llvm::xxh3_64bits(llvm::ArrayRef(bytes, hashes.size() * sizeof(std::uint64_t)));
+
+    /// Reuse the PCM if nothing is changed.
+    if(hash == pcm.hash && !pcm.path.empty() && llvm::sys::fs::exists(pcm.path) &&
+       co_await hashDeps(pcm.deps) == pcm.depsHash) {
+        co_return true;
+    }
+
+    if(auto error = llvm::sys::fs::create_directories(options.dir)) {
+        log::warn("Failed to create cache directory: {}, because {}", options.dir, error.message());
+    }
+
+    CompilationParams params;
+    params.srcPath = srcPath;
+    params.outPath = path::join(options.dir, std::format("{:016x}.pcm", hash));
+    params.content = content->getBuffer();
+    params.command = command;
+    params.vfs = vfs;
+    for(auto& import: pcm.imports) {
+        collectPCMs(import, params.pcms);
+    }
+
+    PCMInfo info;
+    auto result = co_await async::submit([&]() -> std::expected<void, std::string> {
+        if(auto ast = compile(params, info); !ast) {
+            return std::unexpected(ast.error());
+        }
+        return {};
+    });
+
+    if(!result) {
+        log::warn("Failed to build module {}, because {}", name, result.error());
+        co_return false;
+    }
+
+    auto depsHash = co_await hashDeps(info.deps);
+
+    /// Remove the outdated PCM.
+    if(!pcm.path.empty() && pcm.path != info.path) {
+        if(auto error = llvm::sys::fs::remove(pcm.path)) {
+            log::warn("Failed to remove PCM: {}, because {}", pcm.path, error.message());
+        }
+    }
+
+    static_cast<PCMInfo&>(pcm) = std::move(info);
+    pcm.srcHash = srcHash;
+    pcm.hash = hash;
+    pcm.depsHash = depsHash;
+
+    log::info("Build module {} at {}", name, pcm.path);
+
+    co_return true;
+}
+
+void CacheController::collectPCMs(llvm::StringRef name, llvm::StringMap<std::string>& pcms) {
+    auto iter = this->pcms.find(name);
+    if(iter == this->pcms.end() || iter->second.path.empty()) {
+        return;
+    }
+
+    if(!pcms.try_emplace(name, iter->second.path).second) {
+        return;
+    }
+
+    for(auto& import: iter->second.imports) {
+        collectPCMs(import, pcms);
+    }
+}
+
+async::Task<std::uint64_t> CacheController::hashDeps(std::vector<std::string> deps) {
+    llvm::SmallVector<std::int64_t, 64> mtimes;
+    mtimes.reserve(deps.size());
+    for(auto& dep: deps) {
+        auto stats = co_await async::fs::stat(dep);
+        mtimes.emplace_back(stats ? stats->mtime.count() : -1);
+    }
+
+    auto bytes = reinterpret_cast<const std::uint8_t*>(mtimes.data());
+    co_return llvm::xxh3_64bits(llvm::ArrayRef(bytes, mtimes.size() * sizeof(std::int64_t)));
+}
+
+void CacheController::acquire(llvm::StringRef file, std::uint64_t key) {
+    if(auto iter = pchMap.find(file); iter != pchMap.end() && iter->second == key) {
+        return;
+    }
+
+    release(file);
+    pchMap[file] = key;
+    pchs[key].reference += 1;
+}
+
+void CacheController::release(llvm::StringRef file) {
+    auto iter = pchMap.find(file);
+    if(iter == pchMap.end()) {
+        return;
+    }
+
+    if(auto pch = pchs.find(iter->second); pch != pchs.end() && pch->second.reference > 0) {
+        pch->second.reference -= 1;
+    }
+    pchMap.erase(iter);
+}
+
+void CacheController::collect() {
+    if(options.limit == 0 || pchs.size() <= options.limit) {
+        return;
+    }
+
+    /// [last used, key]
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> candidates;
+    for(auto& [key, pch]: pchs) {
+        if(pch.reference == 0 && !pch.building) {
+            candidates.emplace_back(pch.lastUsed, key);
+        }
+    }
+    ranges::sort(candidates);
+
+    for(auto [_, key]: candidates) {
+        if(pchs.size() <= options.limit) {
+            break;
+        }
+        remove(key);
+    }
+}
+
+void CacheController::remove(std::uint64_t key) {
+    auto iter = pchs.find(key);
+    if(iter == pchs.end()) {
+        return;
+    }
+
+    if(auto error = llvm::sys::fs::remove(iter->second.path)) {
+        log::warn("Failed to remove PCH: {}, because {}", iter->second.path, error.message());
+    }
+    pchs.erase(iter);
 }
 
 }  // namespace clice
@@ -1,116 +1,646 @@
 #include "Support/Logger.h"
 #include "Server/Database.h"
 #include "Support/FileSystem.h"
+#include "Compiler/Command.h"
 #include "Compiler/Compilation.h"
 
+#include "llvm/Support/ConvertUTF.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/ADT/StringExtras.h"
+
 namespace clice {
 
-/// Update the compile commands with the given file.
-void CompilationDatabase::updateCommands(llvm::StringRef filename) {
-    auto path = path::real_path(filename);
-    filename = path;
-
-    /// Read the compile commands from the file.
-    json::Value json = nullptr;
-
-    if(auto buffer = llvm::MemoryBuffer::getFile(filename)) {
-        if(auto result = json::parse(buffer->get()->getBuffer())) {
-            /// llvm::json::Value will hold on string buffer.
-            /// Do not worry about the lifetime of the buffer.
-            /// Release buffer to save memory.
-            json = std::move(result.get());
-        } else {
-            log::warn("Failed to parse json file at {0}, because {1}",
-                      filename,
-                      result.takeError());
-            return;
+namespace {
+
+/// An entry of compile_commands.json, strings refer to the file buffer or the allocator
+/// of the loader.
+struct CommandEntry {
+    llvm::StringRef directory;
+    llvm::StringRef file;
+    llvm::StringRef command;
+    std::vector<llvm::StringRef> arguments;
+};
+
+/// A SAX style parser of compile_commands.json. It only decodes the fields we need and
+/// skips others, without building `json::Value` for the whole file. Strings without
+/// escapes refer to the content directly.
+class CommandParser {
+public:
+    CommandParser(llvm::StringRef content, llvm::StringSaver& saver) :
+        content(content), saver(saver) {}
+
+    std::expected<std::vector<CommandEntry>, std::string> parse() {
+        std::vector<CommandEntry> entries;
+
+        skipSpace();
+        if(!consume('[')) {
+            return std::unexpected(error("expected an array of object"));
         }
-    } else {
-        log::warn("Failed to read file {0}", filename);
-        return;
+
+        skipSpace();
+        if(consume(']')) {
+            return entries;
+        }
+
+        while(true) {
+            skipSpace();
+            if(!consume('{')) {
+                return std::unexpected(error("expected an object"));
+            }
+
+            auto& entry = entries.emplace_back();
+            skipSpace();
+            while(!consume('}')) {
+                skipSpace();
+                auto key = parseString();
+                skipSpace();
+                if(!key || !consume(':')) {
+                    return std::unexpected(error("expected a key"));
+                }
+
+                skipSpace();
+                if(*key == "directory" || *key == "file" || *key == "command") {
+                    auto value = parseString();
+                    if(!value) {
+                        return std::unexpected(error("expected a string"));
+                    }
+
+                    if(*key == "directory") {
+                        entry.directory = *value;
+                    } else if(*key == "file") {
+                        entry.file = *value;
+                    } else {
+                        entry.command = *value;
+                    }
+                } else if(*key == "arguments") {
+                    if(!parseArguments(entry.arguments)) {
+                        return std::unexpected(error("expected an array of string"));
+                    }
+                } else if(!skipValue()) {
+                    return std::unexpected(error("invalid value"));
+                }
+
+                skipSpace();
+                if(!consume(',') && peek() != '}') {
+                    return std::unexpected(error("expected ',' or '}'"));
+                }
+                skipSpace();
+            }
+
+            skipSpace();
+            if(consume(']')) {
+                break;
+            }
+
+            if(!consume(',')) {
+                return std::unexpected(error("expected ',' or ']'"));
+            }
+        }
+
+        return entries;
+    }
+
+private:
+    char peek() const {
+        return pos < content.size() ? content[pos] : '\0';
+    }
+
+    bool consume(char c) {
+        if(peek() == c) {
+            pos += 1;
+            return true;
+        }
+        return false;
     }
 
-    assert(json.kind() != json::Value::Null && "json is nullptr");
+    void skipSpace() {
+        while(pos < content.size() && llvm::isSpace(content[pos])) {
+            pos += 1;
+        }
+    }
 
-    if(json.kind() != json::Value::Array) {
-        log::warn("Compilation Database requires a array of object, but get {0}, input file: {1}",
-                  refl::enum_name(json.kind()),
-                  filename);
-        return;
+    std::string error(llvm::StringRef message) const {
+        return std::format("{} at offset {}", message, pos);
     }
 
-    auto elements = json.getAsArray();
-    assert(elements && "json is not an array");
+    std::optional<llvm::StringRef> parseString() {
+        if(!consume('"')) {
+            return std::nullopt;
+        }
 
-    for(auto& element: *elements) {
-        auto object = element.getAsObject();
-        if(!object) {
-            log::warn(
-                "Compilation Database requires an array of object, but get a array of {0}, input file: {1}",
-                refl::enum_name(element.kind()),
-                filename);
-            continue;
+        /// Fast path, the string does not contain any escape.
+        auto begin = pos;
+        auto end = content.find_first_of("\"\\", pos);
+        if(end == llvm::StringRef::npos) {
+            return std::nullopt;
         }
 
-        /// FIXME: currently we assume all path here is absolute.
-        /// Add `directory` field in the future.
+        if(content[end] == '"') {
+            pos = end + 1;
+            return content.slice(begin, end);
+        }
 
-        llvm::SmallString<128> path;
+        std::string result = content.slice(begin, end).str();
+        pos = end;
+        while(true) {
+            if(pos >= content.size()) {
+                return std::nullopt;
+            }
 
-        if(auto file = object->getString("file")) {
-            if(auto error = fs::real_path(*file, path)) {
-                log::warn("Failed to get real path of {0}, because {1}", *file, error.message());
+            char c = content[pos++];
+            if(c == '"') {
+                break;
+            } else if(c != '\\') {
+                result.push_back(c);
                 continue;
             }
-        } else {
-            log::warn("The element does not have a file field, input file: {0}", filename);
+
+            if(pos >= content.size()) {
+                return std::nullopt;
+            }
+
+            switch(content[pos++]) {
+                case '"': result.push_back('"'); break;
+                case '\\': result.push_back('\\'); break;
+                case '/': result.push_back('/'); break;
+                case 'b': result.push_back('\b'); break;
+                case 'f': result.push_back('\f'); break;
+                case 'n': result.push_back('\n'); break;
+                case 'r': result.push_back('\r'); break;
+                case 't': result.push_back('\t'); break;
+                case 'u': {
+                    auto code = parseHex();
+                    if(!code) {
+                        return std::nullopt;
+                    }
+
+                    /// Combine the surrogate pair.
+                    if(*code >= 0xD800 && *code < 0xDC00 &&
+                       content.substr(pos).starts_with("\\u")) {
+                        pos += 2;
+                        auto low = parseHex();
+                        if(!low || *low < 0xDC00 || *low >= 0xE000) {
+                            return std::nullopt;
+                        }
+                        *code = 0x10000 + ((*code - 0xD800) << 10) + (*low - 0xDC00);
+                    }
+
+                    char buffer[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+                    char* out = buffer;
+                    if(!llvm::ConvertCodePointToUTF8(*code, out)) {
+                        return std::nullopt;
+                    }
+                    result.append(buffer, out);
+                    break;
+                }
+                default: return std::nullopt;
+            }
+        }
+
+        return saver.save(result);
+    }
+
+    std::optional<std::uint32_t> parseHex() {
+        std::uint32_t code = 0;
+        if(pos + 4 > content.size() || content.substr(pos, 4).getAsInteger(16, code)) {
+            return std::nullopt;
+        }
+        pos += 4;
+        return code;
+    }
+
+    bool parseArguments(std::vector<llvm::StringRef>& arguments) {
+        if(!consume('[')) {
+            return false;
+        }
+
+        skipSpace();
+        if(consume(']')) {
+            return true;
+        }
+
+        while(true) {
+            skipSpace();
+            auto argument = parseString();
+            if(!argument) {
+                return false;
+            }
+            arguments.emplace_back(*argument);
+
+            skipSpace();
+            if(consume(']')) {
+                return true;
+            }
+
+            if(!consume(',')) {
+                return false;
+            }
+        }
+    }
+
+    /// Skip a value of any kind, the content of nested values are not validated.
+    bool skipValue() {
+        if(peek() == '"') {
+            return parseString().has_value();
+        }
+
+        std::size_t depth = 0;
+        while(pos < content.size()) {
+            char c = peek();
+            if(c == '"') {
+                if(!parseString()) {
+                    return false;
+                }
+                continue;
+            }
+
+            if(c == '{' || c == '[') {
+                depth += 1;
+            } else if(c == '}' || c == ']') {
+                if(depth == 0) {
+                    return true;
+                }
+                depth -= 1;
+            } else if(c == ',' && depth == 0) {
+                return true;
+            }
+            pos += 1;
+        }
+        return depth == 0;
+    }
+
+    llvm::StringRef content;
+    std::size_t pos = 0;
+    llvm::StringSaver& saver;
+};
+
+struct PathOption {
+    llvm::StringLiteral name;
+
+    /// Whether the value is relative to the working directory. Values of options like
+    /// `-iwithsysroot` are relative to other paths, they are kept as is.
+    bool rebased = true;
+};
+
+/// Options whose value is a path, in separate (`-I dir`) or joined (`-Idir`) form. Every
+/// option is matched as a prefix of the argument, and the longest one wins, so that
+/// `-iframeworkwithsysroot<dir>` is not matched as `-iframework`.
+constexpr PathOption pathOptions[] = {
+    {"-include-pch"},
+    {"-include"},
+    {"-imacros"},
+    {"-isystem"},
+    {"-isystem-after"},
+    {"-cxx-isystem"},
+    {"-isysroot"},
+    {"-iquote"},
+    {"-idirafter"},
+    {"-iframework"},
+    {"-iframeworkwithsysroot", false},
+    {"-iwithsysroot", false},
+    {"-iprefix"},
+    {"-iwithprefix", false},
+    {"-iwithprefixbefore", false},
+    {"-ivfsoverlay"},
+    {"-I"},
+    {"-F"},
+    {"--sysroot="},
+    {"--sysroot"},
+    {"-fmodule-map-file="},
+    {"-fmodule-file="},
+    {"-fprebuilt-module-path="},
+};
+
+/// Find the longest path option which the argument starts with.
+const PathOption* findPathOption(llvm::StringRef arg) {
+    const PathOption* result = nullptr;
+    for(auto& option: pathOptions) {
+        if(arg.starts_with(option.name) &&
+           (!result || option.name.size() > result->name.size())) {
+            result = &option;
+        }
+    }
+    return result;
+}
+
+/// Resolve the relative path against the directory, return empty if it is not changed.
+std::string rebase(llvm::StringRef directory, llvm::StringRef path) {
+    if(directory.empty() || path.empty() || path::is_absolute(path)) {
+        return "";
+    }
+
+    llvm::SmallString<128> result = directory;
+    path::append(result, path);
+    path::remove_dots(result, true);
+    return result.str().str();
+}
+
+}  // namespace
+
+async::Task<> CompilationDatabase::loadCommands(llvm::ArrayRef<std::string> dirs) {
+    for(auto& dir: dirs) {
+        auto path = path::join(dir, "compile_commands.json");
+        if(!fs::exists(path)) {
+            log::warn("Failed to find compile_commands.json in {0}", dir);
             continue;
         }
+        co_await updateCommands(std::move(path));
+    }
+}
+
+async::Task<> CompilationDatabase::updateCommands(std::string filename) {
+    /// The count of entries resolved in one job.
+    constexpr std::size_t batch = 1024;
+
+    llvm::BumpPtrAllocator allocator;
+    llvm::StringSaver saver(allocator);
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+
+    auto result = co_await async::submit(
+        [&]() -> std::expected<std::vector<CommandEntry>, std::string> {
+            auto file = llvm::MemoryBuffer::getFile(filename);
+            if(!file) {
+                return std::unexpected(file.getError().message());
+            }
+            buffer = std::move(*file);
+
+            CommandParser parser(buffer->getBuffer(), saver);
+            return parser.parse();
+        });
+
+    if(!result) {
+        log::warn("Failed to load compile commands from {0}, because {1}",
+                  filename,
+                  result.error());
+        co_return;
+    }
 
-        auto command = object->getString("command");
-        if(!command) {
-            log::warn("The key:{0} does not have a command field, input file: {1}", path, filename);
+    /// Resolve paths and split commands on the thread pool, each job has its own
+    /// allocator so they never contend with each other.
+    auto& entries = *result;
+    std::vector<std::string> paths(entries.size());
+    std::vector<llvm::BumpPtrAllocator> allocators((entries.size() + batch - 1) / batch);
+
+    auto resolve = [&](std::size_t index) -> async::Task<> {
+        co_await async::submit([&, index] {
+            llvm::StringSaver saver(allocators[index]);
+            llvm::SmallVector<const char*, 64> args;
+
+            auto end = std::min(entries.size(), (index + 1) * batch);
+            for(auto i = index * batch; i < end; ++i) {
+                auto& entry = entries[i];
+                if(entry.file.empty() || (entry.command.empty() && entry.arguments.empty())) {
+                    continue;
+                }
+
+                llvm::SmallString<128> path = entry.file;
+                if(!path::is_absolute(path)) {
+                    path = entry.directory;
+                    path::append(path, entry.file);
+                }
+
+                /// The file may be generated during build, keep the normalized path.
+                llvm::SmallString<128> real;
+                if(fs::real_path(path, real)) {
+                    path::remove_dots(path, true);
+                    real = path;
+                }
+                paths[i] = real.str().str();
+
+                if(entry.arguments.empty()) {
+                    args.clear();
+                    tokenizeCommand(entry.command, saver, args);
+                    entry.arguments.assign(args.begin(), args.end());
+                }
+            }
+        });
+    };
+
+    std::vector<async::Task<>> tasks;
+    for(std::size_t i = 0; i < allocators.size(); ++i) {
+        tasks.emplace_back(resolve(i));
+    }
+    co_await async::when_all(std::move(tasks));
+
+    /// Interning is cheap, do it serially.
+    std::size_t invalid = 0;
+    for(std::size_t i = 0; i < entries.size(); ++i) {
+        if(paths[i].empty()) {
+            invalid += 1;
             continue;
         }
+        commands[paths[i]] =
+            canonicalize(paths[i], entries[i].arguments, entries[i].directory);
+    }
 
-        commands[path] = *command;
+    if(invalid != 0) {
+        log::warn("Skipped {0} entries without file or command in {1}", invalid, filename);
     }
 
-    log::info("Successfully loaded compile commands from {0}, total {1} commands",
-              filename,
-              commands.size());
+    log::info(
+        "Successfully loaded compile commands from {0}, total {1} commands, {2} classes, {3} arguments",
+        filename,
+        commands.size(),
+        classes.size(),
+        arguments.size());
+}
+
+async::Task<> CompilationDatabase::scanModules() {
+    /// The count of files scanned in one job.
+    constexpr std::size_t batch = 64;
+
+    /// The database is not changed while scanning, so it is safe to refer to the paths.
+    std::vector<std::pair<llvm::StringRef, std::string>> files;
+    files.reserve(commands.size());
+    for(auto& entry: commands) {
+        files.emplace_back(entry.first(), getCommand(entry.first()));
+    }
+
+    auto scan = [this](llvm::ArrayRef<std::pair<llvm::StringRef, std::string>> files)
+        -> async::Task<> {
+        auto modules = co_await async::submit([files] {
+            std::vector<std::pair<std::string, std::string>> modules;
+            for(auto& [path, command]: files) {
+                auto buffer = llvm::MemoryBuffer::getFile(path);
+                if(!buffer) {
+                    continue;
+                }
 
-    /// Scan all files to build module map.
-    // CompilationParams params;
-    // for(auto& [path, command]: commands) {
-    //     params.srcPath = path;
-    //     params.command = command;
-    //
-    //    auto name = scanModuleName(params);
-    //    if(!name.empty()) {
-    //        moduleMap[name] = path;
-    //    }
-    //}
+                CompilationParams params;
+                params.srcPath = path;
+                params.content = buffer.get()->getBuffer();
+                params.command = command;
+                if(auto name = scanModuleName(params); !name.empty()) {
+                    modules.emplace_back(std::move(name), path.str());
+                }
+            }
+            return modules;
+        });
+
+        for(auto& [name, path]: modules) {
+            moduleMap[name] = std::move(path);
+        }
+    };
+
+    std::vector<async::Task<>> tasks;
+    for(std::size_t i = 0; i < files.size(); i += batch) {
+        auto chunk = llvm::ArrayRef(files).slice(i, std::min(batch, files.size() - i));
+        tasks.emplace_back(scan(chunk));
+    }
+    co_await async::when_all(std::move(tasks));
 
     log::info("Successfully built module map, total {0} modules", moduleMap.size());
 }
 
-void CompilationDatabase::updateCommand(llvm::StringRef file, llvm::StringRef command) {
-    commands[path::real_path(file)] = command;
+void CompilationDatabase::updateCommand(llvm::StringRef file,
+                                        llvm::StringRef command,
+                                        llvm::StringRef directory) {
+    auto path = path::real_path(file);
+    commands[path] = canonicalize(path, command, directory);
+}
+
+std::uint32_t CompilationDatabase::intern(llvm::StringRef argument) {
+    auto [iter, inserted] = argumentIds.try_emplace(argument, arguments.size());
+    if(inserted) {
+        arguments.emplace_back(iter->first());
+    }
+    return iter->second;
+}
+
+CompilationDatabase::Command CompilationDatabase::canonicalize(llvm::StringRef file,
+                                                               llvm::StringRef command,
+                                                               llvm::StringRef directory) {
+    llvm::BumpPtrAllocator allocator;
+    llvm::StringSaver saver(allocator);
+    llvm::SmallVector<const char*, 64> args;
+    tokenizeCommand(command, saver, args);
+
+    llvm::SmallVector<llvm::StringRef, 64> tokens(args.begin(), args.end());
+    return canonicalize(file, tokens, directory);
+}
+
+CompilationDatabase::Command
+    CompilationDatabase::canonicalize(llvm::StringRef file,
+                                      llvm::ArrayRef<llvm::StringRef> args,
+                                      llvm::StringRef directory) {
+    Command result;
+    CommandClass commandClass;
+
+    for(std::size_t i = 0; i < args.size(); ++i) {
+        llvm::StringRef arg = args[i];
+
+        /// Remove output and dependency file arguments, they differ between files but do
+        /// not affect the semantics. Note that `-objc*` and `-object` are not output.
+        if(arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ" ||
+           arg == "--serialize-diagnostics") {
+            ++i;
+            continue;
+        }
+
+        if(arg == "-c" || arg == "-MD" || arg == "-MMD" || arg.starts_with("-MF") ||
+           arg.starts_with("-MT") || arg.starts_with("-MQ") ||
+           (arg.starts_with("-o") && !arg.starts_with("-obj"))) {
+            continue;
+        }
+
+        /// The command is run in `directory`, rebase relative paths onto it so that the
+        /// command could be run in any working directory.
+        if(auto option = findPathOption(arg)) {
+            llvm::StringRef value = arg.substr(option->name.size());
+            if(value.empty() && !option->name.ends_with("=") && i + 1 < args.size()) {
+                commandClass.arguments.emplace_back(intern(arg));
+                value = args[++i];
+                auto path = option->rebased ? rebase(directory, value) : "";
+                commandClass.arguments.emplace_back(
+                    intern(path.empty() ? value : llvm::StringRef(path)));
+                continue;
+            }
+
+            /// `-fmodule-file=<name>=<path>`, only the path is rebased.
+            llvm::StringRef name;
+            if(option->name == "-fmodule-file=" && value.contains('=')) {
+                std::tie(name, value) = value.split('=');
+                name = arg.substr(0, option->name.size() + name.size() + 1);
+            } else {
+                name = option->name;
+            }
+
+            if(auto path = option->rebased ? rebase(directory, value) : "";
+               !path.empty()) {
+                commandClass.arguments.emplace_back(intern((llvm::Twine(name) + path).str()));
+                continue;
+            }
+            commandClass.arguments.emplace_back(intern(arg));
+            continue;
+        }
+
+        /// Replace the input file with a placeholder, keep the extension because it
+        /// determines the language.
+        if(result.input == std::uint32_t(-1) && !arg.starts_with("-")) {
+            auto path = rebase(directory, arg);
+            llvm::StringRef input = path.empty() ? arg : llvm::StringRef(path);
+            if(isInputFile(input, file)) {
+                result.input = intern(input);
+                commandClass.input = commandClass.arguments.size();
+                commandClass.arguments.emplace_back(
+                    intern((inputPlaceholder + path::extension(arg)).str()));
+                continue;
+            }
+        }
+
+        commandClass.arguments.emplace_back(intern(arg));
+    }
+
+    if(auto iter = classIds.find(commandClass.arguments); iter != classIds.end()) {
+        result.id = iter->second;
+    } else {
+        classes.emplace_back(std::move(commandClass));
+        result.id = classes.size();
+        classIds.try_emplace(classes.back().arguments, result.id);
+    }
+
+    return result;
 }
 
 /// Update the module map with the given file and module name.
 void CompilationDatabase::updateModule(llvm::StringRef file, llvm::StringRef name) {
-    moduleMap[path::real_path(file)] = file;
+    moduleMap[name] = path::real_path(file);
 }
 
 /// Lookup the compile commands of the given file.
-llvm::StringRef CompilationDatabase::getCommand(llvm::StringRef file) {
+std::string CompilationDatabase::getCommand(llvm::StringRef file) {
     auto iter = commands.find(file);
     if(iter == commands.end()) {
         return "";
     }
-    return iter->second;
+
+    auto& command = iter->second;
+    auto& commandClass = classes[command.id - 1];
+
+    std::string result;
+    for(std::size_t i = 0; i < commandClass.arguments.size(); ++i) {
+        llvm::StringRef arg = i == commandClass.input ? arguments[command.input]
+                                                      : arguments[commandClass.arguments[i]];
+        appendArgument(result, arg);
+    }
+    return result;
+}
+
+std::uint32_t CompilationDatabase::getCommandClass(llvm::StringRef file) {
+    auto iter = commands.find(file);
+    return iter == commands.end() ? 0 : iter->second.id;
+}
+
+std::vector<llvm::StringRef> CompilationDatabase::getClassArguments(std::uint32_t id) {
+    std::vector<llvm::StringRef> result;
+    if(id == 0 || id > classes.size()) {
+        return result;
+    }
+
+    for(auto argument: classes[id - 1].arguments) {
+        result.emplace_back(arguments[argument]);
+    }
+    return result;
 }
 
 /// Lookup the module interface unit file path of the given module name.
@@ -4,19 +4,33 @@
 namespace clice {
 
 async::Task<> Server::onDidOpen(const proto::DidOpenTextDocumentParams& params) {
-    co_return;
+    auto path = SourceConverter::toPath(params.textDocument.uri);
+    co_await scheduler.open(path, params.textDocument.text);
 }
 
 async::Task<> Server::onDidChange(const proto::DidChangeTextDocumentParams& document) {
-    co_return;
+    /// Background indexing yields to the user typing.
+    if(config::index.pauseOnTyping != 0) {
+        indexer.pauseFor(std::chrono::milliseconds(config::index.pauseOnTyping));
+    }
+
+    /// The document is synced incrementally, changes are applied in order.
+    auto path = SourceConverter::toPath(document.textDocument.uri);
+    co_await scheduler.update(path, document.contentChanges, converter);
 }
 
 async::Task<> Server::onDidSave(const proto::DidSaveTextDocumentParams& document) {
-    co_return;
+    /// The content on disk is changed, the document itself is still served from memory.
+    auto path = SourceConverter::toPath(document.textDocument.uri);
+    vfs->invalidate(path);
+    co_await indexer.update({path}, [&](llvm::StringRef file) {
+        return scheduler.isOpened(file);
+    });
 }
 
 async::Task<> Server::onDidClose(const proto::DidCloseTextDocumentParams& document) {
-    co_return;
+    auto path = SourceConverter::toPath(document.textDocument.uri);
+    co_await scheduler.close(path);
 }
 
 }  // namespace clice
@@ -8,7 +8,61 @@ async::Task<> Server::onIndexCurrent(const proto::TextDocumentIdentifier& params
 }
 
 async::Task<> Server::onIndexAll(const proto::None& params) {
-    co_await indexer.indexAll();
+    /// Every run has its own token, and the progress is reported only after the client
+    /// acknowledges it.
+    static std::uint32_t runs = 0;
+    proto::ProgressToken token = std::format("clice/index/all/{}", runs += 1);
+    auto created = co_await request("window/workDoneProgress/create",
+                                    json::serialize(proto::WorkDoneProgressCreateParams{token}));
+    if(!created) {
+        log::warn("Failed to create progress {0}, indexing without reporting", token);
+        auto report = co_await indexer.indexAll();
+        log::info("Indexed {} of {} files", report.indexed, report.files);
+        co_return;
+    }
+
+    using Begin = proto::ProgressParams<proto::WorkDoneProgressBegin>;
+    co_await notify("$/progress", json::serialize(Begin{token, {.title = "Indexing"}}));
+
+    /// Report at most once per percent, and skip reports if the client reads slowly.
+    std::uint32_t percentage = 0;
+    auto progress = [&](std::size_t done, std::size_t total) {
+        auto current = static_cast<std::uint32_t>(done * 100 / total);
+        if(current == percentage || async::net::pending() >= async::net::highWaterMark) {
+            return;
+        }
+
+        percentage = current;
+        using Report = proto::ProgressParams<proto::WorkDoneProgressReport>;
+        auto params = Report{
+            token,
+            {.message = std::format("{}/{}", done, total), .percentage = current}
+        };
+        async::schedule(notify("$/progress", json::serialize(params)).release());
+    };
+
+    auto report = co_await indexer.indexAll(progress);
+
+    auto seconds = std::max(report.elapsed.count(), std::int64_t(1)) / 1000.0;
+    auto message = std::format("Indexed {} of {} files in {:.1f}s, {:.1f} files/s, {} KB written",
+                               report.indexed,
+                               report.files,
+                               seconds,
+                               report.indexed / seconds,
+                               report.written / 1024);
+    log::info("{}", message);
+
+    using End = proto::ProgressParams<proto::WorkDoneProgressEnd>;
+    co_await notify("$/progress", json::serialize(End{token, {.message = message}}));
+}
+
+async::Task<> Server::onIndexPause(const proto::None& params) {
+    indexer.pause();
+    co_return;
+}
+
+async::Task<> Server::onIndexResume(const proto::None& params) {
+    indexer.resume();
     co_return;
 }
 
@@ -7,33 +7,33 @@ async::Task<> Server::onGotoDeclaration(json::Value id, const proto::Declaration
     proto::DeclarationResult result =
         co_await indexer.lookup(params,
                                 RelationKind(RelationKind::Declaration, RelationKind::Definition));
-    co_await response(std::move(id), json::serialize(result));
+    co_await response(std::move(id), result);
 }
 
 async::Task<> Server::onGotoDefinition(json::Value id, const proto::DefinitionParams& params) {
     proto::DefinitionResult result = co_await indexer.lookup(params, RelationKind::Definition);
-    co_await response(std::move(id), json::serialize(result));
+    co_await response(std::move(id), result);
 }
 
 async::Task<> Server::onGotoTypeDefinition(json::Value id,
                                            const proto::TypeDefinitionParams& params) {
     proto::TypeDefinitionResult result =
         co_await indexer.lookup(params, RelationKind::TypeDefinition);
-    co_await response(std::move(id), json::serialize(result));
+    co_await response(std::move(id), result);
 }
 
 async::Task<> Server::onGotoImplementation(json::Value id,
                                            const proto::ImplementationParams& params) {
     proto::ImplementationResult result =
         co_await indexer.lookup(params, RelationKind::Implementation);
-    co_await response(std::move(id), json::serialize(result));
+    co_await response(std::move(id), result);
 }
 
 async::Task<> Server::onFindReferences(json::Value id, const proto::ReferenceParams& params) {
     proto::ReferenceResult result = co_await indexer.lookup(
         params,
         RelationKind(RelationKind::Declaration, RelationKind::Definition, RelationKind::Reference));
-    co_await response(std::move(id), json::serialize(result));
+    co_await response(std::move(id), result);
 }
 
 async::Task<> Server::onPrepareCallHierarchy(json::Value id,
@@ -83,21 +83,65 @@ async::Task<> Server::onCodeLens(json::Value id, const proto::CodeLensParams& pa
 }
 
 async::Task<> Server::onFoldingRange(json::Value id, const proto::FoldingRangeParams& params) {
-    co_return;
+    auto path = SourceConverter::toPath(params.textDocument.uri);
+    auto result = co_await scheduler.withAST(
+        path,
+        [&](ASTInfo& info) {
+            FoldingRangeParams foldingParams;
+            auto ranges = feature::folding_range::foldingRange(foldingParams, info, converter);
+            auto content = info.srcMgr().getBufferData(info.getInterestedFile());
+            return feature::folding_range::toLspResult(ranges, content, converter);
+        },
+        token(id));
+
+    if(!result) {
+        co_await response(std::move(id), json::Value(nullptr));
+        co_return;
+    }
+    co_await response(std::move(id), *result);
 }
 
 async::Task<> Server::onDocumentSymbol(json::Value id, const proto::DocumentSymbolParams& params) {
-    co_return;
+    auto path = SourceConverter::toPath(params.textDocument.uri);
+    auto result = co_await scheduler.withAST(
+        path,
+        [&](ASTInfo& info) { return feature::documentSymbol(info, converter); },
+        token(id));
+
+    if(!result) {
+        co_await response(std::move(id), json::Value(nullptr));
+        co_return;
+    }
+    co_await response(std::move(id), *result);
 }
 
 async::Task<> Server::onSemanticTokens(json::Value id, const proto::SemanticTokensParams& params) {
     auto path = SourceConverter::toPath(params.textDocument.uri);
     auto tokens = co_await indexer.semanticTokens(path);
-    co_await response(std::move(id), json::serialize(tokens));
+    co_await response(std::move(id), tokens);
 }
 
 async::Task<> Server::onInlayHint(json::Value id, const proto::InlayHintParams& params) {
-    co_return;
+    auto path = SourceConverter::toPath(params.textDocument.uri);
+    auto result = co_await scheduler.withAST(
+        path,
+        [&](ASTInfo& info) {
+            config::InlayHintOption options;
+            auto hints = feature::inlay_hint::inlayHints(params, info, converter, options);
+            auto content = info.srcMgr().getBufferData(info.getInterestedFile());
+            return feature::inlay_hint::toLspType(hints,
+                                                  params.textDocument.uri,
+                                                  options,
+                                                  content,
+                                                  converter);
+        },
+        token(id));
+
+    if(!result) {
+        co_await response(std::move(id), json::Value(nullptr));
+        co_return;
+    }
+    co_await response(std::move(id), *result);
 }
 
 async::Task<> Server::onCodeCompletion(json::Value id, const proto::CompletionParams& params) {
@@ -0,0 +1,78 @@
+#include "Server/IndexCache.h"
+
+namespace clice {
+
+std::shared_ptr<llvm::MemoryBuffer> IndexCache::get(llvm::StringRef path) {
+    auto iter = map.find(path);
+    if(iter == map.end()) {
+        return nullptr;
+    }
+
+    /// Move the entry to the front.
+    entries.splice(entries.begin(), entries, iter->second);
+    return iter->second->buffer;
+}
+
+std::shared_ptr<llvm::MemoryBuffer> IndexCache::put(llvm::StringRef path,
+                                                    std::unique_ptr<llvm::MemoryBuffer> buffer) {
+    invalidate(path);
+
+    size += buffer->getBufferSize();
+    entries.emplace_front(Entry{path.str(), std::move(buffer)});
+    map.try_emplace(path, entries.begin());
+
+    /// Keep a reference before eviction, the new entry may be evicted immediately
+    /// if it is larger than the whole budget.
+    auto result = entries.front().buffer;
+    evict();
+    return result;
+}
+
+std::shared_ptr<const LineTable> IndexCache::getLines(llvm::StringRef path) {
+    auto iter = map.find(path);
+    if(iter == map.end()) {
+        return nullptr;
+    }
+
+    entries.splice(entries.begin(), entries, iter->second);
+    return iter->second->lines;
+}
+
+void IndexCache::putLines(llvm::StringRef path,
+                          const llvm::MemoryBuffer* buffer,
+                          std::shared_ptr<const LineTable> lines) {
+    auto iter = map.find(path);
+    if(iter == map.end() || iter->second->buffer.get() != buffer || iter->second->lines) {
+        return;
+    }
+
+    size += lines->memoryUsage();
+    iter->second->lines = std::move(lines);
+    evict();
+}
+
+void IndexCache::invalidate(llvm::StringRef path) {
+    auto iter = map.find(path);
+    if(iter == map.end()) {
+        return;
+    }
+
+    size -= iter->second->bytes();
+    entries.erase(iter->second);
+    map.erase(iter);
+}
+
+void IndexCache::evict() {
+    if(limit == 0) {
+        return;
+    }
+
+    while(size > limit && !entries.empty()) {
+        auto& entry = entries.back();
+        size -= entry.bytes();
+        map.erase(entry.path);
+        entries.pop_back();
+    }
+}
+
+}  // namespace clice
@@ -0,0 +1,438 @@
+#include "Server/Indexer.h"
+#include "Support/Binary.h"
+#include "Support/Logger.h"
+
+#include "llvm/Support/MathExtras.h"
+
+namespace clice {
+
+namespace memory {
+
+/// The paths appended to the path pool, the first one is at `first` in the pool.
+struct PathRecord {
+    std::uint32_t first;
+    std::vector<std::string> paths;
+};
+
+struct IndexRecord {
+    std::string path;
+    llvm::XXH128_hash_t symbolHash;
+    llvm::XXH128_hash_t featureHash;
+};
+
+struct InclusionRecord {
+    std::uint64_t fingerprint;
+    std::uint64_t key;
+};
+
+struct HeaderRecord {
+    std::string srcPath;
+    Indexer::Fingerprint fingerprint;
+    std::vector<IndexRecord> indices;
+    std::vector<InclusionRecord> inclusions;
+};
+
+struct ContextRecord {
+    /// The path of the header in the path pool.
+    std::uint32_t header;
+    std::vector<Indexer::Context> contexts;
+};
+
+struct UnitRecord {
+    std::string srcPath;
+    std::string indexPath;
+    std::uint64_t indexKey;
+    Indexer::Fingerprint fingerprint;
+    bool dirty;
+    std::vector<Indexer::IncludeLocation> locations;
+    std::vector<ContextRecord> contexts;
+};
+
+}  // namespace memory
+
+namespace {
+
+/// The version of `index.bin`, index files of other versions are discarded.
+constexpr std::uint32_t version = 1;
+
+constexpr std::uint32_t magic = 0x58444943;
+
+struct FileHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+};
+
+enum class RecordKind : std::uint32_t {
+    Paths = 0,
+    Header,
+    Unit,
+};
+
+/// The index file is a sequence of records, each one is a binarified object. A later
+/// record of the same unit or header supersedes the earlier ones.
+struct RecordHeader {
+    RecordKind kind;
+
+    /// The size of the object, padded to 8 bytes so that the next record is aligned.
+    std::uint32_t size;
+};
+
+/// Write the record and return the written bytes.
+template <typename Record>
+std::uint32_t writeRecord(llvm::raw_ostream& os, RecordKind kind, const Record& record) {
+    auto [proxy, size] = binary::binarify(record);
+    auto buffer = const_cast<void*>(proxy.base);
+
+    RecordHeader header{kind, std::uint32_t(llvm::alignTo(size, 8))};
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(static_cast<const char*>(buffer), size);
+    os.write_zeros(header.size - size);
+    std::free(buffer);
+
+    return sizeof(header) + header.size;
+}
+
+}  // namespace
+
+std::vector<Indexer::IncludeLocation>& Indexer::locations(TranslationUnit* tu) {
+    if(!tu->storedLocations.empty()) {
+        tu->locations.assign(tu->storedLocations.begin(), tu->storedLocations.end());
+        tu->storedLocations = {};
+    }
+    return tu->locations;
+}
+
+std::uint64_t Indexer::writeRecords(llvm::raw_ostream& os, bool all) {
+    std::uint64_t written = 0;
+
+    if(savedPaths < pathPool.size()) {
+        memory::PathRecord record{
+            .first = std::uint32_t(savedPaths),
+            .paths = {pathPool.begin() + savedPaths, pathPool.end()},
+        };
+        written += writeRecord(os, RecordKind::Paths, record);
+        savedPaths = pathPool.size();
+    }
+
+    /// The new record supersedes the last one of the object.
+    auto supersede = [&](const void* object, std::uint32_t size) {
+        auto& last = recordSizes[object];
+        staleSize += last;
+        last = size;
+        written += size;
+    };
+
+    auto writeHeader = [&](Header* header) {
+        memory::HeaderRecord record{
+            .srcPath = header->srcPath,
+            .fingerprint = header->fingerprint,
+        };
+
+        for(auto& index: header->indices) {
+            record.indices.emplace_back(index.path, index.symbolHash, index.featureHash);
+        }
+
+        for(auto& [fingerprint, key]: header->inclusions) {
+            record.inclusions.emplace_back(fingerprint, key);
+        }
+
+        supersede(header, writeRecord(os, RecordKind::Header, record));
+    };
+
+    auto writeUnit = [&](TranslationUnit* tu) {
+        memory::UnitRecord record{
+            .srcPath = tu->srcPath,
+            .indexPath = tu->indexPath,
+            .indexKey = tu->indexKey,
+            .fingerprint = tu->fingerprint,
+            .dirty = tu->dirty,
+            .locations = locations(tu),
+        };
+
+        for(auto header: tu->headers) {
+            auto contexts = header->contexts.find(tu);
+            auto path = pathIndices.find(header->srcPath);
+            if(contexts == header->contexts.end() || path == pathIndices.end()) {
+                continue;
+            }
+            record.contexts.emplace_back(path->second, contexts->second);
+        }
+
+        supersede(tu, writeRecord(os, RecordKind::Unit, record));
+    };
+
+    if(all) {
+        for(auto& [_, header]: headers) {
+            writeHeader(header);
+        }
+
+        for(auto& [_, tu]: tus) {
+            writeUnit(tu);
+        }
+    } else {
+        for(auto header: changedHeaders) {
+            writeHeader(header);
+        }
+
+        for(auto tu: changedUnits) {
+            writeUnit(tu);
+        }
+    }
+
+    return written;
+}
+
+void Indexer::saveToDisk() {
+    auto path = path::join(options.dir, "index.bin");
+
+    /// Rewrite the file if it is not written yet, or most of it is superseded.
+    if(fileSize == 0 || staleSize * 2 > fileSize) {
+        /// Copy all locations, the mapped file is released after rewritten.
+        for(auto& [_, tu]: tus) {
+            locations(tu);
+        }
+
+        auto temp = path + ".tmp";
+        std::error_code ec;
+        llvm::raw_fd_ostream os(temp, ec);
+        if(ec) {
+            log::warn("Failed to open index file: {} Beacuse {}", temp, ec.message());
+            return;
+        }
+
+        savedPaths = 0;
+        staleSize = 0;
+        recordSizes.clear();
+
+        FileHeader header{magic, version};
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        fileSize = sizeof(header) + writeRecords(os, true);
+        os.close();
+
+        if(os.has_error()) {
+            log::warn("Failed to write index file: {}", os.error().message());
+            fileSize = 0;
+            return;
+        }
+
+        if(auto error = llvm::sys::fs::rename(temp, path)) {
+            log::warn("Failed to replace index file: {} Beacuse {}", path, error.message());
+            fileSize = 0;
+            return;
+        }
+
+        storage.reset();
+    } else {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Append);
+        if(ec) {
+            log::warn("Failed to open index file: {} Beacuse {}", path, ec.message());
+            return;
+        }
+
+        fileSize += writeRecords(os, false);
+        os.close();
+
+        /// The file may end with a partial record, rewrite it next time.
+        if(os.has_error()) {
+            log::warn("Failed to write index file: {}", os.error().message());
+            fileSize = 0;
+            return;
+        }
+    }
+
+    changedUnits.clear();
+    changedHeaders.clear();
+    log::info("Successfully saved index to disk");
+
+    symbols.saveToDisk(path::join(options.dir, "symbols.bin"));
+}
+
+void Indexer::loadFromDisk() {
+    auto path = path::join(options.dir, "index.bin");
+
+    /// Do not require null terminator, so that the file could be mapped into memory.
+    auto file = llvm::MemoryBuffer::getFile(path,
+                                            /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+    if(!file) {
+        log::warn("Failed to open index file: {} Beacuse {}", path, file.getError());
+        return;
+    }
+
+    auto content = (*file)->getBuffer();
+
+    FileHeader prefix = {};
+    if(content.size() >= sizeof(prefix)) {
+        std::memcpy(&prefix, content.data(), sizeof(prefix));
+    }
+
+    if(prefix.magic != magic || prefix.version != version) {
+        log::warn("Discard index file of other version: {}", path);
+        return;
+    }
+
+    struct Record {
+        const char* data;
+        std::uint32_t size;
+    };
+
+    /// Only the last record of each unit and header is loaded.
+    llvm::StringMap<Record> headerRecords;
+    llvm::StringMap<Record> unitRecords;
+    std::uint64_t stale = 0;
+    auto add = [&](llvm::StringMap<Record>& records, llvm::StringRef key, Record record) {
+        auto [iter, success] = records.try_emplace(key, record);
+        if(!success) {
+            stale += iter->second.size;
+            iter->second = record;
+        }
+    };
+
+    std::size_t offset = sizeof(FileHeader);
+    bool complete = true;
+    while(offset < content.size()) {
+        RecordHeader record;
+        if(content.size() - offset < sizeof(record)) {
+            complete = false;
+            break;
+        }
+
+        std::memcpy(&record, content.data() + offset, sizeof(record));
+        auto data = content.data() + offset + sizeof(record);
+        if(content.size() - offset - sizeof(record) < record.size) {
+            complete = false;
+            break;
+        }
+
+        Record entry{data, std::uint32_t(sizeof(record) + record.size)};
+        if(record.kind == RecordKind::Paths) {
+            binary::Proxy<memory::PathRecord> paths{data, data};
+            std::uint32_t first = paths.get<"first">();
+            if(first != pathPool.size()) {
+                complete = false;
+                break;
+            }
+
+            auto list = paths.get<"paths">();
+            for(std::size_t i = 0; i < list.size(); ++i) {
+                auto name = list[i].as_string();
+                pathIndices.try_emplace(name, pathPool.size());
+                pathPool.emplace_back(name.str());
+            }
+        } else if(record.kind == RecordKind::Header) {
+            binary::Proxy<memory::HeaderRecord> proxy{data, data};
+            add(headerRecords, proxy.get<"srcPath">().as_string(), entry);
+        } else if(record.kind == RecordKind::Unit) {
+            binary::Proxy<memory::UnitRecord> proxy{data, data};
+            add(unitRecords, proxy.get<"srcPath">().as_string(), entry);
+        } else {
+            complete = false;
+            break;
+        }
+
+        offset += entry.size;
+    }
+
+    if(!complete) {
+        log::warn("Index file is truncated or corrupted at {}: {}", offset, path);
+    }
+
+    blobs.clear();
+
+    for(auto& [srcPath, record]: headerRecords) {
+        binary::Proxy<memory::HeaderRecord> proxy{record.data, record.data};
+
+        auto header = new Header;
+        header->srcPath = srcPath;
+        header->fingerprint = proxy.get<"fingerprint">().value();
+
+        auto indices = proxy.get<"indices">();
+        header->indices.resize(indices.size());
+        for(std::uint32_t slot = 0; slot < indices.size(); ++slot) {
+            auto index = indices[slot];
+            auto& result = header->indices[slot];
+            result.path = index.get<"path">().as_string();
+            result.symbolHash = index.get<"symbolHash">();
+            result.featureHash = index.get<"featureHash">();
+
+            if(result.path.empty()) {
+                header->freeSlots.push_back(slot);
+                continue;
+            }
+
+            auto key = BlobStore::key(result.symbolHash, result.featureHash);
+            header->slots.try_emplace(key, slot);
+            blobs.acquire(key, /*written=*/true);
+        }
+
+        for(auto& inclusion: proxy.get<"inclusions">().as_array()) {
+            header->inclusions.try_emplace(inclusion.fingerprint, inclusion.key);
+        }
+
+        headers.try_emplace(srcPath, header);
+        recordSizes[header] = record.size;
+    }
+
+    for(auto& [srcPath, record]: unitRecords) {
+        binary::Proxy<memory::UnitRecord> proxy{record.data, record.data};
+
+        auto tu = new TranslationUnit{
+            .srcPath = srcPath.str(),
+            .indexPath = proxy.get<"indexPath">().as_string().str(),
+            .indexKey = proxy.get<"indexKey">(),
+            .fingerprint = proxy.get<"fingerprint">().value(),
+            .dirty = proxy.get<"dirty">(),
+            .storedLocations = proxy.get<"locations">().as_array(),
+        };
+        tus.try_emplace(srcPath, tu);
+        recordSizes[tu] = record.size;
+
+        if(!tu->indexPath.empty()) {
+            blobs.acquire(tu->indexKey, /*written=*/true);
+        }
+
+        auto contexts = proxy.get<"contexts">();
+        for(std::size_t i = 0; i < contexts.size(); ++i) {
+            auto context = contexts[i];
+            std::uint32_t name = context.get<"header">();
+            if(name >= pathPool.size()) {
+                continue;
+            }
+
+            Header* header = nullptr;
+            if(auto iter = headers.find(pathPool[name]); iter != headers.end()) {
+                header = iter->second;
+            } else {
+                header = new Header;
+                header->srcPath = pathPool[name];
+                headers.try_emplace(header->srcPath, header);
+                changedHeaders.insert(header);
+            }
+
+            auto list = context.get<"contexts">().as_array();
+            header->contexts[tu].assign(list.begin(), list.end());
+            tu->headers.insert(header);
+
+            /// The references of indices are not stored, count them from the contexts.
+            for(auto& element: list) {
+                if(element.index < header->indices.size()) {
+                    header->indices[element.index].references += 1;
+                }
+            }
+        }
+    }
+
+    storage = std::move(*file);
+    savedPaths = pathPool.size();
+    staleSize = stale;
+
+    /// A broken file is rewritten by the next save.
+    fileSize = complete ? content.size() : 0;
+
+    symbols.loadFromDisk(path::join(options.dir, "symbols.bin"));
+
+    log::info("Successfully loaded index from disk");
+}
+
+}  // namespace clice
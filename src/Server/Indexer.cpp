@@ -1,4 +1,4 @@
-#include <random>
+#include <thread>
 
 #include "Compiler/Compilation.h"
 #include "Index/SymbolIndex.h"
@@ -12,6 +12,148 @@
 
 namespace clice {
 
+namespace {
+
+std::int64_t toNanoseconds(llvm::sys::TimePoint<> time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+/// Refresh the fingerprint of the file on disk, return whether its content is changed.
+/// The content is only read and hashed if the mtime or size differs.
+bool refresh(llvm::StringRef path, Indexer::Fingerprint& fingerprint) {
+    llvm::sys::fs::file_status status;
+    if(llvm::sys::fs::status(path, status)) {
+        /// The file is removed.
+        fingerprint = {};
+        return true;
+    }
+
+    auto mtime = toNanoseconds(status.getLastModificationTime());
+    auto size = status.getSize();
+    if(mtime == fingerprint.mtime && size == fingerprint.size) {
+        return false;
+    }
+
+    auto buffer = llvm::MemoryBuffer::getFile(path,
+                                              /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if(!buffer) {
+        fingerprint = {};
+        return true;
+    }
+
+    auto hash = llvm::xxh3_64bits((*buffer)->getBuffer());
+    bool changed = size != fingerprint.size || hash != fingerprint.hash;
+    fingerprint = {mtime, size, hash};
+    return changed;
+}
+
+/// Fingerprint the main file and all included files of the AST, the contents are taken
+/// from the source manager rather than read again.
+llvm::DenseMap<clang::FileID, Indexer::Fingerprint> fingerprint(ASTInfo& info) {
+    auto& SM = info.srcMgr();
+    auto& vfs = SM.getFileManager().getVirtualFileSystem();
+
+    llvm::DenseMap<clang::FileID, Indexer::Fingerprint> fingerprints;
+    auto add = [&](clang::FileID fid) {
+        auto [iter, success] = fingerprints.try_emplace(fid);
+        if(!success) {
+            return;
+        }
+
+        auto& fingerprint = iter->second;
+        auto content = SM.getBufferData(fid);
+        fingerprint.size = content.size();
+        fingerprint.hash = llvm::xxh3_64bits(content);
+        if(auto entry = SM.getFileEntryRefForID(fid)) {
+            if(auto status = vfs.status(entry->getName())) {
+                fingerprint.mtime = toNanoseconds(status->getLastModificationTime());
+            }
+        }
+    };
+
+    add(SM.getMainFileID());
+    for(auto& [fid, directive]: info.directives()) {
+        for(auto& include: directive.includes) {
+            if(include.fid.isValid()) {
+                add(include.fid);
+            }
+        }
+    }
+    return fingerprints;
+}
+
+/// Fingerprint each inclusion of headers, i.e. the content of the header and the state of
+/// macros influencing it: the values of its conditional directives and the definitions of
+/// macros used in it but defined elsewhere. Inclusions with the same fingerprint are
+/// expected to have the same index.
+llvm::DenseMap<clang::FileID, std::uint64_t>
+    inclusions(ASTInfo& info,
+               const llvm::DenseMap<clang::FileID, Indexer::Fingerprint>& fingerprints) {
+    auto& SM = info.srcMgr();
+    auto& PP = info.pp();
+    auto& directives = info.directives();
+
+    llvm::DenseMap<clang::FileID, std::uint64_t> inclusions;
+    for(auto& [fid, fingerprint]: fingerprints) {
+        if(fid == SM.getMainFileID()) {
+            continue;
+        }
+
+        llvm::SmallString<256> state;
+        state += llvm::StringRef(reinterpret_cast<const char*>(&fingerprint.hash),
+                                 sizeof(fingerprint.hash));
+
+        if(auto iter = directives.find(fid); iter != directives.end()) {
+            for(auto& condition: iter->second.conditions) {
+                state += char(condition.kind);
+                state += char(condition.value);
+            }
+
+            for(auto& macro: iter->second.macros) {
+                if(macro.kind == MacroRef::Def ||
+                   SM.getFileID(macro.macro->getDefinitionLoc()) == fid) {
+                    continue;
+                }
+
+                for(auto param: macro.macro->params()) {
+                    state += param->getName();
+                    state += ',';
+                }
+
+                state += macro.macro->isFunctionLike() ? '(' : ' ';
+                for(auto& token: macro.macro->tokens()) {
+                    state += PP.getSpelling(token);
+                    state += ' ';
+                }
+                state += '\n';
+            }
+        }
+
+        inclusions.try_emplace(fid, llvm::xxh3_64bits(state));
+    }
+    return inclusions;
+}
+
+/// Write the file through a temporary file and rename it, so that readers never see a
+/// partially written file.
+async::Task<bool> writeFile(std::string path, char* data, std::size_t size) {
+    auto temp = path + ".tmp";
+    if(auto result = co_await async::fs::write(temp, data, size); !result) {
+        log::warn("Failed to write {}, because {}", temp, result.error().message());
+        co_return false;
+    }
+
+    if(auto result = co_await async::fs::rename(temp, path); !result) {
+        log::warn("Failed to rename {}, because {}", temp, result.error().message());
+        co_return false;
+    }
+
+    co_return true;
+}
+
+}  // namespace
+
 Indexer::~Indexer() {
     for(auto& [_, header]: headers) {
         delete header;
@@ -35,24 +177,72 @@ async::Task<Indexer::TranslationUnit*> Indexer::check(this Self& self, llvm::Str
 
     auto tu = iter->second;
 
-    async::Lock lock(self.locked);
-    co_await lock;
+    auto guard = co_await self.mutex.lock();
 
-    /// Otherwise, we need to check whether the file needs to be updated.
-    auto stats = co_await async::fs::stat(tu->srcPath);
-    if(stats.has_value() && stats->mtime > tu->mtime) {
+    /// The unit may be already marked by a changed header.
+    if(tu->dirty) {
         co_return tu;
     }
 
+    /// Otherwise, we need to check whether the file needs to be updated.
+    std::vector<std::string> files = {tu->srcPath};
     for(auto header: tu->headers) {
-        auto stats = co_await async::fs::stat(header->srcPath);
-        if(stats.has_value() && stats->mtime > tu->mtime) {
-            co_return tu;
-        }
+        files.emplace_back(header->srcPath);
     }
+    co_await self.refresh(std::move(files));
 
     /// If no need to update, just return nullptr.
-    co_return nullptr;
+    co_return tu->dirty ? tu : nullptr;
+}
+
+async::Task<> Indexer::refresh(this Self& self, std::vector<std::string> files) {
+    std::vector<Fingerprint> fingerprints;
+    fingerprints.reserve(files.size());
+    for(auto& file: files) {
+        if(auto iter = self.tus.find(file); iter != self.tus.end()) {
+            fingerprints.emplace_back(iter->second->fingerprint);
+        } else if(auto iter = self.headers.find(file); iter != self.headers.end()) {
+            fingerprints.emplace_back(iter->second->fingerprint);
+        } else {
+            fingerprints.emplace_back();
+        }
+    }
+
+    auto changed = co_await async::submit([&] {
+        std::vector<char> changed(files.size());
+        for(std::size_t i = 0; i < files.size(); ++i) {
+            changed[i] = clice::refresh(files[i], fingerprints[i]);
+        }
+        return changed;
+    });
+
+    for(std::size_t i = 0; i < files.size(); ++i) {
+        if(auto iter = self.tus.find(files[i]); iter != self.tus.end()) {
+            auto tu = iter->second;
+            if(tu->fingerprint != fingerprints[i]) {
+                tu->fingerprint = fingerprints[i];
+                self.changedUnits.insert(tu);
+            }
+
+            if(changed[i]) {
+                self.markDirty(tu);
+            }
+        }
+
+        if(auto iter = self.headers.find(files[i]); iter != self.headers.end()) {
+            auto header = iter->second;
+            if(header->fingerprint != fingerprints[i]) {
+                header->fingerprint = fingerprints[i];
+                self.changedHeaders.insert(header);
+            }
+
+            if(changed[i]) {
+                for(auto& [tu, _]: header->contexts) {
+                    self.markDirty(tu);
+                }
+            }
+        }
+    }
 }
 
 uint32_t Indexer::addIncludeChain(std::vector<Indexer::IncludeLocation>& locations,
@@ -72,6 +262,9 @@ uint32_t Indexer::addIncludeChain(std::vector<Indexer::IncludeLocation>& locatio
     {
         auto path = path::real_path(entry->getName());
         auto [iter, success] = pathIndices.try_emplace(path, pathPool.size());
+        if(success) {
+            pathPool.emplace_back(std::move(path));
+        }
         locations[index].filename = iter->second;
     }
 
@@ -84,12 +277,40 @@ uint32_t Indexer::addIncludeChain(std::vector<Indexer::IncludeLocation>& locatio
     return index;
 }
 
-void Indexer::addContexts(this Self& self,
-                          ASTInfo& info,
-                          TranslationUnit* tu,
-                          llvm::DenseMap<clang::FileID, uint32_t>& files) {
+std::vector<Indexer::IndexSlot>
+    Indexer::addContexts(this Self& self,
+                         ASTInfo& info,
+                         TranslationUnit* tu,
+                         llvm::DenseMap<clang::FileID, uint32_t>& files,
+                         const llvm::DenseMap<clang::FileID, Fingerprint>& fingerprints) {
     auto& SM = info.srcMgr();
 
+    /// The include graph of the last index is replaced, so the contexts of headers no
+    /// longer included do not keep the unit in the reverse graph.
+    std::vector<IndexSlot> unused;
+    for(auto header: tu->headers) {
+        auto iter = header->contexts.find(tu);
+        if(iter == header->contexts.end()) {
+            continue;
+        }
+
+        for(auto& context: iter->second) {
+            if(context.index >= header->indices.size()) {
+                continue;
+            }
+
+            auto& index = header->indices[context.index];
+            assert(index.references != 0 && "Index is not referenced");
+            index.references -= 1;
+            if(index.references == 0) {
+                unused.emplace_back(header, context.index);
+            }
+        }
+
+        header->contexts.erase(iter);
+    }
+    tu->headers.clear();
+
     std::vector<IncludeLocation> locations;
 
     for(auto& [fid, directive]: info.directives()) {
@@ -107,9 +328,10 @@ void Indexer::addContexts(this Self& self,
     }
 
     /// Update the translation unit.
-    tu->mtime = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch());
+    tu->fingerprint = fingerprints.lookup(SM.getMainFileID());
+    tu->dirty = false;
     tu->locations = std::move(locations);
+    tu->storedLocations = {};
 
     /// Update the header context.
     for(auto& [fid, include]: files) {
@@ -128,43 +350,126 @@ void Indexer::addContexts(this Self& self,
             header = new Header;
             header->srcPath = name;
             self.headers.try_emplace(name, header);
+            self.changedHeaders.insert(header);
+        }
+
+        /// The header is changed since it is last seen, other units including it are
+        /// outdated as well.
+        auto fingerprint = fingerprints.lookup(fid);
+        if(fingerprint.size != header->fingerprint.size ||
+           fingerprint.hash != header->fingerprint.hash) {
+            for(auto& [other, _]: header->contexts) {
+                self.markDirty(other);
+            }
+        }
+
+        if(header->fingerprint != fingerprint) {
+            header->fingerprint = fingerprint;
+            self.changedHeaders.insert(header);
         }
+        tu->headers.insert(header);
 
         /// Add new header context.
-        auto contexts = header->contexts[tu];
+        auto& contexts = header->contexts[tu];
         auto iter = ranges::find_if(contexts, [&](const Context& context) {
             return context.include == include;
         });
 
         if(iter == contexts.end()) {
-            header->contexts[tu].emplace_back(Context{
+            contexts.emplace_back(Context{
                 .include = include,
             });
         }
     }
+
+    return unused;
+}
+
+std::optional<Indexer::HeaderContext> Indexer::context(llvm::StringRef header) {
+    auto iter = headers.find(header);
+    if(iter == headers.end()) {
+        return std::nullopt;
+    }
+
+    constexpr std::uint32_t invalid = -1;
+    for(auto& [tu, contexts]: iter->second->contexts) {
+        auto& locations = this->locations(tu);
+        for(auto& context: contexts) {
+            if(context.include >= locations.size()) {
+                continue;
+            }
+
+            /// Walk up the include chain until the directive in the main file, the
+            /// location of main file does not have an includer.
+            auto* location = &locations[context.include];
+            while(location->include != invalid && locations[location->include].include != invalid) {
+                location = &locations[location->include];
+            }
+
+            if(location->include != invalid) {
+                return HeaderContext{tu->srcPath, location->line};
+            }
+        }
+    }
+
+    return std::nullopt;
 }
 
 async::Task<> Indexer::updateIndices(this Self& self,
                                      ASTInfo& info,
                                      TranslationUnit* tu,
-                                     llvm::DenseMap<clang::FileID, uint32_t>& files) {
+                                     llvm::DenseMap<clang::FileID, uint32_t>& files,
+                                     const llvm::DenseMap<clang::FileID, std::uint64_t>& inclusions,
+                                     llvm::ArrayRef<IndexSlot> unused) {
     struct Index {
         llvm::XXH128_hash_t symbolHash = {0, 0};
         std::optional<index::SymbolIndex> symbol;
 
+        /// All symbol ids mentioned in the symbol index.
+        std::vector<uint64_t> symbolIDs;
+
         llvm::XXH128_hash_t featureHash = {0, 0};
         std::optional<index::FeatureIndex> feature;
     };
 
-    auto indices = co_await async::submit([&info] {
+    /// The header and its context of the file in this unit.
+    auto locate = [&](clang::FileID fid) -> std::pair<Header*, Context*> {
+        auto include = files[fid];
+        auto header = self.headers.lookup(self.pathPool[tu->locations[include].filename]);
+        assert(header && "Invalid header name");
+
+        auto& contexts = header->contexts[tu];
+        auto iter = ranges::find_if(contexts, [&](const Context& context) {
+            return context.include == include;
+        });
+        assert(iter != contexts.end() && "Invalid include index");
+        return {header, &*iter};
+    };
+
+    /// Inclusions of headers with a known index are not indexed again, their decls are not
+    /// even traversed. It is most of the work, since most of the included files are the
+    /// headers of the standard library.
+    llvm::DenseMap<clang::FileID, std::uint64_t> known;
+    llvm::DenseSet<clang::FileID> skipped;
+    for(auto& [fid, inclusion]: inclusions) {
+        auto header = locate(fid).first;
+        if(auto iter = header->inclusions.find(inclusion); iter != header->inclusions.end()) {
+            if(header->slots.contains(iter->second)) {
+                known.try_emplace(fid, iter->second);
+                skipped.insert(fid);
+            }
+        }
+    }
+
+    auto indices = co_await async::submit([&info, &skipped] {
         llvm::DenseMap<clang::FileID, Index> indices;
 
-        auto symbolIndices = index::index(info);
+        auto symbolIndices = index::index(info, skipped);
         for(auto& [fid, index]: symbolIndices) {
             indices[fid].symbol.emplace(std::move(index));
         }
 
-        auto featureIndices = index::indexFeature(info);
+        auto featureIndices = index::indexFeature(info, skipped);
         for(auto& [fid, index]: featureIndices) {
             indices[fid].feature.emplace(std::move(index));
         }
@@ -174,6 +479,10 @@ async::Task<> Indexer::updateIndices(this Self& self,
                 auto data = llvm::ArrayRef<uint8_t>(reinterpret_cast<uint8_t*>(index.symbol->base),
                                                     index.symbol->size);
                 index.symbolHash = llvm::xxh3_128bits(data);
+
+                for(auto symbol: index.symbol->symbols()) {
+                    index.symbolIDs.emplace_back(symbol.id());
+                }
             }
 
             if(index.feature) {
@@ -186,74 +495,115 @@ async::Task<> Indexer::updateIndices(this Self& self,
         return indices;
     });
 
-    async::Lock lock(self.locked);
-    co_await lock;
-
-    auto& SM = info.srcMgr();
-
+    /// Write the index files if they are not in the blob store yet, without the lock, so
+    /// workers write in parallel. Each index is referenced here, so it is not collected
+    /// before it is recorded below. The content of a file in the store never changes, so
+    /// cached buffers of index files are never stale.
+    llvm::SmallVector<clang::FileID> failed;
     for(auto& [fid, index]: indices) {
-        if(fid == SM.getMainFileID()) {
-            if(tu->indexPath.empty()) {
-                tu->indexPath = self.getIndexPath(tu->srcPath);
-            }
+        auto key = BlobStore::key(index.symbolHash, index.featureHash);
+        self.blobs.acquire(key);
 
+        auto write = [&self, &index](std::string path) -> async::Task<bool> {
             if(index.symbol) {
-                co_await async::fs::write(tu->indexPath + ".sidx",
-                                          index.symbol->base,
-                                          index.symbol->size);
+                if(!co_await writeFile(path + ".sidx", index.symbol->base, index.symbol->size)) {
+                    co_return false;
+                }
+                self.written += index.symbol->size;
             }
 
             if(index.feature) {
-                co_await async::fs::write(tu->indexPath + ".fidx",
-                                          index.feature->base,
-                                          index.feature->size);
+                if(!co_await writeFile(path + ".fidx",
+                                       index.feature->base,
+                                       index.feature->size)) {
+                    co_return false;
+                }
+                self.written += index.feature->size;
             }
+            co_return true;
+        };
 
-            continue;
+        if(!co_await self.blobs.ensure(key, std::move(write))) {
+            self.blobs.release(key);
+            failed.emplace_back(fid);
         }
+    }
 
-        auto entry = SM.getFileEntryRefForID(fid);
-        if(!entry) {
-            log::info("Invalid file entry for file id: {}", fid.getHashValue());
-        }
-        assert(entry && "Invalid file entry");
+    auto guard = co_await self.mutex.lock();
 
-        auto name = path::real_path(entry->getName());
-        assert(self.headers.contains(name) && "Invalid header name");
+    /// The unit is indexed again later if any index is not written.
+    for(auto fid: failed) {
+        indices.erase(fid);
+        self.markDirty(tu);
+    }
 
-        auto header = self.headers[name];
+    auto& SM = info.srcMgr();
 
-        auto include = files[fid];
-        auto iter = ranges::find_if(header->contexts[tu], [&](const Context& context) {
-            return context.include == include;
-        });
-        assert(iter != header->contexts[tu].end() && "Invalid include index");
+    for(auto& [fid, index]: indices) {
+        auto key = BlobStore::key(index.symbolHash, index.featureHash);
 
-        /// Found whether the we already have the same index. If so, use it directly.
-        /// Otherwise, we need to create a new index.
+        if(fid == SM.getMainFileID()) {
+            /// The source is rewritten, drop the stale buffer.
+            self.cache.invalidate(tu->srcPath);
 
-        auto& indices = header->indices;
+            if(!tu->indexPath.empty() && tu->indexKey == key) {
+                self.blobs.release(key);
+                continue;
+            }
 
-        bool existed = false;
-        for(std::size_t i = 0; i < indices.size(); ++i) {
-            auto& element = indices[i];
-            if(index.symbolHash == element.symbolHash && index.featureHash == element.featureHash) {
-                existed = true;
-                iter->index = i;
-                break;
+            /// The reference taken above is kept by the unit.
+            if(!tu->indexPath.empty()) {
+                self.symbols.remove(tu->indexPath, tu->srcPath);
+                self.blobs.release(tu->indexKey);
+            }
+
+            tu->indexPath = self.blobs.path(key);
+            tu->indexKey = key;
+            self.symbols.update(tu->indexPath, tu->srcPath, index.symbolIDs);
+            continue;
+        }
+
+        auto [header, iter] = locate(fid);
+        if(auto inclusion = inclusions.find(fid); inclusion != inclusions.end()) {
+            auto& recorded = header->inclusions[inclusion->second];
+            if(recorded != key) {
+                recorded = key;
+                self.changedHeaders.insert(header);
             }
         }
 
-        if(existed) {
+        /// Found whether the we already have the same index. If so, use it directly.
+        /// Otherwise, we need to create a new index.
+        if(auto found = header->slots.find(key); found != header->slots.end()) {
+            iter->index = found->second;
+            header->indices[found->second].references += 1;
+            self.blobs.release(key);
             continue;
         }
 
-        iter->index = static_cast<uint32_t>(indices.size());
-        indices.emplace_back(HeaderIndex{
-            .path = self.getIndexPath(name),
+        /// A new index means the header content may be changed. Index files in the blob
+        /// store are never rewritten, so only the source buffer need to be dropped.
+        self.cache.invalidate(header->srcPath);
+
+        std::uint32_t slot;
+        if(!header->freeSlots.empty()) {
+            slot = header->freeSlots.back();
+            header->freeSlots.pop_back();
+        } else {
+            slot = header->indices.size();
+            header->indices.emplace_back();
+        }
+
+        auto path = self.blobs.path(key);
+        header->indices[slot] = HeaderIndex{
+            .path = path,
             .symbolHash = index.symbolHash,
             .featureHash = index.featureHash,
-        });
+            .references = 1,
+        };
+        header->slots.try_emplace(key, slot);
+        iter->index = slot;
+        self.changedHeaders.insert(header);
 
         // if(header->srcPath == "/home/ykiko/C++/clice/include/Support/JSON.h") {
         //     if(index.symbol) {
@@ -273,18 +623,62 @@ async::Task<> Indexer::updateIndices(this Self& self,
         //    // }
         //}
 
-        if(index.symbol) {
-            co_await async::fs::write(indices.back().path + ".sidx",
-                                      index.symbol->base,
-                                      index.symbol->size);
+        /// The reference taken above is kept by the slot.
+        self.symbols.update(path, header->srcPath, index.symbolIDs);
+    }
+
+    for(auto& [fid, key]: known) {
+        auto [header, context] = locate(fid);
+        if(auto found = header->slots.find(key); found != header->slots.end()) {
+            context->index = found->second;
+            header->indices[found->second].references += 1;
+        } else {
+            /// The index is dropped while indexing, index the unit again later.
+            self.markDirty(tu);
         }
+    }
+
+    /// Drop the indices only used by the last index of this unit and not reused.
+    for(auto [header, slot]: unused) {
+        if(header->indices[slot].references == 0 && !header->indices[slot].path.empty()) {
+            self.dropIndex(header, slot);
+        }
+    }
+}
 
-        if(index.feature) {
-            co_await async::fs::write(indices.back().path + ".fidx",
-                                      index.feature->base,
-                                      index.feature->size);
+void Indexer::dropIndex(Header* header, std::uint32_t slot) {
+    auto& index = header->indices[slot];
+    auto key = BlobStore::key(index.symbolHash, index.featureHash);
+    header->slots.erase(key);
+    header->freeSlots.push_back(slot);
+    changedHeaders.insert(header);
+
+    for(auto iter = header->inclusions.begin(); iter != header->inclusions.end();) {
+        auto current = iter++;
+        if(current->second == key) {
+            header->inclusions.erase(current);
         }
     }
+
+    symbols.remove(index.path, header->srcPath);
+    blobs.release(key);
+    index = HeaderIndex{};
+}
+
+async::Task<> Indexer::collect(this Self& self) {
+    /// The store keeps the indices being removed from being acquired and written.
+    auto count = co_await self.blobs.collect([](std::vector<std::string> paths) -> async::Task<> {
+        co_await async::submit([&paths] {
+            for(auto& path: paths) {
+                llvm::sys::fs::remove(path + ".sidx");
+                llvm::sys::fs::remove(path + ".fidx");
+            }
+        });
+    });
+
+    if(count != 0) {
+        log::info("Removed {} unused index files", count);
+    }
 }
 
 async::Task<> Indexer::index(this Self& self, llvm::StringRef file) {
@@ -305,6 +699,7 @@ async::Task<> Indexer::index(this Self& self, llvm::StringRef file) {
 
     CompilationParams params;
     params.command = command;
+    params.vfs = self.vfs;
 
     auto info = co_await async::submit([&params] { return compile(params); });
     if(!info) {
@@ -312,60 +707,211 @@ async::Task<> Indexer::index(this Self& self, llvm::StringRef file) {
         co_return;
     }
 
+    /// Fingerprint the files in the thread pool, their contents are already in memory.
+    auto [fingerprints, inclusions] = co_await async::submit([&info] {
+        auto fingerprints = fingerprint(*info);
+        auto result = clice::inclusions(*info, fingerprints);
+        return std::pair(std::move(fingerprints), std::move(result));
+    });
+
     llvm::DenseMap<clang::FileID, uint32_t> files;
 
     /// Otherwise, we need to update all header contexts.
-    self.addContexts(*info, tu, files);
+    auto unused = self.addContexts(*info, tu, files, fingerprints);
 
-    co_await self.updateIndices(*info, tu, files);
+    co_await self.updateIndices(*info, tu, files, inclusions, unused);
+    self.changedUnits.insert(tu);
+    self.indexed += 1;
 }
 
 async::Task<> Indexer::index(llvm::StringRef file, ASTInfo& info) {
     co_return;
 }
 
-async::Task<> Indexer::indexAll() {
-    auto total = database.size();
-    auto count = 0;
-
-    auto each = [&](llvm::StringRef file) -> async::Task<> {
-        count += 1;
-        log::info("Indexing process: {}/{}, file: {}", count, total, file);
-        co_await index(file);
+async::Task<Indexer::Report> Indexer::indexAll(Progress progress) {
+    struct Entry {
+        std::uint32_t klass;
+        llvm::StringRef include;
+        llvm::StringRef file;
     };
 
-    auto iter = database.begin();
-    auto end = database.end();
+    std::vector<Entry> entries;
+    entries.reserve(database.size());
+    for(auto& entry: database) {
+        llvm::StringRef file = entry.first();
+        llvm::StringRef include;
+        if(auto iter = tus.find(file); iter != tus.end()) {
+            include = firstInclude(iter->second);
+        }
+        entries.emplace_back(database.getCommandClass(file), include, file);
+    }
+
+    /// Files with the same command class and the same first include likely share the
+    /// same preamble, then files in the same directory likely include similar headers.
+    ranges::sort(entries, [](const Entry& lhs, const Entry& rhs) {
+        return std::tuple(lhs.klass, lhs.include, path::parent_path(lhs.file), lhs.file) <
+               std::tuple(rhs.klass, rhs.include, path::parent_path(rhs.file), rhs.file);
+    });
 
-    std::vector<async::Task<>> tasks;
-    /// TODO: Use threads count in the future.
-    tasks.resize(20);
+    std::vector<std::string> files;
+    files.reserve(entries.size());
+    for(auto& entry: entries) {
+        files.emplace_back(entry.file);
+    }
 
     log::info("Start indexing all files");
+    co_return co_await indexFiles(files, progress);
+}
 
-    while(iter != end ||
-          ranges::any_of(tasks, [](auto& task) { return !task.empty() && !task.done(); })) {
-        for(auto& task: tasks) {
-            if(task.empty() || task.done()) {
-                if(iter != end) {
-                    task = each(iter->first());
-                    async::schedule(task.handle());
-                    ++iter;
-                }
+async::Task<std::vector<std::string>>
+    Indexer::outdated(this Self& self,
+                      std::vector<std::string> files,
+                      llvm::function_ref<bool(llvm::StringRef)> opened) {
+    /// Only files known by the index could make units dirty.
+    std::erase_if(files, [&](const std::string& file) {
+        return !self.tus.contains(file) && !self.headers.contains(file);
+    });
+
+    if(!files.empty()) {
+        auto guard = co_await self.mutex.lock();
+        co_await self.refresh(std::move(files));
+    }
+
+    /// Units of opened files first, then units including opened headers.
+    std::vector<std::pair<std::uint32_t, std::string>> dirty;
+    for(auto& [_, tu]: self.tus) {
+        if(!tu->dirty) {
+            continue;
+        }
+
+        std::uint32_t priority = 2;
+        if(opened(tu->srcPath)) {
+            priority = 0;
+        } else if(ranges::any_of(tu->headers, [&](Header* h) { return opened(h->srcPath); })) {
+            priority = 1;
+        }
+        dirty.emplace_back(priority, tu->srcPath);
+    }
+    ranges::sort(dirty);
+
+    std::vector<std::string> queue;
+    queue.reserve(dirty.size());
+    for(auto& [_, file]: dirty) {
+        queue.emplace_back(std::move(file));
+    }
+    co_return queue;
+}
+
+async::Task<> Indexer::update(this Self& self,
+                              std::vector<std::string> files,
+                              llvm::function_ref<bool(llvm::StringRef)> opened) {
+    auto queue = co_await self.outdated(std::move(files), opened);
+    if(!queue.empty()) {
+        log::info("{} translation units are outdated, reindex them", queue.size());
+        co_await self.indexFiles(queue);
+    }
+}
+
+async::Task<Indexer::Report> Indexer::indexFiles(llvm::ArrayRef<std::string> files,
+                                                Progress progress) {
+    Report report;
+    report.files = files.size();
+    if(files.empty()) {
+        co_return report;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    auto indexed = this->indexed;
+    auto written = this->written;
+
+    std::size_t concurrency = options.concurrency;
+    if(concurrency == 0) {
+        concurrency = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    concurrency = std::min(concurrency, files.size());
+
+    std::size_t next = 0;
+    std::size_t done = 0;
+    std::size_t running = concurrency;
+    async::Event finished;
+
+    /// Each worker takes the next file until all files are taken.
+    auto worker = [&]() -> async::Task<> {
+        while(true) {
+            co_await waitResumed();
+            if(next == files.size()) {
+                break;
+            }
+
+            auto& file = files[next++];
+            co_await index(file);
+
+            done += 1;
+            if(progress) {
+                progress(done, files.size());
             }
         }
 
-        co_await async::suspend([&](auto handle) { async::schedule(handle); });
+        running -= 1;
+        if(running == 0) {
+            finished.set();
+        }
+    };
+
+    std::vector<async::Task<>> workers;
+    for(std::size_t i = 0; i < concurrency; ++i) {
+        workers.emplace_back(worker());
+        async::schedule(workers.back().handle());
     }
+
+    co_await finished.wait();
+    co_await collect();
+
+    report.indexed = this->indexed - indexed;
+    report.written = this->written - written;
+    report.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - begin);
+    co_return report;
 }
 
-std::string Indexer::getIndexPath(llvm::StringRef file) {
-    auto now = std::chrono::system_clock::now();
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 1000);
-    return path::join(options.dir, path::filename(file) + "." + llvm::Twine(ms + dis(gen)));
+async::Task<> Indexer::waitResumed() {
+    while(true) {
+        if(!resumed.isSet()) {
+            paused += 1;
+            co_await resumed.wait();
+            paused -= 1;
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(now >= pausedUntil) {
+            co_return;
+        }
+
+        co_await async::sleep(std::chrono::ceil<std::chrono::milliseconds>(pausedUntil - now));
+    }
+}
+
+llvm::StringRef Indexer::firstInclude(TranslationUnit* tu) {
+    constexpr std::uint32_t invalid = -1;
+    auto& locations = this->locations(tu);
+
+    /// The location of the main file does not have an includer.
+    auto main = ranges::find_if(locations, [&](const IncludeLocation& location) {
+        return location.include == invalid && pathPool[location.filename] == tu->srcPath;
+    });
+    if(main == locations.end()) {
+        return "";
+    }
+
+    std::uint32_t mainIndex = main - locations.begin();
+    const IncludeLocation* first = nullptr;
+    for(auto& location: locations) {
+        if(location.include == mainIndex && (!first || location.line < first->line)) {
+            first = &location;
+        }
+    }
+    return first ? llvm::StringRef(pathPool[first->filename]) : "";
 }
 
 json::Value Indexer::dumpToJSON() {
@@ -380,19 +926,22 @@ json::Value Indexer::dumpToJSON() {
         }
 
         headers.emplace_back(json::Object{
-            {"srcPath",  header->srcPath                 },
-            {"contexts", std::move(contexts)             },
-            {"indices",  json::serialize(header->indices)},
+            {"srcPath",     header->srcPath                     },
+            {"contexts",    std::move(contexts)                 },
+            {"indices",     json::serialize(header->indices)    },
+            {"fingerprint", json::serialize(header->fingerprint)},
         });
     }
 
     json::Array tus;
     for(auto& [_, tu]: this->tus) {
         tus.emplace_back(json::Object{
-            {"srcPath",   tu->srcPath                   },
-            {"indexPath", tu->indexPath                 },
-            {"mtime",     tu->mtime.count()             },
-            {"locations", json::serialize(tu->locations)},
+            {"srcPath",     tu->srcPath                     },
+            {"indexPath",   tu->indexPath                   },
+            {"indexKey",    json::serialize(tu->indexKey)   },
+            {"fingerprint", json::serialize(tu->fingerprint)},
+            {"dirty",       tu->dirty                       },
+            {"locations",   json::serialize(locations(tu))  },
         });
     }
 
@@ -416,7 +965,7 @@ async::Task<proto::SemanticTokens> Indexer::semanticTokens(llvm::StringRef file)
         co_return proto::SemanticTokens{};
     }
 
-    auto content = co_await read(file);
+    auto lines = co_await this->lines(file);
     auto buffer = co_await read(indexPath + ".fidx");
 
     index::FeatureIndex index(const_cast<char*>(buffer->getBufferStart()),
@@ -424,10 +973,7 @@ async::Task<proto::SemanticTokens> Indexer::semanticTokens(llvm::StringRef file)
                               false);
 
     SourceConverter converter;
-    co_return feature::toSemanticTokens(index.semanticTokens(),
-                                        converter,
-                                        content->getBuffer(),
-                                        {});
+    co_return feature::toSemanticTokens(index.semanticTokens(), converter, *lines, {});
 }
 
 void Indexer::dumpForTest(llvm::StringRef file) {
@@ -448,97 +994,56 @@ void Indexer::dumpForTest(llvm::StringRef file) {
     }
 }
 
-void Indexer::saveToDisk() {
-    auto path = path::join(options.dir, "index.json");
-    std::error_code ec;
-    llvm::raw_fd_ostream os(path, ec);
-    if(ec) {
-        log::warn("Failed to open index file: {} Beacuse {}", path, ec.message());
-        return;
+async::Task<std::shared_ptr<llvm::MemoryBuffer>> Indexer::read(llvm::StringRef path,
+                                                               bool isVolatile) {
+    if(auto buffer = cache.get(path)) {
+        co_return buffer;
     }
 
-    os << dumpToJSON();
+    auto buffer = co_await async::submit(async::Priority::Interactive, [path, isVolatile] {
+        /// Do not require null terminator, so that large files could be mapped into memory.
+        auto file = llvm::MemoryBuffer::getFile(path,
+                                                /*IsText=*/false,
+                                                /*RequiresNullTerminator=*/false,
+                                                isVolatile);
+        ASSERT(file, "Failed to open file: {}, because: {}", path, file.getError());
+        return std::move(file.get());
+    });
 
-    if(os.has_error()) {
-        log::warn("Failed to write index file: {}", os.error().message());
-    } else {
-        log::info("Successfully saved index to disk");
-    }
+    co_return cache.put(path, std::move(buffer));
 }
 
-void Indexer::loadFromDisk() {
-    auto path = path::join(options.dir, "index.json");
-    auto file = llvm::MemoryBuffer::getFile(path);
-    if(!file) {
-        log::warn("Failed to open index file: {} Beacuse {}", path, file.getError());
-        return;
-    }
-
-    auto json = json::parse(file.get()->getBuffer());
-    ASSERT(json, "Failed to parse index file: {}", path);
-
-    for(auto& value: *json->getAsObject()->getArray("tus")) {
-        auto object = value.getAsObject();
-        auto tu = new TranslationUnit{
-            .srcPath = object->getString("srcPath")->str(),
-            .indexPath = object->getString("indexPath")->str(),
-            .mtime = std::chrono::milliseconds(*object->getInteger("mtime")),
-            .locations = json::deserialize<std::vector<IncludeLocation>>(*object->get("locations")),
-        };
-        tus.try_emplace(tu->srcPath, tu);
-    }
-
-    /// All headers must be already initialized.
-    for(auto& value: *json->getAsObject()->getArray("headers")) {
-        auto object = value.getAsObject();
-        llvm::StringRef srcPath = *object->getString("srcPath");
-
-        Header* header = nullptr;
-        if(auto iter = headers.find(srcPath); iter != headers.end()) {
-            header = iter->second;
-        } else {
-            header = new Header;
-            header->srcPath = srcPath;
-            headers.try_emplace(srcPath, header);
-        }
-
-        header->indices = json::deserialize<std::vector<HeaderIndex>>(*object->get("indices"));
-
-        for(auto& value: *object->getArray("contexts")) {
-            auto object = value.getAsObject();
-            auto tu = tus[*object->getString("tu")];
-            header->contexts[tu] =
-                json::deserialize<std::vector<Context>>(*object->get("contexts"));
-            tu->headers.insert(header);
-        }
+async::Task<std::shared_ptr<const LineTable>> Indexer::lines(llvm::StringRef path) {
+    /// The source file may be rewritten by the editor while the buffer is used.
+    auto buffer = co_await read(path, /*isVolatile=*/true);
+    if(auto table = cache.getLines(path)) {
+        co_return table;
     }
 
-    log::info("Successfully loaded index from disk");
-
-    return;
-}
+    struct Holder {
+        std::shared_ptr<llvm::MemoryBuffer> buffer;
+        LineTable lines;
+    };
 
-async::Task<std::unique_ptr<llvm::MemoryBuffer>> Indexer::read(llvm::StringRef path) {
-    co_return co_await async::submit([path] {
-        auto file = llvm::MemoryBuffer::getFile(path);
-        ASSERT(file, "Failed to open file: {}, because: {}", path, file.getError());
-        return std::move(file.get());
+    auto holder = co_await async::submit(async::Priority::Interactive, [buffer] {
+        return std::make_shared<Holder>(Holder{buffer, LineTable(buffer->getBuffer())});
     });
+
+    /// Share the ownership with the holder, so the content outlives the table.
+    std::shared_ptr<const LineTable> table(holder, &holder->lines);
+    cache.putLines(path, buffer.get(), table);
+    co_return table;
 }
 
 async::Task<> Indexer::lookup(llvm::ArrayRef<Indexer::SymbolID> ids,
                               RelationKind kind,
                               llvm::StringRef srcPath,
-                              llvm::StringRef content,
+                              const LineTable& lines,
                               std::string indexPath,
                               std::vector<proto::Location>& result) {
-    auto indexFile = llvm::MemoryBuffer::getFile(indexPath);
-    ASSERT(indexFile,
-           "Failed to open index file: {}, Beacuse: {}",
-           indexPath,
-           indexFile.getError());
-    index::SymbolIndex index(const_cast<char*>(indexFile.get()->getBufferStart()),
-                             indexFile.get()->getBufferSize(),
+    auto indexFile = co_await read(indexPath);
+    index::SymbolIndex index(const_cast<char*>(indexFile->getBufferStart()),
+                             indexFile->getBufferSize(),
                              false);
 
     for(auto& id: ids) {
@@ -546,8 +1051,8 @@ async::Task<> Indexer::lookup(llvm::ArrayRef<Indexer::SymbolID> ids,
             for(auto relation: symbol->relations()) {
                 if(relation.kind() & kind) {
                     auto range = relation.range();
-                    auto begin = SourceConverter().toPosition(content, range->begin);
-                    auto end = SourceConverter().toPosition(content, range->end);
+                    auto begin = SourceConverter().toPosition(lines, range->begin);
+                    auto end = SourceConverter().toPosition(lines, range->end);
                     result.emplace_back(proto::Location{
                         .uri = SourceConverter::toURI(srcPath),
                         .range = proto::Range{.start = begin, .end = end},
@@ -563,7 +1068,8 @@ async::Task<> Indexer::lookup(llvm::ArrayRef<Indexer::SymbolID> ids,
 async::Task<std::vector<proto::Location>>
     Indexer::lookup(const proto::TextDocumentPositionParams& params, RelationKind kind) {
     auto srcPath = SourceConverter::toPath(params.textDocument.uri);
-    llvm::StringRef indexPathPrefix = "";
+    /// Copy the path, the unit may be indexed again while reading files.
+    std::string indexPathPrefix;
 
     if(auto iter = tus.find(srcPath); iter != tus.end()) {
         indexPathPrefix = iter->second->indexPath;
@@ -593,19 +1099,18 @@ async::Task<std::vector<proto::Location>>
     }
 
     proto::DefinitionResult result;
-    std::string indexPath = (indexPathPrefix + ".sidx").str();
+    std::string indexPath = indexPathPrefix + ".sidx";
 
     llvm::SmallVector<SymbolID, 4> ids;
 
     /// Lookup Target index first
     {
-        auto srcFile = co_await read(srcPath);
-        auto content = srcFile->getBuffer();
-        auto offset = SourceConverter().toOffset(content, params.position);
+        auto srcLines = co_await lines(srcPath);
+        auto offset = SourceConverter().toOffset(srcLines->content(), params.position);
 
         auto indexFile = co_await read(indexPath);
-        index::SymbolIndex index(const_cast<char*>(indexFile.get()->getBufferStart()),
-                                 indexFile.get()->getBufferSize(),
+        index::SymbolIndex index(const_cast<char*>(indexFile->getBufferStart()),
+                                 indexFile->getBufferSize(),
                                  false);
         llvm::SmallVector<index::SymbolIndex::Symbol> symbols;
         index.locateSymbols(offset, symbols);
@@ -616,8 +1121,8 @@ async::Task<std::vector<proto::Location>>
             for(auto relation: symbol.relations()) {
                 if(relation.kind() & kind) {
                     auto range = relation.range();
-                    auto begin = SourceConverter().toPosition(content, range->begin);
-                    auto end = SourceConverter().toPosition(content, range->end);
+                    auto begin = SourceConverter().toPosition(*srcLines, range->begin);
+                    auto end = SourceConverter().toPosition(*srcLines, range->end);
                     result.emplace_back(proto::Location{
                         .uri = SourceConverter::toURI(srcPath),
                         .range = proto::Range{.start = begin, .end = end},
@@ -627,39 +1132,30 @@ async::Task<std::vector<proto::Location>>
         }
     }
 
-    for(auto& [path, tu]: tus) {
-        if(path == srcPath || tu->indexPath.empty()) {
-            continue;
-        }
-
-        auto srcPath = path.str();
-        auto srcFile = co_await read(srcPath);
-        co_await lookup(ids, kind, srcPath, srcFile->getBuffer(), tu->indexPath + ".sidx", result);
+    /// Only open the index files which actually mention the symbols. Note that the
+    /// entries are copied out of the table, so it is safe to update the table while
+    /// we are waiting for reading files.
+    llvm::SmallVector<uint64_t, 4> symbolIDs;
+    for(auto& id: ids) {
+        symbolIDs.emplace_back(id.id);
     }
 
-    llvm::StringSet<> visited;
-    for(auto& [path, header]: headers) {
-        if(path == srcPath) {
+    for(auto& entry: symbols.lookup(symbolIDs)) {
+        /// The index file may be shared by other sources, only skip the target itself.
+        if(entry.indexPath == indexPathPrefix && entry.srcPath == srcPath) {
             continue;
         }
 
-        auto srcPath = path.str();
-        auto srcFile = co_await read(srcPath);
-        auto content = srcFile->getBuffer();
-
-        for(auto& [_, contexts]: header->contexts) {
-            // for(auto& context: contexts) {
-            //     if(context.indexPath.empty() || visited.contains(context.indexPath)) {
-            //         continue;
-            //     }
-            //
-            //    visited.insert(context.indexPath);
-            //    co_await lookup(ids, kind, srcPath, content, context.indexPath + ".sidx", result);
-            //}
-        }
+        auto srcLines = co_await lines(entry.srcPath);
+        co_await lookup(ids,
+                        kind,
+                        entry.srcPath,
+                        *srcLines,
+                        entry.indexPath + ".sidx",
+                        result);
     }
 
-    co_await async::submit([&] {
+    co_await async::submit(async::Priority::Interactive, [&] {
         ranges::sort(result, refl::less);
         auto [first, last] = ranges::unique(result, refl::equal);
         result.erase(first, last);
@@ -20,20 +20,27 @@ async::Task<> Server::onInitialize(json::Value id, const proto::InitializeParams
 
     };
 
-    co_await response(std::move(id), json::serialize(result));
+    result.capabilities.textDocumentSync = proto::TextDocumentSyncKind::Incremental;
+
+    co_await response(std::move(id), result);
 
     auto workplace = SourceConverter::toPath(params.workspaceFolders[0].uri);
     config::init(workplace);
 
-    for(auto& dir: config::server.compile_commands_dirs) {
-        llvm::SmallString<128> path = {dir};
-        path::append(path, "compile_commands.json");
-        database.updateCommands(path);
-    }
+    co_await database.loadCommands(config::server.compile_commands_dirs);
+    co_await database.scanModules();
+
+    scheduler.loadCache();
 }
 
 async::Task<> Server::onInitialized(const proto::InitializedParams& params) {
-    co_return;
+    /// The status and content of files on disk are cached by the overlay, so the changes
+    /// outside of the editor(e.g. git checkout) must be reported to invalidate them.
+    proto::DidChangeWatchedFilesRegistrationOptions options;
+    options.watchers.emplace_back("**/*.{c,cc,cpp,cxx,c++,cppm,ixx,h,hh,hpp,hxx,h++,inc,def}");
+    co_await registerCapacity("clice/didChangeWatchedFiles",
+                              "workspace/didChangeWatchedFiles",
+                              json::serialize(options));
 }
 
 async::Task<> Server::onExit(const proto::None&) {
@@ -41,6 +48,7 @@ async::Task<> Server::onExit(const proto::None&) {
 }
 
 async::Task<> Server::onShutdown(json::Value id, const proto::None&) {
+    scheduler.saveCache();
     co_return;
 }
 
@@ -0,0 +1,321 @@
+#include "Server/OverlayFS.h"
+
+namespace clice {
+
+namespace {
+
+/// A buffer referring to the content owned by others, i.e. the cache entry or the
+/// snapshot. It keeps the owner alive, so the content is not freed if the entry is
+/// invalidated while a compilation is still using it.
+class SharedBuffer : public llvm::MemoryBuffer {
+public:
+    SharedBuffer(std::shared_ptr<const void> owner, llvm::StringRef content, std::string name) :
+        owner(std::move(owner)), name(std::move(name)) {
+        init(content.begin(), content.end(), /*RequiresNullTerminator=*/true);
+    }
+
+    llvm::StringRef getBufferIdentifier() const override {
+        return name;
+    }
+
+    BufferKind getBufferKind() const override {
+        return MemoryBuffer_Malloc;
+    }
+
+private:
+    std::shared_ptr<const void> owner;
+    std::string name;
+};
+
+class SharedFile : public vfs::File {
+public:
+    SharedFile(vfs::Status stat, std::shared_ptr<const void> owner, llvm::StringRef content) :
+        stat(std::move(stat)), owner(std::move(owner)), content(content) {}
+
+    llvm::ErrorOr<vfs::Status> status() override {
+        return stat;
+    }
+
+    llvm::ErrorOr<std::string> getName() override {
+        return stat.getName().str();
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const llvm::Twine& name,
+                                                                 int64_t /*FileSize*/,
+                                                                 bool /*RequiresNullTerminator*/,
+                                                                 bool /*IsVolatile*/) override {
+        return std::make_unique<SharedBuffer>(owner, content, name.str());
+    }
+
+    std::error_code close() override {
+        return {};
+    }
+
+private:
+    vfs::Status stat;
+    std::shared_ptr<const void> owner;
+    llvm::StringRef content;
+};
+
+bool isPrecompiled(llvm::StringRef path) {
+    auto extension = path::extension(path);
+    return extension == ".pch" || extension == ".pcm";
+}
+
+}  // namespace
+
+void OverlayFS::open(llvm::StringRef path, std::shared_ptr<const TextSnapshot> snapshot) {
+    auto key = normalize(path);
+    std::lock_guard lock(mutex);
+    auto& entry = entries[key];
+    if(!entry.snapshot) {
+        entry.id = vfs::getNextVirtualUniqueID();
+    }
+    entry.snapshot = std::move(snapshot);
+}
+
+void OverlayFS::close(llvm::StringRef path) {
+    auto key = normalize(path);
+    std::lock_guard lock(mutex);
+    if(auto iter = entries.find(key); iter != entries.end()) {
+        iter->second.snapshot.reset();
+        if(!iter->second.position) {
+            entries.erase(iter);
+        }
+    }
+}
+
+void OverlayFS::invalidate(llvm::StringRef path) {
+    auto key = normalize(path);
+    std::lock_guard lock(mutex);
+    if(auto iter = entries.find(key); iter != entries.end()) {
+        forget(iter->second);
+        if(!iter->second.snapshot) {
+            entries.erase(iter);
+        }
+    }
+}
+
+void OverlayFS::invalidateAll() {
+    std::lock_guard lock(mutex);
+    for(auto iter = entries.begin(); iter != entries.end();) {
+        auto current = iter++;
+        forget(current->second);
+        if(!current->second.snapshot) {
+            entries.erase(current);
+        }
+    }
+}
+
+llvm::ErrorOr<vfs::Status> OverlayFS::status(const llvm::Twine& path) {
+    auto key = normalize(path);
+    if(isPrecompiled(key)) {
+        return ProxyFileSystem::status(path);
+    }
+
+    auto name = path.str();
+    auto disk = diskStatus(key);
+
+    std::lock_guard lock(mutex);
+    if(auto iter = entries.find(key); iter != entries.end() && iter->second.snapshot) {
+        return overlayStatus(iter->second, disk, name);
+    }
+
+    if(!disk) {
+        return disk.getError();
+    }
+    return vfs::Status::copyWithNewName(*disk, name);
+}
+
+llvm::ErrorOr<std::unique_ptr<vfs::File>> OverlayFS::openFileForRead(const llvm::Twine& path) {
+    auto key = normalize(path);
+    if(isPrecompiled(key)) {
+        return ProxyFileSystem::openFileForRead(path);
+    }
+
+    stats.reads += 1;
+    auto name = path.str();
+    auto disk = diskStatus(key);
+
+    std::shared_ptr<const llvm::MemoryBuffer> cached;
+    vfs::Status cachedStatus;
+    {
+        std::lock_guard lock(mutex);
+        auto iter = entries.find(key);
+        if(iter != entries.end() && iter->second.snapshot) {
+            auto& entry = iter->second;
+            stats.cachedReads += 1;
+            return std::make_unique<SharedFile>(overlayStatus(entry, disk, name),
+                                                entry.snapshot,
+                                                entry.snapshot->content());
+        }
+
+        if(!disk) {
+            return disk.getError();
+        }
+
+        if(iter != entries.end() && iter->second.content) {
+            cached = iter->second.content;
+            cachedStatus = iter->second.contentStatus;
+        }
+    }
+
+    /// The file may be changed outside of the editor without notification, e.g. by a git
+    /// checkout or a code generator. The cached content is served only if the file is not
+    /// modified since read, a stat is much cheaper than reading the file again.
+    if(cached) {
+        stats.validations += 1;
+        if(disk->getLastModificationTime() == cachedStatus.getLastModificationTime() &&
+           disk->getSize() == cachedStatus.getSize()) {
+            stats.cachedReads += 1;
+
+            std::lock_guard lock(mutex);
+            if(auto iter = entries.find(key); iter != entries.end() && iter->second.position) {
+                touch(key, iter->second);
+            }
+            return std::make_unique<SharedFile>(vfs::Status::copyWithNewName(*disk, name),
+                                                cached,
+                                                cached->getBuffer());
+        }
+
+        std::lock_guard lock(mutex);
+        if(auto iter = entries.find(key); iter != entries.end()) {
+            forget(iter->second);
+            if(!iter->second.snapshot) {
+                entries.erase(iter);
+            }
+        }
+    }
+
+    auto file = getUnderlyingFS().openFileForRead(key);
+    if(!file) {
+        return file.getError();
+    }
+
+    /// The file may be changed after the stat, so the status is refreshed to match the
+    /// content.
+    auto status = (*file)->status();
+    if(!status) {
+        return status.getError();
+    }
+
+    /// Read the file rather than mapping it, it may be changed on disk while cached.
+    auto buffer = (*file)->getBuffer(key,
+                                     status->getSize(),
+                                     /*RequiresNullTerminator=*/true,
+                                     /*IsVolatile=*/true);
+    if(!buffer) {
+        return buffer.getError();
+    }
+
+    std::shared_ptr<const llvm::MemoryBuffer> content = std::move(*buffer);
+    {
+        std::lock_guard lock(mutex);
+        auto& entry = entries[key];
+        if(entry.content) {
+            memory -= entry.content->getBufferSize();
+        }
+        entry.content = content;
+        entry.contentStatus = *status;
+        memory += content->getBufferSize();
+        touch(key, entry);
+    }
+
+    return std::make_unique<SharedFile>(vfs::Status::copyWithNewName(*status, name),
+                                        content,
+                                        content->getBuffer());
+}
+
+bool OverlayFS::exists(const llvm::Twine& path) {
+    return bool(status(path));
+}
+
+std::string OverlayFS::normalize(const llvm::Twine& path) const {
+    llvm::SmallString<256> result;
+    path.toVector(result);
+
+    /// The working directory is only queried for relative paths, it costs a syscall.
+    if(!path::is_absolute(result)) {
+        makeAbsolute(result);
+    }
+    path::remove_dots(result, /*remove_dot_dot=*/true);
+    return result.str().str();
+}
+
+llvm::ErrorOr<vfs::Status> OverlayFS::diskStatus(llvm::StringRef key) {
+    stats.stats += 1;
+    {
+        std::lock_guard lock(mutex);
+        if(auto iter = entries.find(key); iter != entries.end() && iter->second.error) {
+            stats.cachedStats += 1;
+            return *iter->second.error;
+        }
+    }
+
+    /// The status of an existing file is always refreshed, it validates the cached content
+    /// as well, so they are never out of sync. Only failures are cached, most of them are
+    /// from probing include directories.
+    auto status = getUnderlyingFS().status(key);
+    if(!status) {
+        std::lock_guard lock(mutex);
+        auto& entry = entries[key];
+        if(!entry.error) {
+            entry.error = status.getError();
+            touch(key, entry);
+        }
+    }
+    return status;
+}
+
+vfs::Status OverlayFS::overlayStatus(const Entry& entry,
+                                     const llvm::ErrorOr<vfs::Status>& disk,
+                                     llvm::StringRef name) {
+    auto size = entry.snapshot->content().size();
+    if(disk) {
+        return vfs::Status::copyWithNewSize(vfs::Status::copyWithNewName(*disk, name), size);
+    }
+
+    return vfs::Status(name,
+                       entry.id,
+                       llvm::sys::TimePoint<>(),
+                       0,
+                       0,
+                       size,
+                       llvm::sys::fs::file_type::regular_file,
+                       llvm::sys::fs::perms::all_read);
+}
+
+void OverlayFS::touch(llvm::StringRef key, Entry& entry) {
+    if(entry.position) {
+        lru.splice(lru.begin(), lru, *entry.position);
+    } else {
+        lru.emplace_front(key);
+        entry.position = lru.begin();
+    }
+
+    while(!lru.empty() && ((capacity != 0 && lru.size() > capacity) ||
+                           (limit != 0 && memory > limit))) {
+        auto iter = entries.find(lru.back());
+        assert(iter != entries.end() && "cached file must have an entry");
+        forget(iter->second);
+        if(!iter->second.snapshot) {
+            entries.erase(iter);
+        }
+        stats.evictions += 1;
+    }
+}
+
+void OverlayFS::forget(Entry& entry) {
+    if(entry.content) {
+        memory -= entry.content->getBufferSize();
+    }
+    entry.error.reset();
+    entry.content.reset();
+
+    if(entry.position) {
+        lru.erase(*entry.position);
+        entry.position.reset();
+    }
+}
+
+}  // namespace clice
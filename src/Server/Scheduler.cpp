@@ -1,41 +1,275 @@
+#include "Support/Logger.h"
 #include "Server/Scheduler.h"
+#include "Compiler/Compilation.h"
 
 namespace clice {
 
-async::Task<> Scheduler::open(llvm::StringRef file) {
+async::Task<> Scheduler::open(llvm::StringRef path, std::string content) {
     /// 首先根据 rule 来对 file 进行判别
 
-    /// 查看一下这 file 属于什么模式
+    /// 如果不是 readonly 模式, 才需要构建 AST
 
-    /// 1. 正常的源文件或者模块文件
+    auto& file = files[path];
+    file.buffer = TextBuffer(std::move(content));
+    file.version = ++version;
 
-    /// 预处理一遍源文件，获取一些相关的信息
-    /// 是不是 module file?
-    /// 获取模块依赖关系
-    /// 或者计算 Preamble 的位置
-
-    auto command = database.getCommand(file);
+    /// A newly opened file is built immediately.
+    async::schedule(build(path.str()).release());
+    co_return;
+}
 
-    /// 如果不是 readonly 模式
-    /// 调用 CacheController 里面对应的函数更新这个文件的 cache
-    /// PCH or PCM
+async::Task<> Scheduler::update(llvm::StringRef path, std::string content) {
+    auto iter = files.find(path);
+    if(iter == files.end()) {
+        co_await open(path, std::move(content));
+        co_return;
+    }
 
-    /// 准备 CompilationParams 进行 AST 编译
+    auto& file = iter->second;
+    file.buffer = TextBuffer(std::move(content));
+    file.version = ++version;
+    async::schedule(debounce(path.str(), file.version).release());
 
     /// 调度索引任务 ...
+}
 
-    /// 2. 头文件
-
-    /// 先检查一下该头文件是否有选中的上下文... [一组 include 位置]
-    ///
-    /// 对上下文源文件进行上述的处理
+async::Task<> Scheduler::update(llvm::StringRef path,
+                                llvm::ArrayRef<proto::TextDocumentContentChangeEvent> changes,
+                                const SourceConverter& converter) {
+    auto iter = files.find(path);
+    if(iter == files.end()) {
+        log::warn("Changes to a file not opened: {}", path);
+        co_return;
+    }
 
-    ///
-    /// ...
+    auto& file = iter->second;
+    for(auto& change: changes) {
+        file.buffer.apply(change, converter);
+    }
+    file.version = ++version;
+    async::schedule(debounce(path.str(), file.version).release());
+}
 
-    /// 重新索引依赖这个头文件的源文件
+async::Task<> Scheduler::close(llvm::StringRef path) {
+    if(auto iter = files.find(path); iter != files.end()) {
+        if(iter->second.ast) {
+            memory -= iter->second.ast->memory;
+        }
+        files.erase(iter);
+    }
 
+    vfs->close(path);
+    cache.release(path);
     co_return;
 }
 
+async::Task<std::shared_ptr<Scheduler::AST>> Scheduler::ast(std::string path,
+                                                            async::CancellationToken token) {
+    auto iter = files.find(path);
+    if(iter == files.end()) {
+        co_return nullptr;
+    }
+
+    if(auto& file = iter->second; file.ast && file.astVersion == file.version) {
+        stats.hits += 1;
+    } else {
+        co_await build(path, token);
+    }
+
+    iter = files.find(path);
+    if(iter == files.end() || !iter->second.ast) {
+        co_return nullptr;
+    }
+
+    iter->second.lastUsed = ++clock;
+    co_return iter->second.ast;
+}
+
+async::Task<> Scheduler::build(std::string path, async::CancellationToken token) {
+    while(true) {
+        auto iter = files.find(path);
+        if(iter == files.end() || token.cancelled()) {
+            co_return;
+        }
+
+        auto& file = iter->second;
+        if(auto event = file.building) {
+            co_await event->wait();
+            continue;
+        }
+
+        if(file.built == file.version) {
+            co_return;
+        }
+
+        auto event = std::make_shared<async::Event>();
+        auto target = file.version;
+        file.building = event;
+        file.built = target;
+
+        auto snapshot = file.buffer.snapshot();
+        vfs->open(path, snapshot);
+
+        auto ast = co_await compile(path, std::move(snapshot), token);
+        event->set();
+
+        /// The file may be closed, reopened or changed while building.
+        iter = files.find(path);
+        if(iter == files.end()) {
+            co_return;
+        }
+
+        auto& current = iter->second;
+        if(current.building == event) {
+            current.building.reset();
+        }
+
+        /// The aborted build is not for the content, others waiting for it build again.
+        if(!ast && token.cancelled()) {
+            stats.cancellations += 1;
+            if(current.built == target) {
+                current.built = 0;
+            }
+            co_return;
+        }
+
+        if(!ast || target < current.astVersion) {
+            continue;
+        }
+
+        if(current.ast) {
+            memory -= current.ast->memory;
+        }
+        memory += ast->memory;
+        current.ast = std::move(ast);
+        current.astVersion = target;
+        current.lastUsed = ++clock;
+        stats.builds += 1;
+
+        evict(current);
+    }
+}
+
+async::Task<> Scheduler::debounce(std::string path, std::uint32_t target) {
+    co_await async::sleep(std::chrono::milliseconds(options.debounce));
+
+    /// A newer change schedules its own build.
+    auto iter = files.find(path);
+    if(iter == files.end() || iter->second.version != target) {
+        co_return;
+    }
+
+    co_await build(path);
+    if(onDebounced) {
+        onDebounced(path);
+    }
+}
+
+async::Task<std::shared_ptr<Scheduler::AST>>
+    Scheduler::compile(std::string path,
+                       std::shared_ptr<const TextSnapshot> snapshot,
+                       async::CancellationToken token) {
+    /// A header without its own command is compiled in the context of a source file
+    /// including it. The source file is cut off right after the `#include` directive,
+    /// so only the preamble and the header itself are parsed.
+    std::string srcPath = path;
+    std::optional<std::uint32_t> line;
+    auto command = database.getCommand(path);
+    if(command.empty()) {
+        if(auto context = indexer.context(path)) {
+            command = database.getCommand(context->srcPath);
+            srcPath = std::move(context->srcPath);
+            line = context->line;
+        }
+    }
+
+    if(command.empty()) {
+        log::warn("No compile command found for {}", path);
+        co_return nullptr;
+    }
+
+    CompilationParams params;
+    std::unique_ptr<llvm::MemoryBuffer> content;
+    if(srcPath != path) {
+        /// Both the source file and the header are read through the overlay, so the unsaved
+        /// content of them in the editor is used.
+        auto result = co_await async::submit(async::Priority::Interactive, [&] {
+            return vfs->getBufferForFile(srcPath);
+        });
+        if(!result) {
+            log::warn("Failed to read {}, because {}", srcPath, result.getError().message());
+            co_return nullptr;
+        }
+
+        content = std::move(*result);
+        params.content = content->getBuffer();
+        params.interested = path;
+    } else {
+        /// The snapshot is kept alive by the AST, so the compiler refers to it directly.
+        params.content = snapshot->content();
+        params.borrowContent = true;
+    }
+
+    params.srcPath = srcPath;
+    params.command = command;
+    params.vfs = vfs;
+    params.cancelled = token.flag();
+    if(line) {
+        params.bound = computeBounds(params.content, *line);
+    }
+
+    /// A file whose preamble matches an existing PCH reuses it without parsing preamble.
+    co_await cache.prepare(params, path);
+    if(token.cancelled()) {
+        co_return nullptr;
+    }
+
+    /// Requests are waiting for the AST, it jumps ahead of queued indexing jobs.
+    std::string error;
+    auto ast = co_await async::submit(async::Priority::Interactive,
+                                      [&]() -> std::shared_ptr<AST> {
+        auto info = clice::compile(params);
+        if(!info) {
+            error = std::move(info.error());
+            return nullptr;
+        }
+
+        auto memory = info->memory();
+        return std::make_shared<AST>(std::move(*info), memory, snapshot);
+    });
+
+    if(!ast && token.cancelled()) {
+        log::info("Build AST for {} is cancelled", path);
+    } else if(!ast) {
+        log::warn("Failed to build AST for {}, because {}", path, error);
+    }
+    co_return ast;
+}
+
+void Scheduler::evict(const File& keep) {
+    if(options.astCacheLimit == 0) {
+        return;
+    }
+
+    auto limit = std::size_t(options.astCacheLimit) * 1024 * 1024;
+    while(memory > limit) {
+        File* victim = nullptr;
+        for(auto& [_, file]: files) {
+            if(&file != &keep && file.ast && (!victim || file.lastUsed < victim->lastUsed)) {
+                victim = &file;
+            }
+        }
+
+        if(!victim) {
+            break;
+        }
+
+        memory -= victim->ast->memory;
+        victim->ast.reset();
+        victim->astVersion = 0;
+        victim->built = 0;
+        stats.evictions += 1;
+    }
+}
+
 }  // namespace clice
@@ -3,7 +3,10 @@
 
 namespace clice {
 
-Server::Server() : indexer(config::index, database), scheduler(database, {}) {
+/// The indexer reads files on disk without the overlay, it runs in the background for a
+/// long time and should never see a stale cached file.
+Server::Server() :
+    indexer(config::index, database), scheduler(config::server, database, indexer, vfs, {}) {
     addMethod("initialize", &Server::onInitialize);
     addMethod("initialized", &Server::onInitialized);
     addMethod("shutdown", &Server::onShutdown);
@@ -43,11 +46,46 @@ Server::Server() : indexer(config::index, database), scheduler(database, {}) {
 
     addMethod("index/current", &Server::onIndexCurrent);
     addMethod("index/all", &Server::onIndexAll);
+    addMethod("index/pause", &Server::onIndexPause);
+    addMethod("index/resume", &Server::onIndexResume);
     addMethod("context/current", &Server::onContextCurrent);
     addMethod("context/switch", &Server::onContextSwitch);
     addMethod("context/all", &Server::onContextAll);
+
+    /// The id may be an integer or a string, so handle it without deserialization.
+    notifications.try_emplace("$/cancelRequest", [this](json::Value value) -> async::Task<> {
+        if(auto object = value.getAsObject()) {
+            if(auto id = object->get("id")) {
+                cancel(*id);
+            }
+        }
+        co_return;
+    });
 }
 
+namespace {
+
+/// Requests whose result only depends on the latest state of the document, an older
+/// request is useless once a newer one of the same document arrives.
+bool isSupersedable(llvm::StringRef method) {
+    return llvm::is_contained(
+        llvm::ArrayRef<llvm::StringRef>{
+            "textDocument/hover",
+            "textDocument/completion",
+            "textDocument/signatureHelp",
+            "textDocument/documentHighlight",
+            "textDocument/documentLink",
+            "textDocument/documentSymbol",
+            "textDocument/codeLens",
+            "textDocument/foldingRange",
+            "textDocument/inlayHint",
+            "textDocument/semanticTokens/full",
+        },
+        method);
+}
+
+}  // namespace
+
 async::Task<> Server::onReceive(json::Value value) {
     assert(value.kind() == json::Value::Object);
     auto object = value.getAsObject();
@@ -59,8 +97,41 @@ async::Task<> Server::onReceive(json::Value value) {
             if(auto iter = requests.find(name); iter != requests.end()) {
                 /// auto tracer = Tracer();
                 log::info("Receive request: {0}", name);
+
+                auto key = std::format("{}", *id);
+                std::string supersedeKey;
+                if(isSupersedable(name) && params) {
+                    if(auto object = params->getAsObject()) {
+                        if(auto document = object->getObject("textDocument")) {
+                            if(auto uri = document->getString("uri")) {
+                                supersedeKey = (name + "|" + *uri).str();
+                            }
+                        }
+                    }
+                }
+
+                if(!supersedeKey.empty()) {
+                    auto& latest = latestRequests[supersedeKey];
+                    if(auto old = pendingRequests.find(latest); old != pendingRequests.end()) {
+                        log::info("Request {0} is superseded by {1}", latest, key);
+                        old->second.token.cancel();
+                    }
+                    latest = key;
+                }
+
+                pendingRequests[key] = {async::CancellationToken::create(), supersedeKey};
+
                 co_await iter->second(std::move(*id),
                                       params ? std::move(*params) : json::Value(nullptr));
+
+                if(!supersedeKey.empty()) {
+                    if(auto latest = latestRequests.find(supersedeKey);
+                       latest != latestRequests.end() && latest->second == key) {
+                        latestRequests.erase(latest);
+                    }
+                }
+                pendingRequests.erase(key);
+
                 log::info("Request {0} is done, elapsed {1}", name, 0);
 
             } else {
@@ -74,17 +145,71 @@ async::Task<> Server::onReceive(json::Value value) {
                 log::warn("Unknown notification: {0}", name);
             }
         }
+    } else {
+        receive(*object);
     }
     co_return;
 }
 
-async::Task<> Server::request(llvm::StringRef method, json::Value params) {
+async::Task<std::optional<json::Value>> Server::request(llvm::StringRef method,
+                                                        json::Value params) {
+    auto current = id += 1;
+    PendingResponse response;
+    pendingResponses[current] = &response;
+
     co_await async::net::write(json::Object{
         {"jsonrpc", "2.0"            },
-        {"id",      id += 1          },
+        {"id",      current          },
         {"method",  method           },
         {"params",  std::move(params)},
     });
+
+    /// The client may never respond, e.g. it does not support the method. The timer only
+    /// finds the entry by id, so it never touches the response after this frame is gone.
+    if(auto timeout = config::server.requestTimeout) {
+        async::schedule(expire(current, std::chrono::milliseconds(timeout)).release());
+    }
+
+    co_await response.received.wait();
+    co_return std::move(response.result);
+}
+
+async::Task<> Server::expire(std::uint32_t id, std::chrono::milliseconds timeout) {
+    co_await async::sleep(timeout);
+
+    auto iter = pendingResponses.find(id);
+    if(iter == pendingResponses.end()) {
+        co_return;
+    }
+
+    log::warn("Request {0} is timed out after {1}ms", id, timeout.count());
+    auto pending = iter->second;
+    pendingResponses.erase(iter);
+    pending->received.set();
+}
+
+void Server::receive(const json::Object& response) {
+    auto id = response.getInteger("id");
+    if(!id) {
+        log::warn("Receive a response without id");
+        return;
+    }
+
+    auto iter = pendingResponses.find(*id);
+    if(iter == pendingResponses.end()) {
+        log::warn("Receive a response of unknown request: {0}", *id);
+        return;
+    }
+
+    auto pending = iter->second;
+    pendingResponses.erase(iter);
+
+    if(auto result = response.get("result")) {
+        pending->result = *result;
+    } else if(auto error = response.get("error")) {
+        log::warn("Request {0} failed, because {1}", *id, *error);
+    }
+    pending->received.set();
 }
 
 async::Task<> Server::notify(llvm::StringRef method, json::Value params) {
@@ -95,11 +220,49 @@ async::Task<> Server::notify(llvm::StringRef method, json::Value params) {
     });
 }
 
+async::CancellationToken Server::token(const json::Value& id) {
+    if(auto iter = pendingRequests.find(std::format("{}", id)); iter != pendingRequests.end()) {
+        return iter->second.token;
+    }
+    return {};
+}
+
+void Server::cancel(const json::Value& id) {
+    if(auto iter = pendingRequests.find(std::format("{}", id)); iter != pendingRequests.end()) {
+        log::info("Cancel request: {0}", iter->first());
+        iter->second.token.cancel();
+    }
+}
+
 async::Task<> Server::response(json::Value id, json::Value result) {
-    co_await async::net::write(json::Object{
-        {"jsonrpc", "2.0"            },
-        {"id",      id               },
-        {"result",  std::move(result)},
+    co_await writeResponse(std::move(id), [&](json::OStream& os) { os.value(result); });
+}
+
+async::Task<> Server::writeResponse(json::Value id,
+                                    llvm::function_ref<void(json::OStream&)> result) {
+    /// A cancelled request still needs a response, but the result is dropped.
+    if(token(id).cancelled()) {
+        co_await async::net::write(json::Object{
+            {"jsonrpc", "2.0"},
+            {"id",      id   },
+            {"error",
+             json::Object{
+                 {"code", -32800},
+                 {"message", "Request cancelled"},
+             }},
+        });
+        co_return;
+    }
+
+    co_await async::net::write([&](llvm::raw_ostream& os) {
+        json::OStream stream(os);
+        stream.object([&] {
+            stream.attribute("jsonrpc", "2.0");
+            stream.attribute("id", id);
+            stream.attributeBegin("result");
+            result(stream);
+            stream.attributeEnd();
+        });
     });
 }
 
@@ -0,0 +1,205 @@
+#include "Server/SymbolTable.h"
+#include "Support/Binary.h"
+#include "Support/Logger.h"
+
+#include "llvm/ADT/DenseSet.h"
+
+namespace clice {
+
+namespace memory {
+
+struct SymbolFile {
+    std::string indexPath;
+    std::string srcPath;
+    std::vector<std::uint64_t> symbols;
+};
+
+struct SymbolTable {
+    std::vector<SymbolFile> files;
+};
+
+}  // namespace memory
+
+namespace {
+
+/// The version of `symbols.bin`, tables of other versions are discarded.
+constexpr std::uint32_t version = 1;
+
+constexpr std::uint32_t magic = 0x4D595343;
+
+/// The header is padded to 8 bytes so that the binarified table is aligned.
+struct FileHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+
+    /// The size of the binarified table following the header.
+    std::uint64_t size;
+};
+
+std::string fileKey(llvm::StringRef indexPath, llvm::StringRef srcPath) {
+    std::string key = indexPath.str();
+    key += '\0';
+    key += srcPath;
+    return key;
+}
+
+}  // namespace
+
+void SymbolTable::update(llvm::StringRef indexPath,
+                         llvm::StringRef srcPath,
+                         llvm::ArrayRef<std::uint64_t> symbols) {
+    /// Remove the old symbols of this file first, so that update is incremental.
+    remove(indexPath, srcPath);
+
+    std::uint32_t slot;
+    if(!freeList.empty()) {
+        slot = freeList.back();
+        freeList.pop_back();
+    } else {
+        slot = files.size();
+        files.emplace_back();
+    }
+
+    auto& file = files[slot];
+    file.indexPath = indexPath;
+    file.srcPath = srcPath;
+    file.symbols.assign(symbols.begin(), symbols.end());
+    ranges::sort(file.symbols);
+    auto [first, last] = ranges::unique(file.symbols);
+    file.symbols.erase(first, last);
+
+    fileIndices.try_emplace(fileKey(indexPath, srcPath), slot);
+
+    for(auto symbol: file.symbols) {
+        auto& slots = symbolFiles[symbol];
+        slots.insert(ranges::lower_bound(slots, slot), slot);
+    }
+}
+
+void SymbolTable::remove(llvm::StringRef indexPath, llvm::StringRef srcPath) {
+    auto iter = fileIndices.find(fileKey(indexPath, srcPath));
+    if(iter == fileIndices.end()) {
+        return;
+    }
+
+    auto slot = iter->second;
+    fileIndices.erase(iter);
+
+    auto& file = files[slot];
+    for(auto symbol: file.symbols) {
+        auto entry = symbolFiles.find(symbol);
+        assert(entry != symbolFiles.end() && "Symbol is not recorded");
+
+        auto& slots = entry->second;
+        auto pos = ranges::lower_bound(slots, slot);
+        assert(pos != slots.end() && *pos == slot && "File is not recorded");
+        slots.erase(pos);
+
+        if(slots.empty()) {
+            symbolFiles.erase(entry);
+        }
+    }
+
+    file = File{};
+    freeList.push_back(slot);
+}
+
+std::vector<SymbolTable::Entry>
+    SymbolTable::lookup(llvm::ArrayRef<std::uint64_t> symbols) const {
+    std::vector<Entry> result;
+    llvm::DenseSet<std::uint32_t> visited;
+
+    for(auto symbol: symbols) {
+        auto iter = symbolFiles.find(symbol);
+        if(iter == symbolFiles.end()) {
+            continue;
+        }
+
+        for(auto slot: iter->second) {
+            if(visited.insert(slot).second) {
+                auto& file = files[slot];
+                result.emplace_back(Entry{file.indexPath, file.srcPath});
+            }
+        }
+    }
+
+    return result;
+}
+
+void SymbolTable::saveToDisk(llvm::StringRef path) const {
+    memory::SymbolTable table;
+    table.files.reserve(fileIndices.size());
+    for(auto& [_, slot]: fileIndices) {
+        auto& file = files[slot];
+        table.files.emplace_back(memory::SymbolFile{
+            .indexPath = file.indexPath,
+            .srcPath = file.srcPath,
+            .symbols = file.symbols,
+        });
+    }
+
+    auto [proxy, size] = binary::binarify(table);
+    auto buffer = const_cast<void*>(proxy.base);
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path, ec);
+    if(ec) {
+        log::warn("Failed to open symbol table: {} Beacuse {}", path, ec.message());
+        std::free(buffer);
+        return;
+    }
+
+    FileHeader header{magic, version, size};
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(static_cast<const char*>(buffer), size);
+    std::free(buffer);
+
+    if(os.has_error()) {
+        log::warn("Failed to write symbol table: {}", os.error().message());
+    }
+}
+
+void SymbolTable::loadFromDisk(llvm::StringRef path) {
+    files.clear();
+    freeList.clear();
+    fileIndices.clear();
+    symbolFiles.clear();
+
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if(!buffer) {
+        log::warn("Failed to open symbol table: {} Beacuse {}", path, buffer.getError());
+        return;
+    }
+
+    auto content = buffer.get()->getBuffer();
+
+    FileHeader header = {};
+    if(content.size() >= sizeof(header)) {
+        std::memcpy(&header, content.data(), sizeof(header));
+    }
+
+    if(header.magic != magic || header.version != version) {
+        log::warn("Discard symbol table of other version: {}", path);
+        return;
+    }
+
+    /// The offsets in the table are trusted once the size matches, a truncated file is
+    /// discarded rather than read out of bounds.
+    if(header.size == 0 || header.size != content.size() - sizeof(header)) {
+        log::warn("Symbol table is truncated or corrupted: {}", path);
+        return;
+    }
+
+    auto base = content.data() + sizeof(header);
+    binary::Proxy<memory::SymbolTable> table{base, base};
+
+    auto entries = table.get<"files">();
+    for(std::size_t i = 0; i < entries.size(); ++i) {
+        auto entry = entries[i];
+        update(entry.get<"indexPath">().as_string(),
+               entry.get<"srcPath">().as_string(),
+               entry.get<"symbols">().as_array());
+    }
+}
+
+}  // namespace clice
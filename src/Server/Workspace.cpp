@@ -4,7 +4,17 @@
 namespace clice {
 
 async::Task<> Server::onDidChangeWatchedFiles(const proto::DidChangeWatchedFilesParams& params) {
-    co_return;
+    /// Created files are invalidated as well, they may be cached as not existing.
+    std::vector<std::string> files;
+    for(auto& change: params.changes) {
+        auto& file = files.emplace_back(SourceConverter::toPath(change.uri));
+        vfs->invalidate(file);
+    }
+
+    /// Reindex the units affected by the changes, opened files first.
+    co_await indexer.update(std::move(files), [&](llvm::StringRef file) {
+        return scheduler.isOpened(file);
+    });
 }
 
 }  // namespace clice
@@ -0,0 +1,267 @@
+#include "Test/Test.h"
+#include "Async/Async.h"
+
+#include <chrono>
+
+namespace clice::testing {
+
+namespace {
+
+using async::net::MessageBuffer;
+
+void feed(MessageBuffer& buffer, llvm::StringRef data) {
+    auto space = buffer.prepare(data.size());
+    std::memcpy(space.data(), data.data(), data.size());
+    buffer.commit(data.size());
+}
+
+std::string frame(llvm::StringRef content, llvm::StringRef extra = "") {
+    return std::format("Content-Length: {}\r\n{}\r\n{}", content.size(), extra, content);
+}
+
+std::vector<std::string> drain(MessageBuffer& buffer) {
+    std::vector<std::string> messages;
+    while(auto message = buffer.next()) {
+        messages.emplace_back(message->str());
+    }
+    return messages;
+}
+
+TEST(Network, MultipleMessages) {
+    MessageBuffer buffer;
+    feed(buffer, frame(R"({"id":1})") + frame(R"({"id":2})") + frame(R"({"id":3})"));
+
+    EXPECT_EQ(drain(buffer), std::vector<std::string>{R"({"id":1})", R"({"id":2})", R"({"id":3})"});
+    EXPECT_EQ(buffer.size(), 0);
+}
+
+TEST(Network, ExtraHeaders) {
+    MessageBuffer buffer;
+    feed(buffer,
+         frame("{}", "Content-Type: application/vscode-jsonrpc; charset=utf-8\r\n") +
+             "content-length:  2\r\n\r\n[]");
+
+    EXPECT_EQ(drain(buffer), std::vector<std::string>{"{}", "[]"});
+}
+
+TEST(Network, PartialMessages) {
+    MessageBuffer buffer;
+    auto data = frame(R"({"method":"textDocument/didChange"})") + frame(R"({"id":2})");
+
+    /// Feed byte by byte, each message is available right after its last byte.
+    std::vector<std::string> messages;
+    for(auto c: data) {
+        feed(buffer, llvm::StringRef(&c, 1));
+        for(auto& message: drain(buffer)) {
+            messages.emplace_back(message);
+        }
+    }
+
+    EXPECT_EQ(messages,
+              std::vector<std::string>{R"({"method":"textDocument/didChange"})", R"({"id":2})"});
+    EXPECT_EQ(buffer.size(), 0);
+}
+
+TEST(Network, MissingLength) {
+    /// The body of the frame without `Content-Length` is dropped with its headers, even
+    /// if it looks like headers.
+    auto invalid = std::string("Content-Type: application/json\r\n\r\n") +
+                   "X-Header: 1\r\n\r\n{\"id\":0}";
+    auto data = frame(R"({"id":1})") + invalid + frame(R"({"id":2})");
+
+    MessageBuffer buffer;
+    feed(buffer, data);
+    EXPECT_EQ(drain(buffer), std::vector<std::string>{R"({"id":1})", R"({"id":2})"});
+    EXPECT_EQ(buffer.size(), 0);
+
+    /// The next header may arrive in pieces.
+    std::vector<std::string> messages;
+    for(auto c: data) {
+        feed(buffer, llvm::StringRef(&c, 1));
+        for(auto& message: drain(buffer)) {
+            messages.emplace_back(message);
+        }
+    }
+    EXPECT_EQ(messages, std::vector<std::string>{R"({"id":1})", R"({"id":2})"});
+}
+
+/// Written messages are sent to a pipe and read back from the other end.
+struct NetworkOutput : ::testing::Test {
+    uv_pipe_t reader;
+    uv_pipe_t writer;
+    MessageBuffer buffer;
+    std::vector<std::string> received;
+    std::size_t expected = 0;
+
+    void SetUp() override {
+        uv_file fds[2];
+        ASSERT_EQ(uv_pipe(fds, UV_NONBLOCK_PIPE, UV_NONBLOCK_PIPE), 0);
+        uv_pipe_init(async::loop, &reader, 0);
+        uv_pipe_open(&reader, fds[0]);
+        uv_pipe_init(async::loop, &writer, 0);
+        uv_pipe_open(&writer, fds[1]);
+        reader.data = this;
+        async::net::redirect(reinterpret_cast<uv_stream_t*>(&writer));
+    }
+
+    void TearDown() override {
+        async::net::redirect(nullptr);
+        uv_close(reinterpret_cast<uv_handle_t*>(&reader), nullptr);
+        uv_close(reinterpret_cast<uv_handle_t*>(&writer), nullptr);
+        async::run();
+    }
+
+    /// Start reading until `count` messages are received.
+    void read(std::size_t count) {
+        expected = count;
+        uv_read_start(
+            reinterpret_cast<uv_stream_t*>(&reader),
+            [](uv_handle_t* handle, size_t suggested, uv_buf_t* buf) {
+                auto space = static_cast<NetworkOutput*>(handle->data)->buffer.prepare(suggested);
+                *buf = uv_buf_init(space.data(), space.size());
+            },
+            [](uv_stream_t* stream, ssize_t nread, const uv_buf_t*) {
+                auto& self = *static_cast<NetworkOutput*>(stream->data);
+                if(nread > 0) {
+                    self.buffer.commit(nread);
+                    while(auto message = self.buffer.next()) {
+                        self.received.emplace_back(message->str());
+                    }
+                }
+
+                if(nread < 0 || self.received.size() >= self.expected) {
+                    uv_read_stop(stream);
+                }
+            });
+    }
+};
+
+TEST_F(NetworkOutput, Coalesce) {
+    auto& stats = async::net::statistics();
+    auto messages = stats.messages;
+    auto writes = stats.writes;
+
+    /// All messages are written in the same loop iteration.
+    auto test = []() -> async::Task<> {
+        std::vector<async::Task<>> tasks;
+        for(int i = 0; i < 8; ++i) {
+            tasks.emplace_back(async::net::write(json::Object{{"id", i}}));
+        }
+        co_await async::when_all(std::move(tasks));
+    };
+
+    read(8);
+    async::run(test());
+
+    EXPECT_EQ(stats.messages - messages, 8);
+    EXPECT_EQ(stats.writes - writes, 1);
+    ASSERT_EQ(received.size(), 8);
+    EXPECT_EQ(received[0], R"({"id":0})");
+    EXPECT_EQ(received[7], R"({"id":7})");
+    EXPECT_EQ(async::net::pending(), 0);
+}
+
+TEST_F(NetworkOutput, BufferReuse) {
+    auto& stats = async::net::statistics();
+    auto allocations = stats.allocations;
+    auto writes = stats.writes;
+
+    /// Each message is sent before the next one is written, its buffer is reused.
+    auto test = []() -> async::Task<> {
+        for(int i = 0; i < 4; ++i) {
+            co_await async::net::write(json::Object{{"id", i}});
+        }
+    };
+
+    read(4);
+    async::run(test());
+
+    EXPECT_EQ(stats.writes - writes, 4);
+    EXPECT_LE(stats.allocations - allocations, 1);
+    EXPECT_EQ(received.size(), 4);
+}
+
+TEST_F(NetworkOutput, HighWaterMark) {
+    std::string large(64 * 1024, 'x');
+    std::size_t produced = 0;
+    std::size_t size = 0;
+
+    /// Nothing is read until the producer stops, like a client busy with other work.
+    auto produce = [&]() -> async::Task<> {
+        while(async::net::pending() < async::net::highWaterMark) {
+            async::schedule(async::net::write(json::Value(large)).release());
+            produced += 1;
+
+            /// The scheduled write runs before the producer is resumed.
+            co_await async::suspend([](async::core_handle handle) { async::schedule(handle); });
+            if(produced == 1) {
+                size = async::net::pending();
+            }
+        }
+
+        read(produced);
+    };
+
+    async::run(produce());
+
+    /// Sent messages are still pending until the client reads them, so the producer
+    /// stops right after the pending bytes reach the mark.
+    ASSERT_GT(size, large.size());
+    EXPECT_EQ(produced, (async::net::highWaterMark + size - 1) / size);
+    EXPECT_EQ(received.size(), produced);
+    EXPECT_EQ(async::net::pending(), 0);
+}
+
+TEST(Network, Benchmark) {
+    if(!benchmark()) {
+        GTEST_SKIP() << "parses about 45MB of messages, run with --benchmark";
+    }
+
+    /// A burst of typical traffic while typing: didChange followed by requests.
+    std::string didChange = R"({"jsonrpc":"2.0","method":"textDocument/didChange","params":)"
+                            R"({"textDocument":{"uri":"file:///main.cpp","version":1},)"
+                            R"("contentChanges":[{"text":")" +
+                            std::string(4096, 'x') + R"("}]}})";
+    std::string semanticTokens = R"({"jsonrpc":"2.0","id":1,"method":"textDocument/semanticTokens/full",)"
+                                 R"("params":{"textDocument":{"uri":"file:///main.cpp"}}})";
+    std::string inlayHint = R"({"jsonrpc":"2.0","id":2,"method":"textDocument/inlayHint",)"
+                            R"("params":{"textDocument":{"uri":"file:///main.cpp"},)"
+                            R"("range":{"start":{"line":0,"character":0},)"
+                            R"("end":{"line":100,"character":0}}}})";
+
+    std::string traffic;
+    for(int i = 0; i < 100; ++i) {
+        traffic += frame(didChange) + frame(semanticTokens) + frame(inlayHint);
+    }
+
+    MessageBuffer buffer;
+    std::size_t messages = 0;
+    std::size_t bytes = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for(int round = 0; round < 100; ++round) {
+        /// Feed in chunks of typical pipe read size.
+        for(std::size_t offset = 0; offset < traffic.size(); offset += 65536) {
+            auto chunk = llvm::StringRef(traffic).substr(offset, 65536);
+            feed(buffer, chunk);
+            while(auto message = buffer.next()) {
+                auto json = json::parse(*message);
+                messages += bool(json);
+            }
+        }
+        bytes += traffic.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(messages, 100 * 300);
+
+    auto seconds = std::chrono::duration<double>(end - begin).count();
+    println("messages: {}, time: {:.3f}s, throughput: {:.1f} MB/s",
+            messages,
+            seconds,
+            bytes / seconds / 1024 / 1024);
+}
+
+}  // namespace
+
+}  // namespace clice::testing
@@ -93,6 +93,47 @@ TEST(SourceConverter, LocalRangeAndPosition) {
     }
 }
 
+TEST(SourceConverter, LineTable) {
+    /// Make some lines longer than 16 bytes to cover the vectorized path.
+    std::string content = "int a = 1;\n\n/* 😂 long long long comment */ int b;\n"
+                          "int c = 2; // ¥ ↓ ascii after that\nint d;";
+
+    LineTable lines(content);
+    EXPECT_EQ(lines.lineCount(), 5);
+    EXPECT_EQ(lines.lineStart(1), 11);
+    EXPECT_EQ(lines.lineOf(10), 0);
+    EXPECT_EQ(lines.lineOf(11), 1);
+    EXPECT_EQ(lines.lineOf(content.size()), 4);
+    EXPECT_EQ(lines.isASCII(0), true);
+    EXPECT_EQ(lines.isASCII(2), false);
+    EXPECT_EQ(lines.isASCII(3), false);
+    EXPECT_EQ(lines.isASCII(4), true);
+
+    /// Compare with the plain conversion at every codepoint boundary.
+    std::vector<std::uint32_t> offsets;
+    for(std::uint32_t i = 0; i <= content.size(); ++i) {
+        if(i == content.size() || (content[i] & 0xC0) != 0x80) {
+            offsets.push_back(i);
+        }
+    }
+
+    for(auto kind: {proto::PositionEncodingKind::UTF8,
+                    proto::PositionEncodingKind::UTF16,
+                    proto::PositionEncodingKind::UTF32}) {
+        SourceConverter cvtr{kind};
+
+        std::vector<proto::Position> positions;
+        cvtr.toPositions(lines, offsets, positions);
+        EXPECT_EQ(positions.size(), offsets.size());
+
+        for(std::size_t i = 0; i < offsets.size(); ++i) {
+            auto expected = cvtr.toPosition(content, offsets[i]);
+            EXPECT_EQ(cvtr.toPosition(lines, offsets[i]), expected);
+            EXPECT_EQ(positions[i], expected);
+        }
+    }
+}
+
 TEST(SourceConverter, UriAndFsPath) {
     using SC = SourceConverter;
 
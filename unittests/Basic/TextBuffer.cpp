@@ -0,0 +1,114 @@
+#include "Test/Test.h"
+#include "Basic/TextBuffer.h"
+#include "Basic/SourceConverter.h"
+
+namespace clice::testing {
+
+namespace {
+
+TEST(TextBuffer, Replace) {
+    TextBuffer buffer("int x = 1;\nint y = 2;\n");
+    EXPECT_EQ(buffer.lineCount(), 3);
+
+    buffer.replace(4, 5, "foo");
+    EXPECT_EQ(buffer.snapshot()->content(), "int foo = 1;\nint y = 2;\n");
+
+    buffer.replace(12, 12, "\nint z = 3;");
+    EXPECT_EQ(buffer.lineCount(), 4);
+    EXPECT_EQ(buffer.snapshot()->content(), "int foo = 1;\nint z = 3;\nint y = 2;\n");
+
+    /// Remove across lines.
+    buffer.replace(3, 17, "");
+    EXPECT_EQ(buffer.lineCount(), 3);
+    EXPECT_EQ(buffer.size(), 21);
+    EXPECT_EQ(buffer.snapshot()->content(), "int z = 3;\nint y = 2;\n");
+
+    /// The line starts match the line table of the snapshot.
+    auto snapshot = buffer.snapshot();
+    EXPECT_EQ(snapshot->lines().lineCount(), buffer.lineCount());
+    EXPECT_EQ(snapshot->lines().lineStart(1), 11);
+}
+
+TEST(TextBuffer, Apply) {
+    SourceConverter converter{proto::PositionEncodingKind::UTF16};
+    TextBuffer buffer("int a = \"😂\";\nb");
+
+    /// The emoji is two code units in UTF-16.
+    buffer.apply({{{0, 11}, {0, 11}}, "x"}, converter);
+    EXPECT_EQ(buffer.snapshot()->content(), "int a = \"😂x\";\nb");
+
+    buffer.apply({{{0, 4}, {1, 0}}, ""}, converter);
+    EXPECT_EQ(buffer.snapshot()->content(), "int b");
+
+    /// Positions out of the text are clamped.
+    buffer.apply({{{0, 100}, {5, 0}}, " = 1;"}, converter);
+    EXPECT_EQ(buffer.snapshot()->content(), "int b = 1;");
+}
+
+TEST(TextBuffer, FullReplace) {
+    SourceConverter converter;
+    TextBuffer buffer("int x = 1;\nint y = 2;\n");
+
+    /// A change without range from the client is the whole new content.
+    auto change = json::deserialize<proto::TextDocumentContentChangeEvent>(
+        json::Object{{"text", "int z;"}});
+    EXPECT_FALSE(change.range.has_value());
+
+    buffer.apply(change, converter);
+    EXPECT_EQ(buffer.lineCount(), 1);
+    EXPECT_EQ(buffer.snapshot()->content(), "int z;");
+
+    /// Incremental changes still work after the replacement.
+    buffer.apply({{{0, 5}, {0, 5}}, " = 3"}, converter);
+    EXPECT_EQ(buffer.snapshot()->content(), "int z = 3;");
+}
+
+TEST(TextBuffer, Snapshot) {
+    TextBuffer buffer("int x;");
+    auto first = buffer.snapshot();
+    EXPECT_EQ(first.get(), buffer.snapshot().get());
+
+    buffer.replace(6, 6, "\nint y;");
+    auto second = buffer.snapshot();
+    EXPECT_NE(first.get(), second.get());
+    EXPECT_EQ(first->content(), "int x;");
+    EXPECT_EQ(second->content(), "int x;\nint y;");
+    EXPECT_EQ(second->buffer("main.cpp")->getBufferStart(), second->content().data());
+}
+
+TEST(TextBuffer, TypingBenchmark) {
+    std::string content;
+    while(content.size() < 1024 * 1024) {
+        content += "int variable = 1;\n";
+    }
+
+    SourceConverter converter;
+    TextBuffer buffer(content);
+    auto line = buffer.lineCount() / 2;
+
+    constexpr std::uint32_t count = 10000;
+    auto begin = std::chrono::steady_clock::now();
+    for(std::uint32_t i = 0; i < count; ++i) {
+        proto::Position position{line, i};
+        buffer.apply({{position, position}, "x"}, converter);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    /// Typing extends the same piece, the text is never copied.
+    EXPECT_EQ(buffer.pieceCount(), 3);
+    EXPECT_EQ(buffer.size(), content.size() + count);
+
+    auto snapshot = buffer.snapshot();
+    auto start = snapshot->lines().lineStart(line);
+    EXPECT_EQ(snapshot->content().substr(start, count), std::string(count, 'x'));
+    EXPECT_EQ(buffer.pieceCount(), 1);
+
+    println("type {} chars into {} bytes: {:.1f}ms",
+            count,
+            content.size(),
+            std::chrono::duration<double, std::milli>(end - begin).count());
+}
+
+}  // namespace
+
+}  // namespace clice::testing
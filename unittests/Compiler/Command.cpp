@@ -31,6 +31,21 @@ TEST(clice, Command) {
     ASSERT_FALSE(bool(!result));
 }
 
+TEST(clice, InputFile) {
+    auto cwd = path::real_path(".");
+
+    /// Relative arguments are resolved against the working directory and normalized.
+    EXPECT_TRUE(isInputFile("main.cpp", path::join(cwd, "main.cpp")));
+    EXPECT_TRUE(isInputFile("src/../main.cpp", "main.cpp"));
+    EXPECT_TRUE(isInputFile(path::join(cwd, "main.cpp"), "main.cpp"));
+
+    /// A path which is only a string suffix of the source file is not the input.
+    EXPECT_FALSE(isInputFile("main.cpp", "/project/amain.cpp"));
+    EXPECT_FALSE(isInputFile("src/main.cpp", "/project/src/main.cpp"));
+    EXPECT_FALSE(isInputFile("-main.cpp", "main.cpp"));
+    EXPECT_FALSE(isInputFile("clang++", "main.cpp"));
+}
+
 }  // namespace
 
 }  // namespace clice::testing
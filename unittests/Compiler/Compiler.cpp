@@ -1,3 +1,5 @@
+#include <chrono>
+
 #include "Test/Test.h"
 #include "Compiler/Compilation.h"
 #include "Support/FileSystem.h"
@@ -12,6 +14,61 @@ TEST(Compiler, buildPCM) {}
 
 TEST(Compiler, codeCompleteAt) {}
 
+TEST(Compiler, InvocationCache) {
+    impl::clearInvocationCache();
+
+    CompilationParams params;
+    params.srcPath = "main.cpp";
+    params.command = "clang++ -std=c++20 -DTEST main.cpp";
+    auto invocation = impl::createInvocation(params);
+
+    CompilationParams params2;
+    params2.srcPath = "foo.cpp";
+    params2.command = "clang++ -std=c++20 -DTEST foo.cpp";
+    auto invocation2 = impl::createInvocation(params2);
+
+    auto statistics = impl::invocationCacheStatistics();
+    EXPECT_EQ(statistics.hits, 1);
+    EXPECT_EQ(statistics.misses, 1);
+
+    /// The cached invocation is retargeted to the new input file.
+    EXPECT_EQ(invocation->getFrontendOpts().Inputs[0].getFile(), "main.cpp");
+    EXPECT_EQ(invocation2->getFrontendOpts().Inputs[0].getFile(), "foo.cpp");
+    EXPECT_EQ(invocation2->getLangOpts().CPlusPlus20, true);
+
+    /// Different language is not shared.
+    CompilationParams params3;
+    params3.srcPath = "foo.c";
+    params3.command = "clang++ -std=c++20 -DTEST foo.c";
+    auto invocation3 = impl::createInvocation(params3);
+    EXPECT_EQ(impl::invocationCacheStatistics().misses, 2);
+}
+
+TEST(Compiler, InvocationCacheBenchmark) {
+    auto create = [](bool cached) {
+        auto begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < 100; ++i) {
+            if(!cached) {
+                impl::clearInvocationCache();
+            }
+
+            auto file = std::format("main{}.cpp", i);
+            CompilationParams params;
+            params.srcPath = file;
+            params.command = std::format("clang++ -std=c++20 -Wall -O2 -DNDEBUG {}", file);
+            auto instance = impl::createInstance(params);
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - begin).count();
+    };
+
+    auto uncached = create(false);
+    auto cached = create(true);
+    EXPECT_EQ(impl::invocationCacheStatistics().hits, 100);
+
+    println("createInstance x100, uncached: {:.1f}ms, cached: {:.1f}ms", uncached, cached);
+}
+
 }  // namespace
 
 }  // namespace clice::testing
@@ -47,6 +47,113 @@ export module test;
     EXPECT_EQ(pos, annotation.pos("end"));
 }
 
+TEST(Preamble, PreamblePatch) {
+    llvm::StringRef old = R"cpp(#include "a.h"
+#define X 1
+#include "b.h")cpp";
+
+    /// Add an include.
+    auto patch = computePreamblePatch(old,
+                                      R"cpp(#include "a.h"
+#define X 1
+#include "c.h"
+#include "b.h")cpp",
+                                      "main.cpp");
+    ASSERT_TRUE(patch.has_value());
+    EXPECT_EQ(patch->content, "#line 3 \"main.cpp\"\n#include \"c.h\"\n");
+    EXPECT_EQ(patch->added, 1);
+    EXPECT_EQ(patch->removed, 0);
+
+    /// Remove an include.
+    patch = computePreamblePatch(old,
+                                 R"cpp(#define X 1
+#include "b.h")cpp",
+                                 "main.cpp");
+    ASSERT_TRUE(patch.has_value());
+    EXPECT_EQ(patch->content, "");
+    EXPECT_EQ(patch->added, 0);
+    EXPECT_EQ(patch->removed, 1);
+
+    /// Other directives are changed.
+    patch = computePreamblePatch(old,
+                                 R"cpp(#include "a.h"
+#define X 2
+#include "b.h")cpp",
+                                 "main.cpp");
+    EXPECT_FALSE(patch.has_value());
+
+    /// Includes in conditional blocks could not be added or removed by the patch.
+    llvm::StringRef conditional = R"cpp(#include "a.h"
+#ifdef X
+#include "b.h"
+#endif)cpp";
+
+    patch = computePreamblePatch(conditional,
+                                 R"cpp(#include "a.h"
+#ifdef X
+#include "b.h"
+#include "c.h"
+#endif)cpp",
+                                 "main.cpp");
+    EXPECT_FALSE(patch.has_value());
+
+    patch = computePreamblePatch(conditional,
+                                 R"cpp(#include "a.h"
+#ifdef X
+#endif)cpp",
+                                 "main.cpp");
+    EXPECT_FALSE(patch.has_value());
+
+    /// But they are fine outside of the block.
+    patch = computePreamblePatch(conditional,
+                                 R"cpp(#ifdef X
+#include "b.h"
+#endif
+#include "c.h")cpp",
+                                 "main.cpp");
+    ASSERT_TRUE(patch.has_value());
+    EXPECT_EQ(patch->added, 1);
+    EXPECT_EQ(patch->removed, 1);
+
+    /// Directives in comments are not directives, and comments or spaces are ignored.
+    patch = computePreamblePatch(old,
+                                 R"cpp(#include "a.h" // comment
+/*
+#include "c.h"
+*/
+#  define X /* one */ 1
+// #include "d.h"
+#include "b.h")cpp",
+                                 "main.cpp");
+    ASSERT_TRUE(patch.has_value());
+    EXPECT_EQ(patch->content, "");
+    EXPECT_EQ(patch->added, 0);
+    EXPECT_EQ(patch->removed, 0);
+
+    /// Includes in `#if 0` blocks are conditional as well.
+    patch = computePreamblePatch(R"cpp(#include "a.h"
+#if 0
+#endif)cpp",
+                                 R"cpp(#include "a.h"
+#if 0
+#include "c.h"
+#endif)cpp",
+                                 "main.cpp");
+    EXPECT_FALSE(patch.has_value());
+
+    /// The added include is patched at its line, the comment after it is kept.
+    patch = computePreamblePatch(old,
+                                 R"cpp(#include "a.h"
+/* comment
+ */ #define X 1
+#include "b.h"
+
+#include <c.h> // comment)cpp",
+                                 "main.cpp");
+    ASSERT_TRUE(patch.has_value());
+    EXPECT_EQ(patch->content, "#line 6 \"main.cpp\"\n#include <c.h>\n");
+}
+
 TEST(Preamble, BuildPreambleForTU) {
     auto outPath = path::join(".", "main.pch");
     llvm::StringRef command = "clang++ -std=c++20 main.cpp";
@@ -92,8 +199,68 @@ int x = foo();
     }
 }
 
+TEST(Preamble, ComputeBounds) {
+    llvm::StringRef content = "#include \"a.h\"\n#include \\\n    \"b.h\"\nint x = 1;";
+
+    EXPECT_EQ(computeBounds(content, 0), content.size());
+    EXPECT_EQ(content.substr(0, computeBounds(content, 1)), "#include \"a.h\"\n");
+    EXPECT_EQ(content.substr(computeBounds(content, 2)), "int x = 1;");
+    EXPECT_EQ(computeBounds(content, 4), content.size());
+    EXPECT_EQ(computeBounds(content, 10), content.size());
+}
+
 TEST(Preamble, BuildPreambleForHeader) {
-    /// TODO: The key point is find interested file according to the header context.
+    auto outPath = path::join(".", "main.pch");
+    llvm::StringRef command = "clang++ -std=c++20 main.cpp";
+
+    llvm::StringRef test = R"cpp(
+int foo();
+)cpp";
+
+    llvm::StringRef header = R"cpp(
+int bar();
+)cpp";
+
+    llvm::StringRef content = R"cpp(#include "test.h"
+#include "header.h"
+int x = foo() + bar();
+int after();
+)cpp";
+
+    CompilationParams params;
+    params.outPath = outPath;
+    params.srcPath = "main.cpp";
+    params.content = content;
+    params.command = command;
+    params.remappedFiles.emplace_back(path::join(".", "test.h"), test);
+    params.remappedFiles.emplace_back(path::join(".", "header.h"), header);
+
+    /// Only the preamble before the directive including the header is precompiled.
+    auto bound = computeBounds(content, 2);
+    params.bound = computePreambleBound(content.substr(0, content.find("#include \"header.h\"")));
+
+    PCHInfo out;
+    {
+        auto info = compile(params, out);
+        ASSERT_TRUE(bool(info));
+        EXPECT_EQ(out.preamble, R"(#include "test.h")");
+    }
+
+    /// Code after the directive is not parsed.
+    {
+        params.bound = bound;
+        params.pch = {outPath, out.preamble.size()};
+        auto info = compile(params);
+        ASSERT_TRUE(bool(info));
+
+        auto lookup = [&](llvm::StringRef name) {
+            return !info->tu()->lookup(&info->context().Idents.get(name)).empty();
+        };
+        EXPECT_TRUE(lookup("foo"));
+        EXPECT_TRUE(lookup("bar"));
+        EXPECT_FALSE(lookup("x"));
+        EXPECT_FALSE(lookup("after"));
+    }
 }
 
 TEST(Preamble, BuildPreambleForMU) {
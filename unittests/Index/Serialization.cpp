@@ -1,4 +1,5 @@
 #include "Test/IndexTester.h"
+#include "Index/FeatureIndex.h"
 
 namespace clice::testing {
 
@@ -65,6 +66,37 @@ void $(2)foo() {}
     }
 }
 
+TEST(Index, Skipped) {
+    const char* code = R"cpp(
+#include "header.h"
+
+int y = x;
+)cpp";
+
+    IndexTester tester{"main.cpp", code};
+    tester.addFile(path::join(".", "header.h"), "int x = 1;");
+    tester.run();
+    auto& info = *tester.info;
+    auto main = info.getInterestedFile();
+    EXPECT_EQ(tester.indices.size(), 2);
+
+    /// Decls in skipped files are not traversed, the main file is still indexed.
+    llvm::DenseSet<clang::FileID> skipped;
+    for(auto& [fid, _]: tester.indices) {
+        if(fid != main) {
+            skipped.insert(fid);
+        }
+    }
+
+    auto indices = index::index(info, skipped);
+    ASSERT_EQ(indices.size(), 1);
+    EXPECT_TRUE(indices.contains(main));
+
+    auto features = index::indexFeature(info, skipped);
+    ASSERT_EQ(features.size(), 1);
+    EXPECT_TRUE(features.contains(main));
+}
+
 }  // namespace
 
 }  // namespace clice::testing
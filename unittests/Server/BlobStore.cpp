@@ -0,0 +1,113 @@
+#include "Test/Test.h"
+#include "Server/BlobStore.h"
+
+namespace clice::testing {
+
+namespace {
+
+TEST(BlobStore, Reference) {
+    BlobStore store("index");
+
+    auto a = BlobStore::key({1, 2}, {3, 4});
+    auto b = BlobStore::key({3, 4}, {1, 2});
+    EXPECT_NE(a, b);
+    EXPECT_EQ(store.path(a), path::join("index", std::format("{:016x}", a)));
+
+    std::vector<std::string> writes;
+    auto ensure = [&](std::uint64_t key) -> async::Task<bool> {
+        co_return co_await store.ensure(key, [&](std::string path) -> async::Task<bool> {
+            writes.emplace_back(std::move(path));
+            co_return true;
+        });
+    };
+
+    auto test = [&]() -> async::Task<> {
+        /// Only the first reference writes the files.
+        store.acquire(a);
+        store.acquire(a);
+        store.acquire(b);
+        EXPECT_TRUE(co_await ensure(a));
+        EXPECT_TRUE(co_await ensure(a));
+        EXPECT_TRUE(co_await ensure(b));
+        EXPECT_EQ(writes, (std::vector<std::string>{store.path(a), store.path(b)}));
+        EXPECT_EQ(store.references(a), 2);
+
+        store.release(a);
+        store.release(b);
+        EXPECT_EQ(store.references(a), 1);
+        EXPECT_EQ(store.references(b), 0);
+
+        /// An unreferenced index is kept until collected, acquiring it needs no write.
+        store.acquire(b);
+        EXPECT_TRUE(co_await ensure(b));
+        EXPECT_EQ(writes.size(), 2);
+        store.release(b);
+
+        std::vector<std::string> removed;
+        auto remove = [&](std::vector<std::string> paths) -> async::Task<> {
+            removed = std::move(paths);
+            co_return;
+        };
+        EXPECT_EQ(co_await store.collect(remove), 1);
+        EXPECT_EQ(removed, std::vector<std::string>{store.path(b)});
+        EXPECT_EQ(store.size(), 1);
+        EXPECT_EQ(co_await store.collect(remove), 0);
+
+        store.acquire(b);
+        EXPECT_TRUE(co_await ensure(b));
+        EXPECT_EQ(writes.size(), 3);
+    };
+
+    async::run(test());
+}
+
+TEST(BlobStore, Concurrent) {
+    BlobStore store("index");
+    auto key = BlobStore::key({1, 2}, {3, 4});
+
+    /// The second acquirer waits for the files being written by the first.
+    std::vector<std::string> events;
+    auto writer = [&](llvm::StringRef name) -> async::Task<> {
+        store.acquire(key);
+        bool success = co_await store.ensure(key, [&](std::string path) -> async::Task<bool> {
+            events.emplace_back(std::format("{} begin", name));
+            co_await async::sleep(std::chrono::milliseconds(10));
+            events.emplace_back(std::format("{} end", name));
+            co_return true;
+        });
+        EXPECT_TRUE(success);
+        events.emplace_back(std::format("{} done", name));
+    };
+
+    /// The index being removed is written again after removed.
+    auto collector = [&]() -> async::Task<> {
+        store.acquire(key, /*written=*/true);
+        store.release(key);
+        co_await store.collect([&](std::vector<std::string> paths) -> async::Task<> {
+            events.emplace_back("remove begin");
+            co_await async::sleep(std::chrono::milliseconds(10));
+            events.emplace_back("remove end");
+        });
+    };
+
+    std::vector<async::Task<>> tasks;
+    tasks.emplace_back(collector());
+    tasks.emplace_back(writer("a"));
+    tasks.emplace_back(writer("b"));
+    async::run(async::when_all(std::move(tasks)));
+
+    EXPECT_EQ(events,
+              (std::vector<std::string>{
+                  "remove begin",
+                  "remove end",
+                  "a begin",
+                  "a end",
+                  "a done",
+                  "b done",
+              }));
+    EXPECT_EQ(store.references(key), 2);
+}
+
+}  // namespace
+
+}  // namespace clice::testing
@@ -0,0 +1,257 @@
+#include "Test/Test.h"
+#include "Server/Cache.h"
+#include "Server/OverlayFS.h"
+#include "Compiler/Compilation.h"
+
+namespace clice::testing {
+
+namespace {
+
+TEST(Cache, SharePCH) {
+    config::CacheOptions options;
+    options.dir = path::join(".", "cache");
+    options.limit = 1;
+    auto error = fs::create_directories(options.dir);
+
+    CompilationDatabase database;
+    CacheController cache(options, database);
+
+    llvm::StringRef test = R"cpp(
+int foo();
+)cpp";
+
+    llvm::StringRef main = R"cpp(#include "test.h"
+int x = foo();
+)cpp";
+
+    llvm::StringRef main2 = R"cpp(#include "test.h"
+int y = foo();
+)cpp";
+
+    llvm::StringRef main3 = R"cpp(#include "test.h"
+#include <cstddef>
+int z = foo();
+)cpp";
+
+    auto prepare = [&](llvm::StringRef file, llvm::StringRef content) {
+        CompilationParams params;
+        params.srcPath = file;
+        params.content = content;
+        params.command = std::format("clang++ -std=c++20 {}", file);
+        params.remappedFiles.emplace_back(path::join(".", "test.h"), test);
+        async::run(cache.prepare(params));
+        return params.pch;
+    };
+
+    /// Files with the same preamble share the PCH.
+    auto [pch, bound] = prepare("main.cpp", main);
+    EXPECT_EQ(bound, computePreambleBound(main));
+    EXPECT_TRUE(fs::exists(pch));
+
+    auto [pch2, bound2] = prepare("main2.cpp", main2);
+    EXPECT_EQ(pch2, pch);
+    EXPECT_EQ(bound2, bound);
+
+    /// Referenced PCHs are not removed even if the limit is exceeded.
+    auto [pch3, bound3] = prepare("main3.cpp", main3);
+    EXPECT_NE(pch3, pch);
+    EXPECT_TRUE(fs::exists(pch));
+    EXPECT_TRUE(fs::exists(pch3));
+
+    cache.saveToDisk();
+
+    /// The least recently used PCH is removed once it is unreferenced.
+    cache.release("main.cpp");
+    cache.release("main2.cpp");
+    cache.collect();
+    EXPECT_FALSE(fs::exists(pch));
+    EXPECT_TRUE(fs::exists(pch3));
+
+    /// The PCH is reused after restart.
+    CacheController cache2(options, database);
+    cache2.loadFromDisk();
+
+    CompilationParams params;
+    params.srcPath = "main3.cpp";
+    params.content = main3;
+    params.command = "clang++ -std=c++20 main3.cpp";
+    params.remappedFiles.emplace_back(path::join(".", "test.h"), test);
+    async::run(cache2.prepare(params));
+    EXPECT_EQ(params.pch.first, pch3);
+}
+
+TEST(Cache, PatchPCH) {
+    config::CacheOptions options;
+    options.dir = path::join(".", "cache");
+    auto error = fs::create_directories(options.dir);
+
+    CompilationDatabase database;
+    CacheController cache(options, database);
+
+    llvm::StringRef test = R"cpp(
+int foo();
+)cpp";
+
+    llvm::StringRef test2 = R"cpp(
+int bar();
+)cpp";
+
+    llvm::StringRef test3 = R"cpp(
+int baz();
+)cpp";
+
+    auto compile = [&](llvm::StringRef content) {
+        CompilationParams params;
+        params.srcPath = "main.cpp";
+        params.content = content;
+        params.command = "clang++ -std=c++20 main.cpp";
+        params.remappedFiles.emplace_back(path::join(".", "test.h"), test);
+        params.remappedFiles.emplace_back(path::join(".", "test2.h"), test2);
+        params.remappedFiles.emplace_back(path::join(".", "test3.h"), test3);
+        async::run(cache.prepare(params));
+        return clice::compile(params);
+    };
+
+    auto visible = [](ASTInfo& info, llvm::StringRef name) {
+        return !info.tu()->lookup(&info.context().Idents.get(name)).empty();
+    };
+
+    auto info = compile(R"cpp(#include "test.h"
+#ifdef NEVER
+#endif
+int x = foo();
+)cpp");
+    ASSERT_TRUE(info.has_value());
+    EXPECT_EQ(cache.statistics().misses, 1);
+
+    /// Edits after the preamble reuse the PCH directly.
+    info = compile(R"cpp(#include "test.h"
+#ifdef NEVER
+#endif
+int y = foo();
+)cpp");
+    ASSERT_TRUE(info.has_value());
+    EXPECT_EQ(cache.statistics().hits, 1);
+
+    /// Adding an include is patched, the declarations of the new header are visible.
+    info = compile(R"cpp(#include "test.h"
+#include "test2.h"
+#ifdef NEVER
+#endif
+int z = foo() + bar();
+)cpp");
+    ASSERT_TRUE(info.has_value());
+    EXPECT_EQ(cache.statistics().patches, 1);
+    EXPECT_EQ(cache.statistics().misses, 1);
+    EXPECT_TRUE(visible(*info, "foo"));
+    EXPECT_TRUE(visible(*info, "bar"));
+
+    /// An include added in a false conditional block must not be included by the patch,
+    /// the PCH is rebuilt.
+    info = compile(R"cpp(#include "test.h"
+#include "test2.h"
+#ifdef NEVER
+#include "test3.h"
+#endif
+int w = foo() + bar();
+)cpp");
+    ASSERT_TRUE(info.has_value());
+    EXPECT_EQ(cache.statistics().patches, 1);
+    EXPECT_EQ(cache.statistics().misses, 2);
+    EXPECT_TRUE(visible(*info, "bar"));
+    EXPECT_FALSE(visible(*info, "baz"));
+}
+
+/// Module interface units and PCMs are written under a temporary directory.
+struct CacheModule : TempDirTest {
+    config::CacheOptions options;
+    CompilationDatabase database;
+
+    void SetUp() override {
+        TempDirTest::SetUp();
+        options.dir = path::join(dir, "cache");
+    }
+
+    std::string write(llvm::StringRef name, llvm::StringRef content) {
+        auto file = TempDirTest::write(name, content);
+        database.updateCommand(file, std::format("clang++ -std=c++20 {}", file));
+        return file;
+    }
+};
+
+TEST_F(CacheModule, Graph) {
+    write("A.cppm", "export module A;\nexport int a() { return 1; }\n");
+    write("B.cppm", "export module B;\nimport A;\nexport int b() { return a(); }\n");
+    write("C.cppm", "export module C;\nimport A;\nexport int c() { return a(); }\n");
+    write("D.cppm", "export module D;\nexport int d() { return 1; }\n");
+    async::run(database.scanModules());
+    EXPECT_EQ(database.modules().size(), 4);
+
+    CacheController cache(options, database);
+    auto prepare = [&](llvm::IntrusiveRefCntPtr<vfs::FileSystem> vfs = new ThreadSafeFS()) {
+        auto main = path::join(dir, "main.cpp");
+        CompilationParams params;
+        params.srcPath = main;
+        params.content = "import B;\nimport C;\nimport D;\nint x = b() + c() + d();\n";
+        params.command = std::format("clang++ -std=c++20 {}", main);
+        params.vfs = vfs;
+        async::run(cache.prepare(params));
+        EXPECT_TRUE(bool(compile(params)));
+        return params.pcms;
+    };
+
+    auto pcms = prepare();
+    ASSERT_EQ(pcms.size(), 4);
+
+    /// Nothing changed, all PCMs are reused.
+    auto pcms2 = prepare();
+    for(auto name: {"A", "B", "C", "D"}) {
+        EXPECT_EQ(pcms2[name], pcms[name]);
+    }
+
+    /// Only modules depending on the changed module are rebuilt.
+    write("A.cppm", "export module A;\nexport int a() { return 2; }\n");
+    auto pcms3 = prepare();
+    for(auto name: {"A", "B", "C"}) {
+        EXPECT_NE(pcms3[name], pcms[name]);
+    }
+    EXPECT_EQ(pcms3["D"], pcms["D"]);
+
+    /// Unsaved interface units are read through the given file system.
+    llvm::IntrusiveRefCntPtr<OverlayFS> overlay = new OverlayFS();
+    auto unsaved = "export module A;\nexport int a() { return 3; }\n";
+    overlay->open(path::join(dir, "A.cppm"), std::make_shared<TextSnapshot>(unsaved));
+    auto pcms4 = prepare(overlay);
+    for(auto name: {"A", "B", "C"}) {
+        EXPECT_NE(pcms4[name], pcms3[name]);
+    }
+    EXPECT_EQ(pcms4["D"], pcms["D"]);
+}
+
+TEST_F(CacheModule, Cycle) {
+    write("E.cppm", "export module E;\nimport F;\n");
+    write("F.cppm", "export module F;\nimport E;\n");
+    async::run(database.scanModules());
+
+    /// Two files enter the cycle from different modules concurrently, neither waits for
+    /// the other forever.
+    CacheController cache(options, database);
+    auto prepare = [&](llvm::StringRef name, llvm::StringRef content) -> async::Task<> {
+        auto main = path::join(dir, name);
+        CompilationParams params;
+        params.srcPath = main;
+        params.content = content;
+        params.command = std::format("clang++ -std=c++20 {}", main);
+        co_await cache.prepare(params);
+        EXPECT_TRUE(params.pcms.empty());
+    };
+
+    std::vector<async::Task<>> tasks;
+    tasks.emplace_back(prepare("cycle1.cpp", "import E;\n"));
+    tasks.emplace_back(prepare("cycle2.cpp", "import F;\n"));
+    async::run(async::when_all(std::move(tasks)));
+}
+
+}  // namespace
+
+}  // namespace clice::testing
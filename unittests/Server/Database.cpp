@@ -1,11 +1,188 @@
 #include "Test/Test.h"
 #include "Server/Database.h"
+#include "Compiler/Command.h"
 
 namespace clice::testing {
 
 namespace {
 
-TEST(CompilationDatabase, Command) {}
+struct CompilationDatabaseTest : TempDirTest {
+    /// Write the compile_commands.json under the sub directory, return the directory.
+    std::string writeCDB(llvm::StringRef name, llvm::StringRef content) {
+        return path::parent_path(write(path::join(name, "compile_commands.json"), content)).str();
+    }
+};
+
+TEST_F(CompilationDatabaseTest, Command) {
+    CompilationDatabase database;
+
+    auto update = [&](llvm::StringRef name, llvm::StringRef command) {
+        auto file = write(name, "");
+        database.updateCommand(file, std::vformat(command, std::make_format_args(file)));
+        return file;
+    };
+
+    auto a = update("a.cpp", "clang++ -std=c++20 -DA=1 -c {} -o a.o -MD -MF a.d");
+    auto b = update("b.cpp", "clang++ -std=c++20 -DA=1 -c {} -ob.o -MFb.d");
+    auto c = update("c.c", "clang -std=c11 -DA=1 -c {} -o c.o");
+    auto d = update("d.cpp", "clang++ -std=c++20 -DA=2 -c {} -o d.o");
+    auto e = update("e.cc", "clang++ -std=c++20 -DA=1 -c {} -o e.o");
+
+    /// Output and dependency file arguments are removed.
+    EXPECT_EQ(database.getCommand(a), std::format("clang++ -std=c++20 -DA=1 {}", a));
+    EXPECT_EQ(database.getCommand(b), std::format("clang++ -std=c++20 -DA=1 {}", b));
+
+    /// Files differ only in input and output share the command class.
+    auto id = database.getCommandClass(a);
+    EXPECT_NE(id, 0);
+    EXPECT_EQ(database.getCommandClass(b), id);
+    EXPECT_NE(database.getCommandClass(c), id);
+    EXPECT_NE(database.getCommandClass(d), id);
+    EXPECT_NE(database.getCommandClass(e), id);
+    EXPECT_EQ(database.getCommandClass("unknown.cpp"), 0);
+    EXPECT_EQ(database.classCount(), 4);
+
+    auto arguments = database.getClassArguments(id);
+    ASSERT_EQ(arguments.size(), 4);
+    EXPECT_EQ(arguments[3], "${input}.cpp");
+
+    /// Arguments are interned, `clang++`, `-std=c++20` and `-DA=1` are shared.
+    /// clang, clang++, -std=c11, -std=c++20, -DA=1, -DA=2, 3 placeholders, 5 inputs.
+    EXPECT_EQ(database.argumentCount(), 14);
+
+#ifndef _WIN32
+    /// Quoted arguments are kept as a whole, backslashes and quotes are escaped.
+    auto f = update("f.cpp", "clang++ '-DB=\"a b\"' {}");
+    EXPECT_EQ(database.getCommand(f), std::format("clang++ \"-DB=\\\"a b\\\"\" {}", f));
+
+    auto g = update("g.cpp", R"(clang++ "-DC='\"x\\y\"'" -DD=\\ {})");
+    auto command = database.getCommand(g);
+    EXPECT_EQ(command, std::format(R"(clang++ "-DC='\"x\\y\"'" "-DD=\\" {})", g));
+
+    /// The command is split back to the same arguments.
+    llvm::SmallString<1024> buffer;
+    llvm::SmallVector<const char*, 16> args;
+    ASSERT_TRUE(mangleCommand(command, args, buffer).has_value());
+    ASSERT_GE(args.size(), 4);
+    EXPECT_EQ(llvm::StringRef(args[1]), R"(-DC='"x\y"')");
+    EXPECT_EQ(llvm::StringRef(args[2]), R"(-DD=\)");
+    EXPECT_EQ(llvm::StringRef(args[3]), g);
+#else
+    /// Backslashes are path separators, only those before a quote are escaped.
+    auto f = update("f.cpp", R"(clang++ -IC:\include "-DB=\"a b\"" {})");
+    EXPECT_EQ(database.getCommand(f), std::format(R"(clang++ -IC:\include "-DB=\"a b\"" {})", f));
+#endif
+}
+
+TEST(CompilationDatabase, Quote) {
+    llvm::SmallVector<llvm::StringRef> arguments = {
+        "clang++",
+        R"(C:\path with space\a.cpp)",
+        R"(C:\trailing\)",
+        R"(-DA="x\"y")",
+        R"(-DB=\\)",
+        "-DC='z'",
+    };
+
+    std::string command;
+    for(auto argument: arguments) {
+        appendArgument(command, argument);
+    }
+
+    /// The command is split back to the same arguments on all platforms.
+    llvm::BumpPtrAllocator allocator;
+    llvm::StringSaver saver(allocator);
+    llvm::SmallVector<const char*> tokens;
+    tokenizeCommand(command, saver, tokens);
+    ASSERT_EQ(tokens.size(), arguments.size());
+    for(std::size_t i = 0; i < arguments.size(); ++i) {
+        EXPECT_EQ(llvm::StringRef(tokens[i]), arguments[i]);
+    }
+}
+
+TEST_F(CompilationDatabaseTest, Load) {
+    auto first = writeCDB("cdb1", R"json([
+    {
+        "directory": "/project/build",
+        "file": "../src/a.cpp",
+        "command": "clang++ -std=c++20 \"-DNAME=\\\"a b\\\"\" -I../include -include config.h -isystem /usr/include -iframework../fw -iframeworkwithsysroot fw -iwithprefixbefore../x -c ../src/a.cpp -o a.o",
+        "output": "a.o"
+    },
+    {
+        "directory": "/project/build",
+        "file": "/project/src/b.cpp",
+        "arguments": ["clang++", "-std=c++20", "-DS=\u00e9", "-c", "/project/src/b.cpp"],
+        "extra": {"nested": [1, 2, {"x": null}], "flag": true}
+    }
+])json");
+
+    auto second = writeCDB("cdb2", R"json([
+    {
+        "directory": "/project",
+        "file": "src/b.cpp",
+        "arguments": ["clang++", "-std=c++23", "src/b.cpp"]
+    }
+])json");
+
+    CompilationDatabase database;
+    async::run(database.loadCommands({first, second, path::join(dir, "missing")}));
+    EXPECT_EQ(database.size(), 2);
+
+    /// Relative paths are resolved against the directory in both forms, escapes are decoded.
+    /// Paths relative to the sysroot or the prefix are kept.
+    EXPECT_EQ(database.getCommand("/project/src/a.cpp"),
+              "clang++ -std=c++20 \"-DNAME=\\\"a b\\\"\" -I/project/include -include "
+              "/project/build/config.h -isystem /usr/include -iframework/project/fw "
+              "-iframeworkwithsysroot fw -iwithprefixbefore../x /project/src/a.cpp");
+
+    /// Later directories override the earlier ones.
+    EXPECT_EQ(database.getCommand("/project/src/b.cpp"),
+              "clang++ -std=c++23 /project/src/b.cpp");
+
+    /// Invalid files are skipped.
+    auto invalid = writeCDB("cdb3", R"json([{"file": "c.cpp", "command": )json");
+    async::run(database.updateCommands(path::join(invalid, "compile_commands.json")));
+    EXPECT_EQ(database.size(), 2);
+}
+
+TEST_F(CompilationDatabaseTest, LoadBenchmark) {
+    if(!benchmark()) {
+        GTEST_SKIP() << "writes about 20MB, run with --benchmark";
+    }
+
+    constexpr std::size_t count = 100000;
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(path::join(dir, "compile_commands.json"), ec);
+        os << "[\n";
+        for(std::size_t i = 0; i < count; ++i) {
+            os << std::format(R"json(    {{
+        "directory": "/project/build",
+        "file": "../src/module{0}/file{1}.cpp",
+        "command": "clang++ -std=c++20 -Wall -O2 -DNDEBUG -I../include -I../src/module{0} -c ../src/module{0}/file{1}.cpp -o file{1}.o"
+    }}{2}
+)json",
+                              i % 100,
+                              i,
+                              i + 1 == count ? "" : ",");
+        }
+        os << "]\n";
+    }
+
+    CompilationDatabase database;
+    auto begin = std::chrono::steady_clock::now();
+    async::run(database.loadCommands({dir}));
+    auto end = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(database.size(), count);
+    EXPECT_EQ(database.classCount(), 100);
+
+    println("load {} compile commands: {:.1f}ms, {} classes, {} arguments",
+            count,
+            std::chrono::duration<double, std::milli>(end - begin).count(),
+            database.classCount(),
+            database.argumentCount());
+}
 
 TEST(CompilationDatabase, Module) {}
 
@@ -0,0 +1,55 @@
+#include "Test/Test.h"
+#include "Server/IndexCache.h"
+
+namespace clice::testing {
+
+namespace {
+
+std::unique_ptr<llvm::MemoryBuffer> buffer(std::size_t size) {
+    return llvm::MemoryBuffer::getMemBufferCopy(std::string(size, 'x'));
+}
+
+TEST(IndexCache, Basic) {
+    IndexCache cache(0);
+    EXPECT_EQ(cache.get("a") == nullptr, true);
+
+    auto a = cache.put("a", buffer(10));
+    EXPECT_EQ(cache.get("a") == a, true);
+    EXPECT_EQ(cache.bytes(), 10);
+
+    /// Put replaces the old buffer.
+    cache.put("a", buffer(20));
+    EXPECT_EQ(cache.get("a") != a, true);
+    EXPECT_EQ(cache.bytes(), 20);
+    EXPECT_EQ(cache.count(), 1);
+
+    cache.invalidate("a");
+    EXPECT_EQ(cache.get("a") == nullptr, true);
+    EXPECT_EQ(cache.bytes(), 0);
+}
+
+TEST(IndexCache, Evict) {
+    IndexCache cache(30);
+    cache.put("a", buffer(10));
+    cache.put("b", buffer(10));
+    cache.put("c", buffer(10));
+
+    /// Touch `a`, so `b` becomes the least recently used one.
+    EXPECT_EQ(cache.get("a") != nullptr, true);
+
+    cache.put("d", buffer(10));
+    EXPECT_EQ(cache.get("b") == nullptr, true);
+    EXPECT_EQ(cache.get("a") != nullptr, true);
+    EXPECT_EQ(cache.get("c") != nullptr, true);
+    EXPECT_EQ(cache.get("d") != nullptr, true);
+    EXPECT_EQ(cache.bytes(), 30);
+
+    /// Evicted buffer is still alive while it is referenced.
+    auto e = cache.put("e", buffer(40));
+    EXPECT_EQ(e->getBufferSize(), 40);
+    EXPECT_EQ(cache.count(), 0);
+}
+
+}  // namespace
+
+}  // namespace clice::testing
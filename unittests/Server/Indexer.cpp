@@ -1,14 +1,32 @@
+#include <map>
+
 #include "Test/Test.h"
 #include "Server/Indexer.h"
 
 namespace clice::testing {
 
-TEST(Indexer, Basic) {
+/// Files and indices are written under a temporary directory, source files are added to
+/// the database.
+struct IndexerTest : TempDirTest {
     config::IndexOptions options;
-    options.dir = path::join(".", "temp");
-    auto error = fs::create_directories(options.dir);
-
     CompilationDatabase database;
+
+    void SetUp() override {
+        TempDirTest::SetUp();
+        options.dir = path::join(dir, "index");
+        auto error = fs::create_directories(options.dir);
+    }
+
+    std::string write(llvm::StringRef name, llvm::StringRef content) {
+        auto file = TempDirTest::write(name, content);
+        if(name.ends_with(".cpp")) {
+            database.updateCommand(file, std::format("clang++ {}", file));
+        }
+        return file;
+    }
+};
+
+TEST_F(IndexerTest, Basic) {
     auto prefix = path::join(test_dir(), "indexer");
     auto foo = path::real_path(path::join(prefix, "foo.cpp"));
     auto main = path::real_path(path::join(prefix, "main.cpp"));
@@ -44,4 +62,231 @@ TEST(Indexer, Basic) {
     EXPECT_EQ(result, result2);
 }
 
+TEST_F(IndexerTest, Outdated) {
+    auto shared = write("shared.h", "int x;");
+    auto a = write("a.cpp", "#include \"shared.h\"");
+    auto b = write("b.cpp", "#include \"shared.h\"");
+    auto c = write("c.cpp", "int y;");
+
+    Indexer indexer(options, database);
+    async::run(indexer.indexFiles({a, b, c}));
+
+    auto outdated = [&](std::vector<std::string> files) {
+        auto opened = [&](llvm::StringRef file) {
+            return file == b;
+        };
+        auto task = indexer.outdated(std::move(files), opened);
+        auto&& [result] = async::run(task);
+        return result;
+    };
+
+    /// Touching a file without changing its content does not make it outdated.
+    write("shared.h", "int x;");
+    EXPECT_EQ(outdated({shared}), std::vector<std::string>{});
+
+    /// A changed header makes all units including it outdated, opened files first.
+    write("shared.h", "int z;");
+    EXPECT_EQ(outdated({shared}), (std::vector<std::string>{b, a}));
+
+    async::run(indexer.update({shared}, [](llvm::StringRef) { return false; }));
+    EXPECT_EQ(outdated({shared}), std::vector<std::string>{});
+
+    write("c.cpp", "int w;");
+    EXPECT_EQ(outdated({c, shared}), std::vector<std::string>{c});
+}
+
+TEST_F(IndexerTest, SharedIndex) {
+    auto count = [&] {
+        std::size_t count = 0;
+        std::error_code ec;
+        for(fs::directory_iterator iter(options.dir, ec), end; !ec && iter != end;
+            iter.increment(ec)) {
+            count += path::extension(iter->path()) == ".sidx";
+        }
+        return count;
+    };
+
+    auto x = write("x.h", "int x;");
+    write("y.h", "int x;");
+    auto a = write("a.cpp", "#include \"x.h\"\nint a;");
+    auto b = write("b.cpp", "#include \"y.h\"\nint b;");
+
+    Indexer indexer(options, database);
+    async::run(indexer.indexFiles({a, b}));
+
+    /// The identical headers share one index, the units have their own.
+    auto initial = count();
+    EXPECT_EQ(initial, 3);
+
+    auto never = [](llvm::StringRef) {
+        return false;
+    };
+
+    /// A changed header gets a new index, the shared one is still used by the other.
+    write("x.h", "int y;");
+    async::run(indexer.update({x}, never));
+    EXPECT_EQ(count(), initial + 1);
+
+    /// The index of the old content is unused after it is reverted, and collected.
+    write("x.h", "int x;");
+    async::run(indexer.update({x}, never));
+    EXPECT_EQ(count(), initial);
+}
+
+TEST_F(IndexerTest, KnownInclusion) {
+    options.concurrency = 1;
+
+    auto header = write("header.h", "#ifdef A\nint a;\n#else\nint b;\n#endif\n");
+    auto a = write("a.cpp", "#define A\n#include \"header.h\"");
+    auto b = write("b.cpp", "#include \"header.h\"");
+    auto c = write("c.cpp", "#include \"header.h\"");
+
+    Indexer indexer(options, database);
+    async::run(indexer.indexFiles({b, c, a}));
+
+    /// The index of the header in each unit.
+    llvm::StringMap<std::int64_t> indices;
+    auto json = indexer.dumpToJSON();
+    for(auto& value: *json.getAsObject()->getArray("headers")) {
+        auto object = value.getAsObject();
+        if(*object->getString("srcPath") != header) {
+            continue;
+        }
+
+        for(auto& value: *object->getArray("contexts")) {
+            auto context = value.getAsObject();
+            auto& contexts = *context->getArray("contexts");
+            indices[*context->getString("tu")] = *contexts[0].getAsObject()->getInteger("index");
+        }
+    }
+
+    /// The inclusion in `c.cpp` has the same fingerprint as `b.cpp`, while the macro state
+    /// differs in `a.cpp`, so it is indexed again.
+    ASSERT_EQ(indices.size(), 3);
+    EXPECT_EQ(indices[b], indices[c]);
+    EXPECT_NE(indices[a], indices[b]);
+}
+
+TEST_F(IndexerTest, Persist) {
+    auto size = [&] {
+        std::uint64_t size = 0;
+        auto error = fs::file_size(path::join(options.dir, "index.bin"), size);
+        return size;
+    };
+
+    /// The index information in a stable order, the maps of the indexer are unordered.
+    auto summary = [](Indexer& indexer) {
+        std::map<std::string, std::string> result;
+        auto json = indexer.dumpToJSON();
+        auto& object = *json.getAsObject();
+        for(auto& value: *object.getArray("tus")) {
+            auto tu = value.getAsObject();
+            result[tu->getString("srcPath")->str()] = llvm::formatv("{0}", value).str();
+        }
+
+        for(auto& value: *object.getArray("headers")) {
+            auto header = value.getAsObject();
+            std::map<std::string, std::string> contexts;
+            for(auto& context: *header->getArray("contexts")) {
+                auto tu = context.getAsObject()->getString("tu")->str();
+                contexts[tu] = llvm::formatv("{0}", context).str();
+            }
+
+            auto& entry = result[header->getString("srcPath")->str()];
+            entry = llvm::formatv("{0}", *header->get("indices")).str();
+            for(auto& [_, context]: contexts) {
+                entry += context;
+            }
+        }
+
+        result["paths"] = llvm::formatv("{0}", *object.get("paths")).str();
+        return result;
+    };
+
+    auto never = [](llvm::StringRef) {
+        return false;
+    };
+
+    write("shared.h", "int x;");
+    std::vector<std::string> files;
+    for(int i = 0; i < 8; ++i) {
+        files.emplace_back(write(std::format("{}.cpp", i), "#include \"shared.h\"\nint y;"));
+    }
+
+    Indexer indexer(options, database);
+    async::run(indexer.indexFiles(files));
+    indexer.saveToDisk();
+    auto initial = size();
+    ASSERT_NE(initial, 0);
+
+    /// Only the changed unit is appended to the index file.
+    write("0.cpp", "#include \"shared.h\"\nint z;");
+    async::run(indexer.update({files[0]}, never));
+    indexer.saveToDisk();
+    EXPECT_GT(size(), initial);
+    EXPECT_LT(size() - initial, initial / 2);
+
+    /// The superseded records are compacted, the file does not grow without bound.
+    for(int i = 0; i < 20; ++i) {
+        write("0.cpp", std::format("#include \"shared.h\"\nint z{};", i));
+        async::run(indexer.update({files[0]}, never));
+        indexer.saveToDisk();
+        EXPECT_LT(size(), initial * 3);
+    }
+
+    Indexer indexer2(options, database);
+    indexer2.loadFromDisk();
+    EXPECT_EQ(summary(indexer), summary(indexer2));
+}
+
+TEST_F(IndexerTest, PauseResume) {
+    options.concurrency = 2;
+
+    std::vector<std::string> files;
+    for(auto name: {"a.cpp", "b.cpp", "c.cpp"}) {
+        files.emplace_back(write(name, "int x;"));
+    }
+
+    Indexer indexer(options, database);
+    indexer.pause();
+
+    auto yield = [] {
+        return async::suspend([](async::core_handle handle) { async::schedule(handle); });
+    };
+
+    std::size_t progress = 0;
+    std::optional<Indexer::Report> report;
+    auto test = [&]() -> async::Task<> {
+        auto run = [&]() -> async::Task<> {
+            report = co_await indexer.indexFiles(files, [&](std::size_t done, std::size_t total) {
+                progress = done;
+                EXPECT_EQ(total, 3);
+            });
+        };
+
+        /// Nothing is started before both workers are parked, then resume them.
+        auto control = [&]() -> async::Task<> {
+            while(indexer.pausedWorkers() != options.concurrency) {
+                co_await yield();
+            }
+            EXPECT_EQ(progress, 0);
+            indexer.resume();
+        };
+
+        std::vector<async::Task<>> tasks;
+        tasks.emplace_back(run());
+        tasks.emplace_back(control());
+        co_await async::when_all(std::move(tasks));
+    };
+
+    async::run(test());
+
+    ASSERT_TRUE(report.has_value());
+    EXPECT_EQ(indexer.pausedWorkers(), 0);
+    EXPECT_EQ(progress, 3);
+    EXPECT_EQ(report->files, 3);
+    EXPECT_EQ(report->indexed, 3);
+    EXPECT_NE(report->written, 0);
+}
+
 }  // namespace clice::testing
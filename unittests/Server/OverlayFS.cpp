@@ -0,0 +1,170 @@
+#include <chrono>
+
+#include "Test/Test.h"
+#include "Server/OverlayFS.h"
+#include "Compiler/Compilation.h"
+
+namespace clice::testing {
+
+namespace {
+
+struct OverlayFSTest : TempDirTest {
+    llvm::IntrusiveRefCntPtr<OverlayFS> vfs = new OverlayFS();
+
+    std::string read(llvm::StringRef file) {
+        auto result = vfs->openFileForRead(file);
+        if(!result) {
+            return "";
+        }
+        return (*(*result)->getBuffer(file))->getBuffer().str();
+    }
+};
+
+TEST_F(OverlayFSTest, Overlay) {
+    auto header = write("overlay/overlay.h", "int x;");
+    EXPECT_EQ(read(header), "int x;");
+
+    /// Opened documents are served from memory.
+    vfs->open(header, std::make_shared<TextSnapshot>("int y = 1;"));
+    EXPECT_EQ(read(header), "int y = 1;");
+    EXPECT_EQ(vfs->status(header)->getSize(), 10);
+    vfs->close(header);
+
+    /// The cached content is checked against the file on disk, so a change outside of
+    /// the editor is visible without invalidation.
+    EXPECT_EQ(read(header), "int x;");
+    write("overlay/overlay.h", "int zz;");
+    EXPECT_EQ(read(header), "int zz;");
+    vfs->invalidate(header);
+    EXPECT_EQ(read(header), "int zz;");
+
+    /// Unsaved documents are visible too, and not existing files are cached as well.
+    auto unsaved = path::join(dir, "overlay", "unsaved.h");
+    EXPECT_FALSE(vfs->exists(unsaved));
+    vfs->open(unsaved, std::make_shared<TextSnapshot>("int w;"));
+    EXPECT_TRUE(vfs->exists(unsaved));
+    EXPECT_EQ(read(path::join(dir, "overlay", "..", "overlay", "unsaved.h")), "int w;");
+    vfs->close(unsaved);
+    EXPECT_FALSE(vfs->exists(unsaved));
+}
+
+TEST_F(OverlayFSTest, Status) {
+    auto header = write("status.h", "int x;");
+    EXPECT_EQ(vfs->status(header)->getSize(), 6);
+    EXPECT_EQ(read(header), "int x;");
+
+    /// The status is refreshed with the content, they always describe the same file.
+    write("status.h", "int xyz;");
+    EXPECT_EQ(vfs->status(header)->getSize(), 8);
+    EXPECT_EQ(read(header), "int xyz;");
+    EXPECT_EQ(vfs->status(header)->getSize(), 8);
+
+    /// Only failures are cached until invalidated, e.g. a generated header.
+    auto generated = path::join(dir, "generated.h");
+    EXPECT_FALSE(vfs->exists(generated));
+    write("generated.h", "int y;");
+    EXPECT_FALSE(vfs->exists(generated));
+    vfs->invalidate(generated);
+    EXPECT_TRUE(vfs->exists(generated));
+    EXPECT_EQ(read(generated), "int y;");
+}
+
+TEST_F(OverlayFSTest, CompileBenchmark) {
+    constexpr std::size_t count = 50;
+    for(std::size_t i = 0; i < count; ++i) {
+        std::string content = "#pragma once\n#include <vector>\n";
+        if(i + 1 < count) {
+            content += std::format("#include \"header{}.h\"\n", i + 1);
+        }
+        write(std::format("header{}.h", i), content);
+    }
+
+    auto main = path::join(dir, "main.cpp");
+    std::string content = R"cpp(
+#include <map>
+#include <string>
+#include <iostream>
+#include "header0.h"
+)cpp";
+
+    auto& stats = vfs->statistics();
+
+    /// Return the count of stat and read syscalls.
+    auto run = [&] {
+        auto stat = stats.stats - stats.cachedStats;
+        auto read = stats.reads - stats.cachedReads;
+
+        CompilationParams params;
+        params.srcPath = main;
+        params.content = content;
+        params.command = std::format("clang++ -std=c++20 {}", main);
+        params.vfs = vfs;
+
+        auto begin = std::chrono::steady_clock::now();
+        auto info = compile(params);
+        auto end = std::chrono::steady_clock::now();
+        EXPECT_TRUE(info.has_value());
+
+        stat = stats.stats - stats.cachedStats - stat;
+        read = stats.reads - stats.cachedReads - read;
+        println("compile: stat syscalls {}, read syscalls {}, {:.1f}ms",
+                stat,
+                read,
+                std::chrono::duration<double, std::milli>(end - begin).count());
+        return std::pair(stat, read);
+    };
+
+    auto [stat, read] = run();
+    EXPECT_NE(read, 0);
+
+    /// Unchanged files are all served from the cache, but each is still checked by a stat.
+    /// The failures of probing include directories are not retried.
+    auto validations = stats.validations.load();
+    auto [restat, reread] = run();
+    EXPECT_EQ(reread, 0);
+    EXPECT_NE(stats.validations, validations);
+    EXPECT_GE(restat, stats.validations - validations);
+    EXPECT_LT(restat, stat);
+    println("total: stat {} (cached {}), read {} (cached {}, validations {})",
+            stats.stats.load(),
+            stats.cachedStats.load(),
+            stats.reads.load(),
+            stats.cachedReads.load(),
+            stats.validations.load());
+}
+
+TEST_F(OverlayFSTest, Eviction) {
+    std::vector<std::string> files;
+    for(int i = 0; i < 4; ++i) {
+        files.emplace_back(write(std::format("{}.h", i), std::string(100, 'x')));
+    }
+
+    /// At most 3 files and 250 bytes of content are cached.
+    vfs = new OverlayFS(new ThreadSafeFS(), 3, 250);
+    auto& stats = vfs->statistics();
+
+    /// Missing files are cached as well, and evicted like others.
+    for(int i = 0; i < 4; ++i) {
+        EXPECT_FALSE(vfs->exists(path::join(dir, std::format("missing{}.h", i))));
+    }
+    EXPECT_EQ(vfs->size(), 3);
+    EXPECT_EQ(stats.evictions, 1);
+
+    for(auto& file: files) {
+        auto result = vfs->openFileForRead(file);
+        ASSERT_TRUE(bool(result));
+    }
+    EXPECT_EQ(vfs->size(), 2);
+    EXPECT_EQ(vfs->memoryUsage(), 200);
+
+    /// The least recently used file is read again.
+    auto reads = stats.cachedReads.load();
+    auto result = vfs->openFileForRead(files[0]);
+    EXPECT_EQ(stats.cachedReads, reads);
+    result = vfs->openFileForRead(files[3]);
+    EXPECT_EQ(stats.cachedReads, reads + 1);
+}
+
+}  // namespace
+
+}  // namespace clice::testing
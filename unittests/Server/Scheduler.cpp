@@ -0,0 +1,314 @@
+#include "Test/Test.h"
+#include "Server/Scheduler.h"
+#include "Feature/DocumentSymbol.h"
+#include "Feature/FoldingRange.h"
+#include <latch>
+#include <semaphore>
+
+namespace clice::testing {
+
+namespace {
+
+struct SchedulerTest : TempDirTest {
+    config::ServerOptions options;
+    config::IndexOptions indexOptions;
+    CompilationDatabase database;
+
+    void SetUp() override {
+        TempDirTest::SetUp();
+        indexOptions.dir = path::join(dir, "index");
+        auto error = fs::create_directories(indexOptions.dir);
+    }
+
+    /// Write the source file and add its command.
+    std::string add(llvm::StringRef name, llvm::StringRef content = "") {
+        auto file = write(name, content);
+        if(name.ends_with(".cpp")) {
+            database.updateCommand(file, std::format("clang++ -std=c++20 {}", file));
+        }
+        return file;
+    }
+};
+
+TEST_F(SchedulerTest, ASTCache) {
+    auto main = add("main.cpp");
+    auto other = add("other.cpp");
+
+    options.debounce = 10;
+    options.astCacheLimit = 0;
+    Indexer indexer(indexOptions, database);
+    Scheduler scheduler(options, database, indexer, new OverlayFS(), {});
+
+    async::Event debounced;
+    scheduler.onDebounced = [&](llvm::StringRef) {
+        debounced.set();
+    };
+
+    auto lookup = [&](llvm::StringRef file, llvm::StringRef name) -> async::Task<bool> {
+        auto found = co_await scheduler.withAST(file, [&](ASTInfo& info) {
+            return !info.tu()->lookup(&info.context().Idents.get(name)).empty();
+        });
+        co_return found && *found;
+    };
+
+    auto test = [&]() -> async::Task<> {
+        auto& stats = scheduler.statistics();
+
+        co_await scheduler.open(main, "int x = 1;");
+        EXPECT_TRUE(co_await lookup(main, "x"));
+        EXPECT_EQ(stats.builds, 1);
+
+        /// Served by the cached AST.
+        EXPECT_FALSE(co_await lookup(main, "y"));
+        EXPECT_EQ(stats.builds, 1);
+        EXPECT_EQ(stats.hits, 1);
+
+        /// Continuous changes are debounced, only the latest content is built.
+        co_await scheduler.update(main, "int y = 1;");
+        co_await scheduler.update(main, "int z = 1;");
+        co_await debounced.wait();
+        debounced.reset();
+        EXPECT_EQ(stats.builds, 2);
+        EXPECT_TRUE(co_await lookup(main, "z"));
+        EXPECT_EQ(stats.hits, 2);
+
+        /// Requests never see an outdated AST, the debounced build is skipped then.
+        co_await scheduler.update(main, "int w = 1;");
+        EXPECT_TRUE(co_await lookup(main, "w"));
+        co_await debounced.wait();
+        debounced.reset();
+        EXPECT_EQ(stats.builds, 3);
+
+        /// The least recently used AST is dropped if the memory exceeds the budget.
+        options.astCacheLimit = 1;
+        std::string large(1024 * 1024, ' ');
+        co_await scheduler.open(other, large + "int a = 1;");
+        EXPECT_TRUE(co_await lookup(other, "a"));
+        EXPECT_EQ(stats.evictions, 1);
+
+        /// The dropped AST is rebuilt on demand.
+        EXPECT_TRUE(co_await lookup(main, "w"));
+        EXPECT_EQ(stats.builds, 5);
+
+        co_await scheduler.close(main);
+        co_await scheduler.close(other);
+        EXPECT_EQ(scheduler.memoryUsage(), 0);
+    };
+
+    async::run(test());
+}
+
+TEST_F(SchedulerTest, Cancel) {
+    auto main = add("main.cpp");
+
+    options.debounce = 200;
+    options.astCacheLimit = 0;
+    Indexer indexer(indexOptions, database);
+    Scheduler scheduler(options, database, indexer, new OverlayFS(), {});
+
+    auto lookup = [&](llvm::StringRef name,
+                      async::CancellationToken token) -> async::Task<std::optional<bool>> {
+        co_return co_await scheduler.withAST(
+            main,
+            [&](ASTInfo& info) {
+                return !info.tu()->lookup(&info.context().Idents.get(name)).empty();
+            },
+            token);
+    };
+
+    auto test = [&]() -> async::Task<> {
+        auto& stats = scheduler.statistics();
+
+        co_await scheduler.open(main, "int x = 1;");
+        EXPECT_EQ(co_await lookup("x", {}), true);
+        EXPECT_EQ(stats.builds, 1);
+
+        /// The request builds the changed content before the debounced build, the build
+        /// is aborted once the request is cancelled.
+        std::string content;
+        for(int i = 0; i < 20000; ++i) {
+            content += std::format("int y{} = {};\n", i, i);
+        }
+        co_await scheduler.update(main, content);
+
+        auto token = async::CancellationToken::create();
+        std::optional<bool> result = false;
+        auto request = [&]() -> async::Task<> {
+            result = co_await lookup("y0", token);
+        };
+
+        /// The request is suspended once the compilation is submitted to the thread pool.
+        auto cancel = [&]() -> async::Task<> {
+            token.cancel();
+            co_return;
+        };
+
+        std::vector<async::Task<>> tasks;
+        tasks.emplace_back(request());
+        tasks.emplace_back(cancel());
+        co_await async::when_all(std::move(tasks));
+        EXPECT_EQ(result, std::nullopt);
+        EXPECT_EQ(stats.builds, 1);
+        EXPECT_EQ(stats.cancellations, 1);
+
+        /// The aborted build is left to the next request.
+        EXPECT_EQ(co_await lookup("y0", {}), true);
+        EXPECT_EQ(stats.builds, 2);
+
+        co_await scheduler.close(main);
+    };
+
+    async::run(test());
+}
+
+TEST_F(SchedulerTest, Priority) {
+    auto main = add("main.cpp");
+
+    llvm::IntrusiveRefCntPtr<OverlayFS> vfs = new OverlayFS();
+    Indexer indexer(indexOptions, database);
+    Scheduler scheduler(options, database, indexer, vfs, {});
+
+    /// The thread pool has 4 workers in unit tests, see `unit_tests.cc`. All of them are
+    /// occupied until the gate is released, so later jobs are queued.
+    constexpr int workers = 4;
+    std::latch busy(workers);
+    std::counting_semaphore<> gate(0);
+    auto block = [&]() -> async::Task<> {
+        co_await async::submit(async::Priority::Background, [&] {
+            busy.count_down();
+            gate.acquire();
+        });
+    };
+
+    /// Saturate the background lane, like indexing the whole project. The compilation is
+    /// the only job looking up files, jobs running before it see no lookups.
+    constexpr std::size_t count = 32;
+    std::atomic<std::size_t> early = 0;
+    auto background = [&]() -> async::Task<> {
+        co_await async::submit(async::Priority::Background, [&] {
+            if(vfs->statistics().stats == 0) {
+                early += 1;
+            }
+        });
+    };
+
+    auto request = [&]() -> async::Task<> {
+        co_await scheduler.open(main, "int x = 1;");
+        auto found = co_await scheduler.withAST(main, [&](ASTInfo& info) {
+            return !info.tu()->lookup(&info.context().Idents.get("x")).empty();
+        });
+        EXPECT_EQ(found, true);
+        gate.release(workers - 1);
+        co_await scheduler.close(main);
+    };
+
+    auto yield = [] {
+        return async::suspend([](async::core_handle handle) { async::schedule(handle); });
+    };
+
+    auto test = [&]() -> async::Task<> {
+        std::vector<async::Task<>> tasks;
+        for(int i = 0; i < workers; ++i) {
+            tasks.emplace_back(block());
+            async::schedule(tasks.back().handle());
+        }
+        co_await yield();
+        busy.wait();
+
+        for(std::size_t i = 0; i < count; ++i) {
+            tasks.emplace_back(background());
+            async::schedule(tasks.back().handle());
+        }
+        /// Submitted after all background jobs.
+        tasks.emplace_back(request());
+        async::schedule(tasks.back().handle());
+
+        /// Each step of the request takes a loop iteration, the compilation is submitted
+        /// within a few of them. No IO is involved, so this is not timing dependent.
+        for(int i = 0; i < 32; ++i) {
+            co_await yield();
+        }
+
+        /// The only free worker must take the compilation before any queued job.
+        gate.release();
+
+        while(ranges::any_of(tasks, [](auto& task) { return !task.done(); })) {
+            co_await yield();
+        }
+    };
+
+    async::run(test());
+
+    EXPECT_EQ(early, 0);
+}
+
+TEST_F(SchedulerTest, HeaderContext) {
+    llvm::StringRef header = R"(#pragma once
+
+namespace ns {
+
+struct Foo {
+    int x;
+};
+
+}  // namespace ns
+)";
+
+    llvm::StringRef source = R"(#include "header.h"
+
+int main() {
+    return 0;
+}
+)";
+
+    auto headerPath = add("header.h", header);
+    auto main = add("main.cpp", source);
+
+    Indexer indexer(indexOptions, database);
+    Scheduler scheduler(options, database, indexer, new OverlayFS(), {});
+
+    SourceConverter converter;
+    std::optional<feature::folding_range::Result> ranges;
+    std::optional<proto::DocumentSymbolResult> symbols;
+
+    auto test = [&]() -> async::Task<> {
+        /// The header has no command, it is built in the context of the indexed source.
+        co_await indexer.index(main);
+        auto context = indexer.context(headerPath);
+        EXPECT_TRUE(context && context->srcPath == main);
+
+        co_await scheduler.open(headerPath, header);
+        co_await scheduler.withAST(headerPath, [&](ASTInfo& info) {
+            EXPECT_NE(info.getInterestedFile(), info.srcMgr().getMainFileID());
+            FoldingRangeParams params;
+            ranges = feature::folding_range::foldingRange(params, info, converter);
+            symbols = feature::documentSymbol(info, converter);
+        });
+        co_await scheduler.close(headerPath);
+    };
+
+    async::run(test());
+
+    /// The namespace and the struct in the header are folded.
+    ASSERT_TRUE(ranges.has_value());
+    auto folded = feature::folding_range::toLspResult(*ranges, header, converter);
+    ASSERT_EQ(folded.size(), 2);
+    EXPECT_EQ(folded[0].startLine, 2);
+    EXPECT_EQ(folded[0].endLine, 7);
+    EXPECT_EQ(folded[1].startLine, 4);
+    EXPECT_EQ(folded[1].endLine, 5);
+
+    /// Only the symbols of the header are reported, positions are relative to it.
+    ASSERT_TRUE(symbols.has_value());
+    ASSERT_EQ(symbols->size(), 1);
+    auto& ns = (*symbols)[0];
+    EXPECT_EQ(ns.name, "ns");
+    EXPECT_EQ(ns.range.start.line, 2);
+    ASSERT_EQ(ns.children.size(), 1);
+    EXPECT_EQ(ns.children[0].name, "Foo");
+    EXPECT_EQ(ns.children[0].range.start.line, 4);
+}
+
+}  // namespace
+
+}  // namespace clice::testing
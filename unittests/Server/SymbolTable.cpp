@@ -0,0 +1,95 @@
+#include "Test/Test.h"
+#include "Server/SymbolTable.h"
+
+namespace clice::testing {
+
+namespace {
+
+std::vector<std::string> indexPaths(const std::vector<SymbolTable::Entry>& entries) {
+    std::vector<std::string> paths;
+    for(auto& entry: entries) {
+        paths.emplace_back(entry.indexPath);
+    }
+    ranges::sort(paths);
+    return paths;
+}
+
+TEST(SymbolTable, Lookup) {
+    SymbolTable table;
+    table.update("a", "a.cpp", {1, 2, 3});
+    table.update("b", "b.cpp", {2, 3, 3, 4});
+    table.update("c", "c.h", {5});
+
+    EXPECT_EQ(table.size(), 3);
+    EXPECT_EQ(indexPaths(table.lookup({1})), std::vector<std::string>{"a"});
+    EXPECT_EQ(indexPaths(table.lookup({3})), std::vector<std::string>{"a", "b"});
+    EXPECT_EQ(indexPaths(table.lookup({1, 4})), std::vector<std::string>{"a", "b"});
+    EXPECT_EQ(indexPaths(table.lookup({6})), std::vector<std::string>{});
+
+    auto entries = table.lookup({5});
+    EXPECT_EQ(entries.size(), 1);
+    EXPECT_EQ(entries[0].srcPath, "c.h");
+}
+
+TEST(SymbolTable, Update) {
+    SymbolTable table;
+    table.update("a", "a.cpp", {1, 2});
+    table.update("b", "b.cpp", {2});
+
+    /// Update replaces all old symbols of the file.
+    table.update("a", "a.cpp", {3});
+    EXPECT_EQ(indexPaths(table.lookup({1})), std::vector<std::string>{});
+    EXPECT_EQ(indexPaths(table.lookup({2})), std::vector<std::string>{"b"});
+    EXPECT_EQ(indexPaths(table.lookup({3})), std::vector<std::string>{"a"});
+
+    table.remove("b", "b.cpp");
+    EXPECT_EQ(table.size(), 1);
+    EXPECT_EQ(indexPaths(table.lookup({2})), std::vector<std::string>{});
+
+    /// Removed slot is reused.
+    table.update("c", "c.cpp", {2, 3});
+    EXPECT_EQ(indexPaths(table.lookup({3})), std::vector<std::string>{"a", "c"});
+
+    /// An index file shared by sources is recorded for each of them.
+    table.update("c", "d.cpp", {2});
+    EXPECT_EQ(table.size(), 3);
+    EXPECT_EQ(table.lookup({2}).size(), 2);
+    table.remove("c", "c.cpp");
+    auto entries = table.lookup({2});
+    EXPECT_EQ(entries.size(), 1);
+    EXPECT_EQ(entries[0].srcPath, "d.cpp");
+}
+
+struct SymbolTableTest : TempDirTest {};
+
+TEST_F(SymbolTableTest, Persist) {
+    auto file = path::join(dir, "symbols.bin");
+
+    SymbolTable table;
+    table.update("a", "a.cpp", {1, 2});
+    table.update("b", "b.cpp", {2, 3});
+    table.saveToDisk(file);
+
+    SymbolTable table2;
+    table2.loadFromDisk(file);
+
+    EXPECT_EQ(table2.size(), 2);
+    EXPECT_EQ(indexPaths(table2.lookup({2})), std::vector<std::string>{"a", "b"});
+    EXPECT_EQ(indexPaths(table2.lookup({3})), std::vector<std::string>{"b"});
+    EXPECT_EQ(table2.lookup({1})[0].srcPath, "a.cpp");
+
+    /// A truncated table is discarded, the old content is dropped as well.
+    auto buffer = llvm::MemoryBuffer::getFile(file);
+    ASSERT_TRUE(bool(buffer));
+    auto content = (*buffer)->getBuffer();
+    table2.loadFromDisk(write("truncated.bin", content.drop_back(8)));
+    EXPECT_EQ(table2.size(), 0);
+
+    /// So is a file of other format.
+    table2.loadFromDisk(write("other.bin", std::string(content.size(), '\x01')));
+    EXPECT_EQ(table2.size(), 0);
+}
+
+}  // namespace
+
+}  // namespace clice::testing
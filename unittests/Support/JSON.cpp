@@ -3,6 +3,7 @@
 #include <set>
 #include <unordered_set>
 #include <vector>
+#include <chrono>
 
 #include "Test/Test.h"
 #include "Support/JSON.h"
@@ -218,6 +219,82 @@ TEST(JSON, StatefulSerde) {
     }
 }
 
+std::string stream(const auto& value) {
+    std::string buffer;
+    llvm::raw_string_ostream os(buffer);
+    json::OStream stream(os);
+    json::stream(stream, value);
+    return buffer;
+}
+
+TEST(JSON, Stream) {
+    enum class E { A, B, C };
+
+    struct A {
+        int x;
+        bool b;
+        double d;
+        E e;
+        std::string s;
+        std::vector<int> v;
+        std::map<std::string, int> m;
+    };
+
+    struct B {
+        A a;
+        std::vector<A> as;
+        std::unordered_map<std::string, std::set<int>> sets;
+    };
+
+    B input = {
+        {1, true, 0.5, E::B, "hello", {1, 2, 3}, {{"a", 1}, {"b", 2}}},
+        {{2, false, 1.5, E::C, "world", {}, {}}},
+        {},
+    };
+    input.sets["x"] = {1, 2};
+
+    auto result = json::parse(stream(input));
+    ASSERT_TRUE(bool(result));
+    EXPECT_EQ(*result, json::serialize(input));
+}
+
+TEST(JSON, StreamBenchmark) {
+    /// Same layout as `proto::SemanticTokens`.
+    struct SemanticTokens {
+        std::vector<std::uint32_t> data;
+    };
+
+    /// About 40k tokens, a large file.
+    SemanticTokens tokens;
+    for(std::uint32_t i = 0; i < 200000; ++i) {
+        tokens.data.emplace_back(i % 5 == 0 ? i % 17 : i % 120);
+    }
+
+    std::string expect;
+    auto begin = std::chrono::steady_clock::now();
+    for(int round = 0; round < 10; ++round) {
+        expect.clear();
+        llvm::raw_string_ostream os(expect);
+        os << json::serialize(tokens);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto serialize = std::chrono::duration<double>(end - begin).count();
+
+    std::string result;
+    begin = std::chrono::steady_clock::now();
+    for(int round = 0; round < 10; ++round) {
+        result = stream(tokens);
+    }
+    end = std::chrono::steady_clock::now();
+    auto streaming = std::chrono::duration<double>(end - begin).count();
+
+    EXPECT_EQ(result, expect);
+    println("size: {} bytes, serialize: {:.3f}s, stream: {:.3f}s",
+            expect.size(),
+            serialize,
+            streaming);
+}
+
 }  // namespace
 
 }  // namespace clice::testing